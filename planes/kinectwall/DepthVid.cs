@@ -8,7 +8,7 @@ using System.IO;
 
 namespace kinectwall
 {
-    class DepthVid
+    class DepthVid : IDisposable
     {
         private byte[] colorBuffer = null;
 
@@ -21,8 +21,12 @@ namespace kinectwall
         private Vector3[] depthTexColors = null;
         private Vector3[] depthNormals = null;
         private uint[] depthindices = null;
-        float[] normvals = null;
-        float[] depthCamPts = null;
+        // Per-pixel points and normal colours, pinned for ptslib to write
+        // into.
+        Vector3[] pixelPts = null;
+        Vector3[] pixelNormals = null;
+        GCHandle pixelPtsHandle;
+        GCHandle pixelNormalsHandle;
 
         Program program;
         Program programPlanes;
@@ -75,16 +79,32 @@ namespace kinectwall
         }
 
 
-        void CopyToVector(float[] floats, Vector3[] vectors)
+        // ptslib's VertexLayout: where each vertex attribute is written.
+        [StructLayout(LayoutKind.Sequential)]
+        struct VertexStream
         {
-            for (int vecIdx = 0; vecIdx < vectors.Length; ++vecIdx)
+            public IntPtr data;
+            public int stride;
+            public int format;
+
+            public VertexStream(IntPtr data)
             {
-                vectors[vecIdx].X = floats[vecIdx * 3];
-                vectors[vecIdx].Y = floats[vecIdx * 3 + 1];
-                vectors[vecIdx].Z = floats[vecIdx * 3 + 2];
+                this.data = data;
+                this.stride = 12;
+                this.format = VertexFloat3;
             }
         }
 
+        [StructLayout(LayoutKind.Sequential)]
+        struct VertexLayout
+        {
+            public VertexStream position;
+            public VertexStream color;
+            public VertexStream normal;
+        }
+
+        const int VertexFloat3 = 0;
+
         [DllImport("ptslib.dll")]
         public static extern void DepthFindEdges(IntPtr pDepthBuffer, IntPtr pOutNormals, int depthWidth, int depthHeight);
 
@@ -95,101 +115,125 @@ namespace kinectwall
         public static extern void DepthMakePlanes(IntPtr pDepthPts, IntPtr pOutVertices, IntPtr pOutTexCoords, int numVertices, out int vertexCnt,
             int px, int py, int depthWidth, int depthHeight);
 
-        [DllImport("msvcrt.dll", EntryPoint = "memcpy",
-        CallingConvention = CallingConvention.Cdecl, SetLastError = false)]
-        public static extern IntPtr memcpy(IntPtr dest, IntPtr src, UIntPtr count);
+        [DllImport("ptslib.dll")]
+        public static extern void DepthMakePlaneMesh(IntPtr pDepthPts, float[] outVertices, int maxVertices, out int vertexCnt,
+            uint[] outIndices, int maxIndices, out int indexCnt, float[] outGroupColors, int[] outGroupIndexStarts,
+            int maxGroups, out int groupCnt, int px, int py, int depthWidth, int depthHeight);
+
+        [DllImport("ptslib.dll")]
+        static extern void DepthFindNormalsLayout(IntPtr pDepthPts, ref VertexLayout layout, int ptx, int pty,
+            int depthWidth, int depthHeight);
+
+        [DllImport("ptslib.dll")]
+        static extern void DepthMakePlaneMeshLayout(IntPtr pDepthPts, ref VertexLayout layout, int maxVertices,
+            out int vertexCnt, IntPtr outIndices, int maxIndices, out int indexCnt, float[] outGroupColors,
+            int[] outGroupIndexStarts, int maxGroups, out int groupCnt, int px, int py, int depthWidth, int depthHeight);
+
+        [DllImport("ptslib.dll")]
+        public static extern IntPtr OpenDepthRecording(string path, int depthWidth, int depthHeight, int prefetchFrames);
+
+        [DllImport("ptslib.dll")]
+        public static extern void CloseDepthRecording(IntPtr recording);
+
+        [DllImport("ptslib.dll")]
+        public static extern int GetRecordingFrameCount(IntPtr recording);
+
+        [DllImport("ptslib.dll")]
+        public static extern long GetRecordingTimestamp(IntPtr recording, int frameIdx);
+
+        [DllImport("ptslib.dll")]
+        public static extern IntPtr GetRecordingFrame(IntPtr recording, int frameIdx);
 
         const int dWidth = 512;
         const int dHeight = 424;
-        byte[][] depthPtBytes;
-        long[] timeStamps;
+        // depth.out mapped by ptslib; frames are read in place.
+        IntPtr recording;
+        const int prefetchFrames = 8;
         IntPtr depthPtsPtr;
-        IntPtr depthNrmPtr;
-        IntPtr genVerticesPtr;
-        IntPtr genTexCoordsPtr;
-        float[] genverticesf;
-        float[] gentexcoordsf;
-        Vector3[] genvertices;
-        Vector3[] gentexcoords;
-        int genCount;
+        // Plane mesh: welded vertices coloured per merged group, written
+        // by ptslib straight into genVertexArray's mapped buffers.
+        float[] gengroupcolors;
+        int[] gengroupstarts;
+        int genVertexCount;
+        int genIndexCount;
+        int genGroupCount;
+        const int maxGroups = dWidth * dHeight / 4;
         int depthQuadCount;
         int numframes = 0;
 
         bool first = true;
+        bool disposed = false;
 
         public bool isPlaying = false;
 
         int frameIdx = 0;
         int lastFrame = -1;
-        const int bytesPerFrame = dWidth * dHeight * 3 * 4;
         const int maxQuads = 1000;
         const int bytesPerQuad = 4 * 3 * 4;
         Matrix4 lastViewProj;
         public long Render(Matrix4 viewProj)
         {
+            if (disposed)
+                return 0;
             if (first)
             {
-                depthPtsPtr = Marshal.AllocHGlobal(bytesPerFrame);
-                depthNrmPtr = Marshal.AllocHGlobal(bytesPerFrame);
-                genVerticesPtr = Marshal.AllocHGlobal(depthQuads.Length * 12);
-                genTexCoordsPtr = Marshal.AllocHGlobal(depthQuads.Length * 12);
-                FileStream fs = new FileStream(App.DepthFile, FileMode.Open, FileAccess.Read);
-                numframes = (int)fs.Length / (bytesPerFrame + 8);
-                depthPtBytes = new byte[numframes][];
-                timeStamps = new long[numframes];
-                byte[] timestampbytes = new byte[8];
-                for (int idx = 0; idx < depthPtBytes.Length; ++idx)
-                {
-                    fs.Read(timestampbytes, 0, timestampbytes.Length);
-                    timeStamps[idx] = BitConverter.ToInt64(timestampbytes, 0);
-                    depthPtBytes[idx] = new byte[bytesPerFrame];
-                    fs.Read(depthPtBytes[idx], 0, bytesPerFrame);
-                }
-                normvals = new float[dWidth * dHeight * 3];
-                depthCamPts = new float[dWidth * dHeight * 3];
-                fs.Close();
-                genverticesf = new float[depthQuads.Length * 3];
-                gentexcoordsf = new float[depthQuads.Length * 3];
-                genvertices = new Vector3[depthQuads.Length];
-                gentexcoords = new Vector3[depthQuads.Length];
+                recording = OpenDepthRecording(App.DepthFile, dWidth, dHeight, prefetchFrames);
+                if (recording == IntPtr.Zero)
+                    throw new IOException("Cannot open " + App.DepthFile);
+                numframes = GetRecordingFrameCount(recording);
+                pixelPts = new Vector3[dWidth * dHeight];
+                pixelNormals = new Vector3[dWidth * dHeight];
+                pixelPtsHandle = GCHandle.Alloc(pixelPts, GCHandleType.Pinned);
+                pixelNormalsHandle = GCHandle.Alloc(pixelNormals, GCHandleType.Pinned);
+                gengroupcolors = new float[maxGroups * 3];
+                gengroupstarts = new int[maxGroups + 1];
                 first = false;
             }
 
             if (frameIdx != lastFrame || needRefresh)
             {
-                Marshal.Copy(depthPtBytes[frameIdx % numframes], 0, depthPtsPtr, depthPtBytes[frameIdx % numframes].Length);
-                DepthFindNormals(depthPtsPtr, depthNrmPtr, this.pickXPt, this.pickYPt, dWidth, dHeight);
-                DepthMakePlanes(depthPtsPtr, genVerticesPtr, genTexCoordsPtr, depthQuads.Length, out genCount,
-                    this.pickXPt, this.pickYPt, dWidth, dHeight);
-
-                Marshal.Copy(genVerticesPtr, genverticesf, 0, genvertices.Length);
-                CopyToVector(genverticesf, genvertices);
-                Marshal.Copy(genTexCoordsPtr, gentexcoordsf, 0, gentexcoords.Length);
-                CopyToVector(gentexcoordsf, gentexcoords);
-                genVertexArray.UpdatePositions(genvertices);
-                genVertexArray.UpdateTexCoords(gentexcoords);
-
-                Marshal.Copy(depthNrmPtr, normvals, 0, normvals.Length);
-                Marshal.Copy(depthPtsPtr, depthCamPts, 0, depthCamPts.Length);
-
+                depthPtsPtr = GetRecordingFrame(recording, frameIdx % numframes);
+                if (depthPtsPtr == IntPtr.Zero)
+                    throw new IOException("Cannot read frame " + frameIdx % numframes + " of " + App.DepthFile);
+                // Normal colours and points arrive as Vector3s, without
+                // a float[] in between.
+                VertexLayout pixelLayout = new VertexLayout();
+                pixelLayout.position = new VertexStream(pixelPtsHandle.AddrOfPinnedObject());
+                pixelLayout.color = new VertexStream(pixelNormalsHandle.AddrOfPinnedObject());
+                DepthFindNormalsLayout(depthPtsPtr, ref pixelLayout, this.pickXPt, this.pickYPt, dWidth, dHeight);
+
+                // The mesh buffers hold as many vertices and indices as
+                // depthQuads, from their creation.
+                VertexLayout genLayout = new VertexLayout();
+                genLayout.position = new VertexStream(genVertexArray.MapPositions(depthQuads.Length));
+                genLayout.color = new VertexStream(genVertexArray.MapTexCoords(depthQuads.Length));
+                IntPtr genIndicesPtr = genVertexArray.MapElements(depthQuads.Length);
+                // A buffer that could not be mapped leaves the planes
+                // undrawn this frame.
+                if (genLayout.position.data != IntPtr.Zero && genLayout.color.data != IntPtr.Zero &&
+                    genIndicesPtr != IntPtr.Zero)
+                {
+                    DepthMakePlaneMeshLayout(depthPtsPtr, ref genLayout, depthQuads.Length, out genVertexCount,
+                        genIndicesPtr, depthQuads.Length, out genIndexCount, gengroupcolors, gengroupstarts,
+                        maxGroups, out genGroupCount, this.pickXPt, this.pickYPt, dWidth, dHeight);
+                }
+                else
+                    genVertexCount = genIndexCount = genGroupCount = 0;
+                genVertexArray.Unmap();
 
                 int depthQuadIdx = 0;
-                int npts = depthCamPts.Length / 3;
+                int npts = pixelPts.Length;
                 for (int idx = 0; idx < npts; ++idx)
                 {
-                    if (!(float.IsInfinity(depthCamPts[idx * 3])))
+                    if (!(float.IsInfinity(pixelPts[idx].X)))
                     {
-                        Vector3 dpth = new Vector3(depthCamPts[idx * 3],
-                            depthCamPts[idx * 3 + 1],
-                            depthCamPts[idx * 3 + 2]);
+                        Vector3 dpth = pixelPts[idx];
 
                         Vector3 texCol = Vector3.Zero;
 
                         for (int qIdx = 0; qIdx < _Quad.Length; ++qIdx)
                         {
-                            depthNormals[depthQuadIdx + qIdx] = new Vector3(normvals[idx * 3],
-                                normvals[idx * 3 + 1],
-                                normvals[idx * 3 + 2]);
+                            depthNormals[depthQuadIdx + qIdx] = pixelNormals[idx];
                             depthQuads[depthQuadIdx + qIdx] = dpth + _Quad[qIdx] * 0.005f;
                             depthTexColors[depthQuadIdx + qIdx] = texCol;
                         }
@@ -207,26 +251,44 @@ namespace kinectwall
 
             programPlanes.Use(0);
             programPlanes.SetMat4("uMVP", ref viewProj);
-            genVertexArray.Draw(0, genCount);
+            genVertexArray.Draw(0, genIndexCount);
             /*
             GL.UseProgram(program.ProgramName);
             GL.UniformMatrix4(program.LocationMVP, false, ref viewProj);
 
             ptsVertexArray.Draw(depthQuadCount);*/
             lastViewProj = viewProj;
-            long timestamp = timeStamps[frameIdx % numframes];
+            long timestamp = GetRecordingTimestamp(recording, frameIdx % numframes);
             if (isPlaying)
                 frameIdx++;
             return timestamp;
         }
 
+        // Closes the recording and unpins the per-pixel buffers.
+        public void Dispose()
+        {
+            if (recording != IntPtr.Zero)
+            {
+                CloseDepthRecording(recording);
+                recording = IntPtr.Zero;
+                depthPtsPtr = IntPtr.Zero;
+            }
+            if (pixelPtsHandle.IsAllocated)
+                pixelPtsHandle.Free();
+            if (pixelNormalsHandle.IsAllocated)
+                pixelNormalsHandle.Free();
+            disposed = true;
+        }
+
         void FindDepthPt(Vector2 pt)
         {
+            if (recording == IntPtr.Zero)
+                return;
+            IntPtr framePtr = GetRecordingFrame(recording, frameIdx % numframes);
+            if (framePtr == IntPtr.Zero)
+                return;
             float[] pts = new float[dWidth * dHeight * 3];
-            IntPtr tmpBuf = Marshal.AllocHGlobal(depthPtBytes[frameIdx % numframes].Length);
-            Marshal.Copy(depthPtBytes[frameIdx % numframes], 0, tmpBuf, depthPtBytes[frameIdx % numframes].Length);
-            Marshal.Copy(tmpBuf, pts, 0, pts.Length);
-            Marshal.FreeHGlobal(tmpBuf);
+            Marshal.Copy(framePtr, pts, 0, pts.Length);
             pt = (pt - new Vector2(0.5f, 0.5f)) * 2;
             pt.Y = -pt.Y;
             float minLenSq = float.MaxValue;
@@ -202,6 +202,23 @@ namespace GLObjects
         }
 
         public abstract void Update(object vectors);
+        // Uploads only the first count elements.
+        public abstract void Update(object vectors, int count);
+        // Maps the first count elements for writing, discarding the
+        // buffer's contents, so native code can fill it in place. Unmap
+        // before drawing. IntPtr.Zero if the buffer could not be mapped.
+        public abstract IntPtr Map(int count);
+
+        public void Unmap()
+        {
+            if (!isMapped)
+                return;
+            GL.BindBuffer(BufferTarget.CopyWriteBuffer, BufferName);
+            GL.UnmapBuffer(BufferTarget.CopyWriteBuffer);
+            isMapped = false;
+        }
+
+        protected bool isMapped;
     }
 
     public class Buffer<T> : BufferBase where T : struct
@@ -230,6 +247,24 @@ namespace GLObjects
             // Set buffer information, 'buffer' is pinned automatically
             GL.BufferData(BufferTarget.ArrayBuffer, (int)(SizeOf<T>() * vectors.Length), vectors, BufferUsageHint.StaticDraw);
         }
+
+        public override void Update(object vecs, int count)
+        {
+            T[] vectors = vecs as T[];
+            GL.BindBuffer(BufferTarget.ArrayBuffer, BufferName);
+            GL.BufferData(BufferTarget.ArrayBuffer, (int)(SizeOf<T>() * count), vectors, BufferUsageHint.StaticDraw);
+        }
+
+        public override IntPtr Map(int count)
+        {
+            // The copy target leaves the array and element bindings of the
+            // bound vertex array alone.
+            GL.BindBuffer(BufferTarget.CopyWriteBuffer, BufferName);
+            IntPtr ptr = GL.MapBufferRange(BufferTarget.CopyWriteBuffer, IntPtr.Zero, (IntPtr)(SizeOf<T>() * count),
+                BufferAccessMask.MapWriteBit | BufferAccessMask.MapInvalidateBufferBit);
+            isMapped = ptr != IntPtr.Zero;
+            return ptr;
+        }
     }
     
     public class Texture : IDisposable
@@ -573,6 +608,52 @@ namespace GLObjects
             _BufferTexCoords0.Update(texcoords);
         }
 
+        public void UpdatePositions(Vector3[] positions, int count)
+        {
+            _BufferPosition.Update(positions, count);
+        }
+
+        public void UpdateTexCoords(Vector3[] texcoords, int count)
+        {
+            _BufferTexCoords0.Update(texcoords, count);
+        }
+
+        public void UpdateElements(uint[] elems, int count)
+        {
+            _BufferElems.Update(elems, count);
+        }
+
+        // Pointers to write the first count elements of each buffer to in
+        // place, valid until Unmap, or IntPtr.Zero where mapping failed.
+        // The buffers keep the size they were created or last updated with.
+        public IntPtr MapPositions(int count)
+        {
+            return _BufferPosition.Map(count);
+        }
+
+        public IntPtr MapTexCoords(int count)
+        {
+            return _BufferTexCoords0.Map(count);
+        }
+
+        public IntPtr MapNormals(int count)
+        {
+            return _BufferNormal.Map(count);
+        }
+
+        public IntPtr MapElements(int count)
+        {
+            return _BufferElems.Map(count);
+        }
+
+        public void Unmap()
+        {
+            _BufferPosition.Unmap();
+            _BufferTexCoords0?.Unmap();
+            _BufferNormal?.Unmap();
+            _BufferElems?.Unmap();
+        }
+
         void BuildWireframeElems()
         {
             List<uint> wireframeElems = new List<uint>();
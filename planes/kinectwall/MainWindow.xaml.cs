@@ -673,6 +673,11 @@ namespace kinectwall
         /// <param name="e">event arguments</param>
         private void MainWindow_Closing(object sender, CancelEventArgs e)
         {
+            if (depthVid != null)
+            {
+                depthVid.Dispose();
+                depthVid = null;
+            }
         }
 
         private void backBtn_Click(object sender, RoutedEventArgs e)
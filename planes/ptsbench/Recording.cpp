@@ -0,0 +1,186 @@
+#include "Recording.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+bool WriteRecordingFrame(FILE* file, long long timestamp, const Pt* pts, int width, int height)
+{
+    size_t numPts = (size_t)width * height;
+    return fwrite(&timestamp, sizeof(timestamp), 1, file) == 1 &&
+        fwrite(pts, sizeof(Pt), numPts, file) == numPts;
+}
+
+namespace
+{
+    // Distance along the ray to the plane dot(p, n) = d, or inf if it is behind the camera.
+    float RayPlane(const Pt& dir, const Pt& n, float d)
+    {
+        float denom = Dot(dir, n);
+        if (denom == 0)
+            return std::numeric_limits<float>::infinity();
+        float t = d / denom;
+        return t > 0 ? t : std::numeric_limits<float>::infinity();
+    }
+
+    unsigned int NextRand(unsigned int& state)
+    {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    }
+
+    struct Box
+    {
+        float lo[3];
+        float hi[3];
+    };
+
+    // Ray parameter where dir enters the box, or inf if it misses.
+    float RayBox(const Pt& dir, const Box& box)
+    {
+        const float inf = std::numeric_limits<float>::infinity();
+        float tnear = 0, tfar = inf;
+        const float d[3] = { dir.x, dir.y, dir.z };
+        for (int a = 0; a < 3; ++a)
+        {
+            float t0 = box.lo[a] / d[a];
+            float t1 = box.hi[a] / d[a];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tnear = std::max(tnear, t0);
+            tfar = std::min(tfar, t1);
+        }
+        return (tnear <= tfar && tnear > 0) ? tnear : inf;
+    }
+
+    float RandRange(unsigned int& rnd, float lo, float hi)
+    {
+        return lo + (hi - lo) * ((NextRand(rnd) & 0xFFFF) / 65535.0f);
+    }
+}
+
+void MakeSyntheticFrame(int frameIdx, int width, int height, Pt* outPts, int clutter)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    // Kinect v2 depth intrinsics, rescaled for other resolutions.
+    float fx = 365.0f * width / 512.0f;
+    float fy = 365.0f * height / 424.0f;
+    float cx = width * 0.5f;
+    float cy = height * 0.5f;
+
+    float boxX = -0.4f + 0.3f * (float)sin(frameIdx * 0.05);
+    std::vector<Box> boxes(1);
+    boxes[0] = Box{ { boxX, -1.2f, 2.2f }, { boxX + 0.6f, -0.5f, 2.8f } };
+
+    // Clutter is the same every frame.
+    unsigned int clutterRnd = 0x2468aceu;
+    for (int idx = 0; idx < clutter; ++idx)
+    {
+        Box box;
+        float size = RandRange(clutterRnd, 0.05f, 0.25f);
+        box.lo[0] = RandRange(clutterRnd, -1.8f, 2.0f);
+        if (idx % 2 == 0)
+        {
+            // On the floor.
+            box.lo[1] = -1.2f;
+            box.lo[2] = RandRange(clutterRnd, 1.5f, 3.8f);
+        }
+        else
+        {
+            // Against the back wall.
+            box.lo[1] = RandRange(clutterRnd, -1.0f, 1.2f);
+            box.lo[2] = 4.0f - size;
+        }
+        box.hi[0] = box.lo[0] + size;
+        box.hi[1] = box.lo[1] + size * RandRange(clutterRnd, 0.5f, 2.0f);
+        box.hi[2] = box.lo[2] + size;
+        boxes.push_back(box);
+    }
+
+    unsigned int rnd = 0x1234567u + frameIdx * 7919u;
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            Pt dir((x - cx) / fx, (cy - y) / fy, 1.0f);
+            float t = inf;
+            t = std::min(t, RayPlane(dir, Pt(0, 1, 0), -1.2f));
+            t = std::min(t, RayPlane(dir, Pt(0, 0, 1), 4.0f));
+            t = std::min(t, RayPlane(dir, Pt(1, 0, 0), -2.0f));
+            t = std::min(t, RayPlane(dir, Pt(1, 0, 0), 2.5f));
+
+            for (const Box& box : boxes)
+                t = std::min(t, RayBox(dir, box));
+
+            Pt& out = outPts[y * width + x];
+            // Edge of the sensor's field of view has no depth, like a real frame.
+            bool vignette = (x < 4 || x >= width - 4 || y < 2 || y >= height - 2);
+            if (vignette || t == inf || t * dir.z > 4.5f)
+            {
+                out = Pt(-inf, -inf, -inf);
+                continue;
+            }
+            float noise = ((NextRand(rnd) & 0xFFFF) / 65535.0f - 0.5f) * 0.004f;
+            out = dir * (t + noise);
+        }
+    }
+}
+
+void AddDepthNoise(int frameIdx, Pt* pts, size_t numPts, float sigma)
+{
+    unsigned int rnd = 0x13579bdu + frameIdx * 104729u;
+    for (size_t idx = 0; idx < numPts; ++idx)
+    {
+        Pt& pt = pts[idx];
+        if (!pt.IsValid())
+            continue;
+        // Sum of four uniforms: variance 4 / 12, close enough to normal.
+        float g = 0;
+        for (int sample = 0; sample < 4; ++sample)
+            g += (NextRand(rnd) & 0xFFFF) / 65535.0f - 0.5f;
+        float noise = g * sigma * 1.7320508f;
+        pt *= (pt.z + noise) / pt.z;
+    }
+}
+
+void AddFlyingPixels(int frameIdx, Pt* pts, int width, int height, float fraction)
+{
+    unsigned int rnd = 0x2b7e151u + frameIdx * 6151u;
+    std::vector<float> depth((size_t)width * height);
+    for (size_t idx = 0; idx < depth.size(); ++idx)
+        depth[idx] = pts[idx].IsValid() ? pts[idx].z : 0;
+    for (int y = 1; y < height - 1; ++y)
+    {
+        for (int x = 1; x < width - 1; ++x)
+        {
+            int idx = y * width + x;
+            if (depth[idx] == 0)
+                continue;
+            // The step across the pixel, horizontally or vertically.
+            float lo = 0, hi = 0;
+            for (int step : { 1, width })
+            {
+                float a = depth[idx - step], b = depth[idx + step];
+                if (a != 0 && b != 0 && fabsf(a - b) > hi - lo)
+                {
+                    lo = std::min(a, b);
+                    hi = std::max(a, b);
+                }
+            }
+            if (hi - lo <= 0.1f || (NextRand(rnd) & 0xFFFF) >= fraction * 65536.0f)
+                continue;
+            float mix = lo + (hi - lo) * RandRange(rnd, 0.2f, 0.8f);
+            pts[idx] *= mix / depth[idx];
+        }
+    }
+}
+
+void PointsToDepth(const Pt* pts, int width, int height, unsigned short* outDepth)
+{
+    for (int idx = 0; idx < width * height; ++idx)
+    {
+        Pt pt = pts[idx];
+        outDepth[idx] = pt.IsValid() ?
+            (unsigned short)std::min(65535.0f, pt.z * 1000.0f) : 0;
+    }
+}
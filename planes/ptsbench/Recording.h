@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+#include "Pt.h"
+
+const int depthFrameWidth = 512;
+const int depthFrameHeight = 424;
+
+// Appends one frame in the depth.out layout that OpenDepthRecording reads:
+// an int64 timestamp followed by width * height camera-space points.
+bool WriteRecordingFrame(FILE* file, long long timestamp, const Pt* pts, int width, int height);
+
+// Procedural room (floor, three walls and a moving box) in the same
+// camera-space convention as the Kinect CoordinateMapper, including
+// -inf for pixels with no depth. clutter adds that many small static boxes
+// on the floor and back wall, which drives the quadtree much deeper.
+void MakeSyntheticFrame(int frameIdx, int width, int height, Pt* outPts, int clutter = 0);
+
+// Moves every valid point along its ray by roughly Gaussian noise with
+// standard deviation sigma metres, the same for a given frameIdx.
+void AddDepthNoise(int frameIdx, Pt* pts, size_t numPts, float sigma);
+
+// Replaces that fraction of the pixels beside a depth step of more than
+// 0.1 m with a mix of the depths on either side, like the flying pixels
+// the Kinect returns along silhouettes. The same for a given frameIdx.
+void AddFlyingPixels(int frameIdx, Pt* pts, int width, int height, float fraction);
+
+// Raw millimetre depth, the input DepthFindEdges expects, from camera-space points.
+void PointsToDepth(const Pt* pts, int width, int height, unsigned short* outDepth);
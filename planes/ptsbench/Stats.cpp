@@ -0,0 +1,111 @@
+#include "Stats.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+double StageStats::Total() const
+{
+    double total = 0;
+    for (double ms : m_samples)
+        total += ms;
+    return total;
+}
+
+double StageStats::Percentile(double pct) const
+{
+    if (m_samples.empty())
+        return 0;
+    std::vector<double> sorted(m_samples);
+    std::sort(sorted.begin(), sorted.end());
+    size_t idx = (size_t)(pct / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(idx, sorted.size() - 1)];
+}
+
+void PrintStageHeader()
+{
+    printf("%-12s %8s %9s %9s %9s %9s %9s\n", "stage", "frames",
+        "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+}
+
+void PrintStage(const StageStats& stats)
+{
+    double mean = stats.Count() > 0 ? stats.Total() / stats.Count() : 0;
+    printf("%-12s %8zu %9.3f %9.3f %9.3f %9.3f %9.3f\n", stats.Name().c_str(),
+        stats.Count(), mean, stats.Percentile(50), stats.Percentile(90),
+        stats.Percentile(99), stats.Percentile(100));
+}
+
+long long PeakRssKb()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return (long long)(pmc.PeakWorkingSetSize / 1024);
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+namespace
+{
+    std::atomic<unsigned long long> g_heapAllocations(0);
+}
+
+unsigned long long HeapAllocationCount()
+{
+    return g_heapAllocations.load();
+}
+
+void* operator new(size_t size)
+{
+    g_heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    free(ptr);
+}
+
+// C++14 compilers call these for objects of known size; they must free
+// with malloc's free too.
+void operator delete(void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    operator delete[](ptr);
+}
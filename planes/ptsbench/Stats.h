@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Collects per-frame latencies for one pipeline stage.
+class StageStats
+{
+public:
+    explicit StageStats(const std::string& name) : m_name(name) {}
+
+    void Add(double ms) { m_samples.push_back(ms); }
+    const std::string& Name() const { return m_name; }
+    size_t Count() const { return m_samples.size(); }
+    double Total() const;
+    double Percentile(double pct) const;
+
+private:
+    std::string m_name;
+    std::vector<double> m_samples;
+};
+
+class StopWatch
+{
+public:
+    StopWatch() : m_start(std::chrono::steady_clock::now()) {}
+
+    double ElapsedMs() const
+    {
+        return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - m_start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+};
+
+void PrintStageHeader();
+void PrintStage(const StageStats& stats);
+
+// Peak resident set size of this process in kilobytes, or 0 if unknown.
+long long PeakRssKb();
+
+// Calls to the global operator new so far. ptsbench replaces it to count;
+// where the library has its own heap (a Windows DLL) only ptsbench's own
+// allocations are seen.
+unsigned long long HeapAllocationCount();
@@ -0,0 +1,1215 @@
+// ptsbench : replays depth.out recordings through the ptslib entry points and
+// reports per-stage latency, throughput and peak memory.
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include "DepthCodec.h"
+#include "Kernels.h"
+#include "Pt.h"
+#include "ptslib.h"
+#include "Recording.h"
+#include "Stats.h"
+
+namespace
+{
+    void Usage()
+    {
+        printf("usage: ptsbench [options] [depth.out]\n"
+            "  --frames N      stop after N frames (default: whole recording)\n"
+            "  --loops N       replay the recording N times (default: 1)\n"
+            "  --prefetch N    frames the recording reader keeps resident ahead (default: 4)\n"
+            "  --record PATH   also write the frames processed to PATH as a depth.out recording\n"
+            "  --encode PATH   also write them compressed to PATH, then decode and check them\n"
+            "  --synthetic N   use N generated frames instead of a recording\n"
+            "  --clutter N     add N small objects to the synthetic scene\n"
+            "  --noise S       add S metres of depth noise to every frame processed\n"
+            "  --flying F      turn fraction F of the pixels along depth steps into flying pixels\n"
+            "  --size WxH      frame resolution (default: 512x424)\n"
+            "  --fit MODE      plane fitting: corners (default) or moments\n"
+            "  --threads N     worker threads per context (default: one per core)\n"
+            "  --compare       also run the single-threaded scalar kernels and check the output\n"
+            "  --neighbors     also run planes with the sweep neighbour search and check the neighbours\n"
+            "  --coarse        also run planes without the coarse split test and check the output\n"
+            "  --temporal T    also run planes incrementally, reusing tiles that moved less than T metres\n"
+            "  --unproject     also rebuild the points from raw depth and a ray table\n"
+            "  --mesh          also run planes with indexed mesh output\n"
+            "  --layout        also write normals and planes into an interleaved vertex buffer and check them\n"
+            "  --describe      also fill plane descriptors after planes\n"
+            "  --ransac        also find planes with RANSAC and compare them with the descriptors\n"
+            "  --segment       also find planes by region growing and compare them likewise\n"
+            "  --filter        pre-filter the points before normals and planes, and compare planes\n"
+            "                  on the raw points\n"
+            "  --pipeline N    also run normals and planes through a pipeline with N frames in flight\n"
+            "  --trace PATH    instrument the library's stages and write a Chrome trace to PATH\n");
+    }
+
+    // Largest per-component difference, treating matching NaNs as equal.
+    float MaxAbsDiff(const std::vector<float>& a, const std::vector<float>& b)
+    {
+        float maxDiff = 0;
+        for (size_t idx = 0; idx < a.size(); ++idx)
+        {
+            if (std::isnan(a[idx]) && std::isnan(b[idx]))
+                continue;
+            float diff = fabs(a[idx] - b[idx]);
+            if (std::isnan(diff))
+                return INFINITY;
+            maxDiff = std::max(maxDiff, diff);
+        }
+        return maxDiff;
+    }
+
+    // FNV-1a over raw bytes, to compare outputs between runs.
+    unsigned int HashBytes(const void* data, size_t size, unsigned int hash)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+        for (size_t idx = 0; idx < size; ++idx)
+            hash = (hash ^ bytes[idx]) * 16777619u;
+        return hash;
+    }
+
+    // Records the ray (x / z, y / z) of every valid point whose pixel has
+    // none yet, as a stand-in for the Kinect's depth-to-camera-space
+    // table. Returns true if any were added.
+    bool UpdateRays(const Pt* pts, size_t numPts, std::vector<float>& rays)
+    {
+        bool changed = false;
+        for (size_t idx = 0; idx < numPts; ++idx)
+        {
+            Pt pt = pts[idx];
+            if (!pt.IsValid() || rays[idx * 2] != 0 || rays[idx * 2 + 1] != 0)
+                continue;
+            rays[idx * 2] = pt.x / pt.z;
+            rays[idx * 2 + 1] = pt.y / pt.z;
+            changed = true;
+        }
+        return changed;
+    }
+
+    // Planes found without the quadtree, to compare with its descriptors.
+    struct PlaneSetStats
+    {
+        explicit PlaneSetStats(const char* name) :
+            stage(name), planes(0), inliers(0), rmsSq(0), labelsMatch(true), hash(2166136261u)
+        {
+        }
+
+        // Adds a frame's planes; every labelled pixel should be an inlier
+        // of one.
+        void Add(const std::vector<PlaneDescriptor>& descs, int count, const std::vector<int>& labels)
+        {
+            planes += count;
+            hash = HashBytes(descs.data(), count * sizeof(PlaneDescriptor), hash);
+            long long frameInliers = 0;
+            for (int idx = 0; idx < count; ++idx)
+            {
+                frameInliers += descs[idx].inlierCount;
+                rmsSq += (double)descs[idx].inlierCount * descs[idx].rmsDist * descs[idx].rmsDist;
+            }
+            inliers += frameInliers;
+            long long labelled = 0;
+            for (int label : labels)
+                labelled += label >= 0;
+            labelsMatch = labelsMatch && labelled == frameInliers;
+        }
+
+        StageStats stage;
+        long long planes;
+        long long inliers;
+        double rmsSq;
+        bool labelsMatch;
+        unsigned int hash;
+    };
+
+    // Quadtree time includes the planes it describes. Its inliers are
+    // every valid point in a merged tile, outliers included, so its share
+    // is higher and its RMS worse than a method that tests every point.
+    void PrintPlaneComparison(const PlaneSetStats& stats, int frameCnt, double quadMs, long long quadPlanes,
+        long long quadInliers, double quadRmsSq, long long validPoints)
+    {
+        printf("%s vs quadtree: %.3f / %.3f ms, %.1f / %.1f planes/frame, "
+            "%.1f%% / %.1f%% of valid points, inlier rms %.2f / %.2f mm, labels %s, checksum %08x\n",
+            stats.stage.Name().c_str(), stats.stage.Total() / frameCnt, quadMs / frameCnt,
+            (double)stats.planes / frameCnt, (double)quadPlanes / frameCnt,
+            100.0 * stats.inliers / std::max(1ll, validPoints), 100.0 * quadInliers / std::max(1ll, validPoints),
+            1000 * sqrt(stats.rmsSq / std::max(1ll, stats.inliers)),
+            1000 * sqrt(quadRmsSq / std::max(1ll, quadInliers)), stats.labelsMatch ? "ok" : "MISMATCH",
+            stats.hash);
+    }
+
+    // An interleaved vertex as a renderer might map it, for --layout.
+    struct PackedVertex
+    {
+        float position[3];
+        unsigned char color[4];
+        signed char normal[4];
+    };
+
+    VertexLayout PackedLayout(std::vector<PackedVertex>& vertices)
+    {
+        VertexLayout layout;
+        layout.position = VertexStream{ vertices[0].position, (int)sizeof(PackedVertex), VertexFloat3 };
+        layout.color = VertexStream{ vertices[0].color, (int)sizeof(PackedVertex), VertexUnorm8x4 };
+        layout.normal = VertexStream{ vertices[0].normal, (int)sizeof(PackedVertex), VertexSnorm8x4 };
+        return layout;
+    }
+
+    // The packed vertex has pt's position and rgb's colour, rounded.
+    bool PackedMatches(const PackedVertex& v, const Pt& pt, const float* rgb)
+    {
+        if (memcmp(v.position, &pt, sizeof(v.position)) != 0)
+            return false;
+        for (int c = 0; c < 3; ++c)
+        {
+            if (v.color[c] != (unsigned char)(std::min(std::max(rgb[c], 0.0f), 1.0f) * 255.0f + 0.5f))
+                return false;
+        }
+        return v.color[3] == 255;
+    }
+
+    bool PtLess(const Pt& a, const Pt& b)
+    {
+        return std::tie(a.x, a.y, a.z) < std::tie(b.x, b.y, b.z);
+    }
+
+    // DepthMakePlanes colours each connected group, and writes a group's
+    // quads together, so groups are the runs of one colour.
+    int CountGroups(const std::vector<Pt>& texCoords, int vertexCnt)
+    {
+        int groups = 0;
+        for (int idx = 0; idx < vertexCnt; idx += 6)
+        {
+            const Pt& rgb = texCoords[idx];
+            if (idx == 0 || rgb.x != texCoords[idx - 6].x || rgb.y != texCoords[idx - 6].y ||
+                rgb.z != texCoords[idx - 6].z)
+                groups++;
+        }
+        return groups;
+    }
+
+    // DepthPlaneNeighborsCtx's pairs, sorted so two searches' lists can
+    // be compared.
+    std::vector<std::pair<int, int>> SortedPairs(const std::vector<int>& pairs, int pairCnt)
+    {
+        std::vector<std::pair<int, int>> sorted(pairCnt);
+        for (int idx = 0; idx < pairCnt; ++idx)
+            sorted[idx] = std::make_pair(pairs[idx * 2], pairs[idx * 2 + 1]);
+        std::sort(sorted.begin(), sorted.end());
+        return sorted;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = nullptr;
+    int maxFrames = -1;
+    int loops = 1;
+    int prefetch = 4;
+    const char* recordPath = nullptr;
+    const char* encodePath = nullptr;
+    int syntheticFrames = 0;
+    int clutter = 0;
+    bool compare = false;
+    bool neighbors = false;
+    bool coarse = false;
+    bool unproject = false;
+    bool mesh = false;
+    bool layout = false;
+    bool describe = false;
+    bool ransac = false;
+    bool segment = false;
+    bool filter = false;
+    float noise = 0;
+    float flying = 0;
+    float temporal = 0;
+    int pipeline = 0;
+    const char* tracePath = nullptr;
+    int threads = 0;
+    int planeFit = PlaneFitCorners;
+    int width = depthFrameWidth;
+    int height = depthFrameHeight;
+
+    for (int argIdx = 1; argIdx < argc; ++argIdx)
+    {
+        const char* arg = argv[argIdx];
+        bool hasValue = argIdx + 1 < argc;
+        if (strcmp(arg, "--frames") == 0 && hasValue)
+            maxFrames = atoi(argv[++argIdx]);
+        else if (strcmp(arg, "--loops") == 0 && hasValue)
+            loops = atoi(argv[++argIdx]);
+        else if (strcmp(arg, "--prefetch") == 0 && hasValue)
+            prefetch = atoi(argv[++argIdx]);
+        else if (strcmp(arg, "--record") == 0 && hasValue)
+            recordPath = argv[++argIdx];
+        else if (strcmp(arg, "--encode") == 0 && hasValue)
+            encodePath = argv[++argIdx];
+        else if (strcmp(arg, "--synthetic") == 0 && hasValue)
+            syntheticFrames = atoi(argv[++argIdx]);
+        else if (strcmp(arg, "--clutter") == 0 && hasValue)
+            clutter = atoi(argv[++argIdx]);
+        else if (strcmp(arg, "--threads") == 0 && hasValue)
+            threads = atoi(argv[++argIdx]);
+        else if (strcmp(arg, "--noise") == 0 && hasValue)
+            noise = (float)atof(argv[++argIdx]);
+        else if (strcmp(arg, "--flying") == 0 && hasValue)
+            flying = (float)atof(argv[++argIdx]);
+        else if (strcmp(arg, "--temporal") == 0 && hasValue)
+            temporal = (float)atof(argv[++argIdx]);
+        else if (strcmp(arg, "--pipeline") == 0 && hasValue)
+            pipeline = atoi(argv[++argIdx]);
+        else if (strcmp(arg, "--trace") == 0 && hasValue)
+            tracePath = argv[++argIdx];
+        else if (strcmp(arg, "--fit") == 0 && hasValue)
+        {
+            const char* mode = argv[++argIdx];
+            if (strcmp(mode, "corners") == 0)
+                planeFit = PlaneFitCorners;
+            else if (strcmp(mode, "moments") == 0)
+                planeFit = PlaneFitMoments;
+            else
+            {
+                Usage();
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--compare") == 0)
+            compare = true;
+        else if (strcmp(arg, "--unproject") == 0)
+            unproject = true;
+        else if (strcmp(arg, "--layout") == 0)
+            layout = true;
+        else if (strcmp(arg, "--mesh") == 0)
+            mesh = true;
+        else if (strcmp(arg, "--describe") == 0)
+            describe = true;
+        else if (strcmp(arg, "--ransac") == 0)
+            ransac = true;
+        else if (strcmp(arg, "--segment") == 0)
+            segment = true;
+        else if (strcmp(arg, "--filter") == 0)
+            filter = true;
+        else if (strcmp(arg, "--neighbors") == 0)
+            neighbors = true;
+        else if (strcmp(arg, "--coarse") == 0)
+            coarse = true;
+        else if (strcmp(arg, "--size") == 0 && hasValue)
+        {
+            if (sscanf(argv[++argIdx], "%dx%d", &width, &height) != 2)
+            {
+                Usage();
+                return 1;
+            }
+        }
+        else if (arg[0] != '-' && path == nullptr)
+            path = arg;
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (path == nullptr && syntheticFrames <= 0)
+    {
+        Usage();
+        return 1;
+    }
+    // RANSAC and segmentation are compared with the quadtree's descriptors.
+    describe = describe || ransac || segment;
+
+    StopWatch openTimer;
+    MappedRecording* recording = nullptr;
+    if (path != nullptr)
+    {
+        recording = OpenDepthRecording(path, width, height, prefetch);
+        if (recording == nullptr)
+        {
+            fprintf(stderr, "ptsbench: cannot open %s\n", path);
+            return 1;
+        }
+    }
+    double openMs = openTimer.ElapsedMs();
+    int sourceFrames = recording != nullptr ? GetRecordingFrameCount(recording) : syntheticFrames;
+    FILE* recordFile = nullptr;
+    if (recordPath != nullptr)
+    {
+        recordFile = fopen(recordPath, "wb");
+        if (recordFile == nullptr)
+        {
+            fprintf(stderr, "ptsbench: cannot write %s\n", recordPath);
+            return 1;
+        }
+    }
+    DepthRecordingWriter* encoder = nullptr;
+    if (encodePath != nullptr)
+    {
+        encoder = OpenDepthRecordingWriter(encodePath, width, height);
+        if (encoder == nullptr)
+        {
+            fprintf(stderr, "ptsbench: cannot write %s\n", encodePath);
+            return 1;
+        }
+    }
+    StageStats encodeStats("encode");
+    StageStats decodeStats("decode");
+
+    DepthContext* ctx = CreateDepthContext(width, height);
+    DepthContext* refCtx = CreateDepthContext(width, height);
+    SetContextThreadCount(ctx, threads);
+    // Enough trace events for several thousand frames.
+    if (tracePath != nullptr)
+        SetContextInstrument(ctx, 1, 1 << 18);
+    SetContextPlaneFit(ctx, planeFit);
+    SetContextPlaneFit(refCtx, planeFit);
+    SetContextSimd(refCtx, 0);
+    SetContextThreadCount(refCtx, 1);
+    DepthContext* sweepCtx = CreateDepthContext(width, height);
+    SetContextThreadCount(sweepCtx, threads);
+    SetContextPlaneFit(sweepCtx, planeFit);
+    SetContextNeighborSearch(sweepCtx, NeighborSearchSweep);
+    DepthContext* temporalCtx = CreateDepthContext(width, height);
+    SetContextThreadCount(temporalCtx, threads);
+    SetContextPlaneFit(temporalCtx, planeFit);
+    SetContextIncremental(temporalCtx, temporal);
+    // The same reused tiles, but searched and merged in full each frame.
+    DepthContext* temporalFullCtx = CreateDepthContext(width, height);
+    SetContextThreadCount(temporalFullCtx, threads);
+    SetContextPlaneFit(temporalFullCtx, planeFit);
+    SetContextNeighborSearch(temporalFullCtx, NeighborSearchSweep);
+    SetContextIncremental(temporalFullCtx, temporal);
+    if (temporal > 0)
+    {
+        SetContextInstrument(temporalCtx, 1, 0);
+        SetContextInstrument(temporalFullCtx, 1, 0);
+    }
+    DepthContext* meshCtx = CreateDepthContext(width, height);
+    SetContextThreadCount(meshCtx, threads);
+    SetContextPlaneFit(meshCtx, planeFit);
+    DepthContext* layoutCtx = CreateDepthContext(width, height);
+    SetContextThreadCount(layoutCtx, threads);
+    SetContextPlaneFit(layoutCtx, planeFit);
+    DepthContext* fullScanCtx = CreateDepthContext(width, height);
+    SetContextThreadCount(fullScanCtx, threads);
+    SetContextPlaneFit(fullScanCtx, planeFit);
+    SetContextCoarseSplit(fullScanCtx, 0);
+    DepthContext* rawCtx = CreateDepthContext(width, height);
+    SetContextThreadCount(rawCtx, threads);
+    SetContextPlaneFit(rawCtx, planeFit);
+    size_t numPts = (size_t)width * height;
+    std::vector<Pt> depthPts(numPts);
+    std::vector<unsigned short> depthVals(numPts);
+    std::vector<float> edgeVals(numPts * 3);
+    std::vector<float> normVals(numPts * 3);
+    std::vector<float> refNormVals(numPts * 3);
+    std::vector<float> refEdgeVals(numPts * 3);
+    size_t edgeMaskWords = (size_t)(width + 63) / 64 * height;
+    std::vector<unsigned long long> edgeMask(edgeMaskWords);
+    std::vector<unsigned long long> refEdgeMask(edgeMaskWords);
+    std::vector<Pt> genVertices(numPts * 6);
+    std::vector<Pt> genTexCoords(numPts * 6);
+    std::vector<Pt> refVertices(numPts * 6);
+    std::vector<Pt> meshVertices(mesh ? numPts * 4 : 0);
+    std::vector<PackedVertex> packedPixels(layout ? numPts : 0);
+    std::vector<PackedVertex> packedVertices(layout ? numPts * 6 : 0);
+    std::vector<unsigned int> meshIndices(mesh ? numPts * 6 : 0);
+    std::vector<Pt> meshColors(mesh ? numPts : 0);
+    std::vector<int> meshGroupStarts(mesh ? numPts + 1 : 0);
+    std::vector<Pt> sortedVertices;
+    std::vector<PlaneDescriptor> planeDescs(describe ? numPts / 4 : 0);
+    std::vector<PlaneTile> planeTiles(describe ? numPts / 4 : 0);
+    std::vector<PlaneDescriptor> altPlanes(ransac || segment ? numPts / 16 : 0);
+    std::vector<int> altLabels(ransac || segment ? numPts : 0);
+    std::vector<float> rays(unproject ? numPts * 2 : 0);
+    std::vector<Pt> unprojPts(unproject ? numPts : 0);
+    std::vector<Pt> refUnprojPts(unproject ? numPts : 0);
+    std::vector<Pt> filteredPts(filter ? numPts : 0);
+    std::vector<Pt> refFilteredPts(filter && compare ? numPts : 0);
+
+    StageStats edgeStats("edges");
+    StageStats edgeMaskStats("edge-mask");
+    long long edgePixels = 0;
+    StageStats normalStats("normals");
+    StageStats refNormalStats("normals-ref");
+    float maxNormalDiff = 0;
+    bool edgesMatch = true;
+    StageStats refPlaneStats("planes-ref");
+    long long refTotalVertices = 0;
+    StageStats sweepPlaneStats("planes-sweep");
+    long long totalGroups = 0;
+    long long sweepTotalGroups = 0;
+    bool sweepMatch = true;
+    bool neighborsMatch = true;
+    std::vector<int> gridPairs(neighbors ? numPts * 2 : 0);
+    std::vector<int> sweepPairs(neighbors ? numPts * 2 : 0);
+    StageStats fullScanPlaneStats("planes-full");
+    bool fullScanMatch = true;
+    StageStats temporalPlaneStats("planes-temp");
+    long long temporalTotalVertices = 0;
+    long long temporalTotalGroups = 0;
+    // Neighbour search and merge ms, incremental and in full.
+    double temporalMergeMs = 0;
+    double temporalFullMergeMs = 0;
+    bool temporalMergeMatch = true;
+    std::vector<Pt> temporalVertices(temporal > 0 ? refVertices.size() : 0);
+    std::vector<Pt> temporalTexCoords(temporal > 0 ? refVertices.size() : 0);
+    StageStats meshStats("planes-mesh");
+    long long meshTotalVertices = 0;
+    long long meshTotalIndices = 0;
+    long long meshTotalGroups = 0;
+    bool meshMatch = true;
+    StageStats normalLayoutStats("normals-lay");
+    StageStats planeLayoutStats("planes-lay");
+    bool layoutMatch = true;
+    StageStats describeStats("describe");
+    long long describedPlanes = 0;
+    long long describedInliers = 0;
+    double describedArea = 0;
+    float maxPlaneRms = 0;
+    double describedRmsSq = 0;
+    bool describeMatch = true;
+    PlaneSetStats ransacStats("ransac");
+    PlaneSetStats segmentStats("segment");
+    long long validPoints = 0;
+    StageStats unprojectStats("unproject");
+    float maxUnprojectDiff = 0;
+    bool unprojectMatch = true;
+    StageStats filterStats("filter");
+    StageStats rawPlaneStats("planes-raw");
+    long long flyingRemoved = 0;
+    long long rawTotalVertices = 0;
+    long long rawTotalGroups = 0;
+    bool filterMatch = true;
+    StageStats planeStats("planes");
+    // --trace: the library's own stage timings and counters.
+    std::vector<StageStats> instrumentStats;
+    const char* const instrumentNames[InstrumentStageCount] = { "filter", "normals", "history", "masks",
+        "quadtree", "corners", "residual", "coverage", "neighbor", "merge", "output" };
+    for (const char* name : instrumentNames)
+        instrumentStats.emplace_back(std::string("lib-") + name);
+    DepthInstrumentStats instrumentTotals = {};
+    StageStats frameStats("frame");
+    long long totalVertices = 0;
+    int lastVertexCnt = 0;
+    // Heap allocations inside DepthMakePlanesCtx, after the first frame,
+    // and once the first loop has shown the context every frame.
+    unsigned long long planeAllocations = 0;
+    unsigned long long steadyAllocations = 0;
+    unsigned long long ctxAllocationsSteady = 0;
+    int steadyFrames = 0;
+    unsigned long long ctxAllocationsStart = 0;
+    unsigned int planeHash = 2166136261u;
+    unsigned int colorHash = 2166136261u;
+
+    StopWatch wallClock;
+    int frameCnt = 0;
+    for (int loop = 0; loop < loops; ++loop)
+    {
+        for (int frameIdx = 0; frameIdx < sourceFrames; ++frameIdx)
+        {
+            if (maxFrames >= 0 && frameCnt >= maxFrames)
+                break;
+            // Recorded frames are used in place, without a copy.
+            float* framePts;
+            if (recording != nullptr)
+                framePts = (float*)GetRecordingFrame(recording, frameIdx);
+            else
+            {
+                MakeSyntheticFrame(frameIdx, width, height, depthPts.data(), clutter);
+                framePts = (float*)depthPts.data();
+            }
+            // 30 fps in 100 ns units, like the Kinect's RelativeTime.
+            long long timestamp = recording != nullptr ?
+                GetRecordingTimestamp(recording, frameIdx) : frameIdx * 333333ll;
+            if (recordFile != nullptr && loop == 0)
+                WriteRecordingFrame(recordFile, timestamp, (const Pt*)framePts, width, height);
+            if (encoder != nullptr && loop == 0)
+            {
+                StopWatch timer;
+                WriteDepthRecordingFrame(encoder, timestamp, framePts);
+                encodeStats.Add(timer.ElapsedMs());
+            }
+            if (noise > 0 || flying > 0)
+            {
+                if (framePts != (float*)depthPts.data())
+                    std::copy((const Pt*)framePts, (const Pt*)framePts + numPts, depthPts.data());
+                if (flying > 0)
+                    AddFlyingPixels(frameIdx, depthPts.data(), width, height, flying);
+                if (noise > 0)
+                    AddDepthNoise(frameIdx, depthPts.data(), numPts, noise);
+                framePts = (float*)depthPts.data();
+            }
+            PointsToDepth((const Pt*)framePts, width, height, depthVals.data());
+
+            // Edges still see the raw depth; normals and planes, and every
+            // stage after them, the filtered points.
+            float* rawPts = framePts;
+            StopWatch frameTimer;
+            if (filter)
+            {
+                StopWatch timer;
+                DepthFilterPointsCtx(ctx, rawPts, (float*)filteredPts.data());
+                filterStats.Add(timer.ElapsedMs());
+                framePts = (float*)filteredPts.data();
+            }
+            {
+                StopWatch timer;
+                DepthFindEdgesCtx(ctx, depthVals.data(), edgeVals.data());
+                edgeStats.Add(timer.ElapsedMs());
+            }
+            {
+                StopWatch timer;
+                DepthFindEdgeMaskCtx(ctx, depthVals.data(), edgeMask.data(), nullptr);
+                edgeMaskStats.Add(timer.ElapsedMs());
+                for (unsigned long long word : edgeMask)
+                {
+                    for (; word != 0; word &= word - 1)
+                        edgePixels++;
+                }
+            }
+            {
+                StopWatch timer;
+                DepthFindNormalsCtx(ctx, framePts, normVals.data(), -1, -1);
+                normalStats.Add(timer.ElapsedMs());
+            }
+            {
+                if (loop == 1 && steadyFrames == 0)
+                    ctxAllocationsSteady = GetContextAllocationCount(ctx);
+                unsigned long long allocsBefore = HeapAllocationCount();
+                StopWatch timer;
+                int vertexCnt = 0;
+                DepthMakePlanesCtx(ctx, framePts, genVertices.data(), genTexCoords.data(),
+                    (int)genVertices.size(), &vertexCnt, -1, -1);
+                // Counted before the timing is stored, which may grow its list.
+                unsigned long long allocs = HeapAllocationCount() - allocsBefore;
+                planeStats.Add(timer.ElapsedMs());
+                if (frameCnt == 0)
+                    ctxAllocationsStart = GetContextAllocationCount(ctx);
+                else
+                    planeAllocations += allocs;
+                if (loop > 0)
+                {
+                    steadyAllocations += allocs;
+                    steadyFrames++;
+                }
+                totalVertices += vertexCnt;
+                lastVertexCnt = vertexCnt;
+                totalGroups += CountGroups(genTexCoords, vertexCnt);
+                planeHash = HashBytes(genVertices.data(), vertexCnt * sizeof(Pt), planeHash);
+                if (pipeline > 0)
+                    colorHash = HashBytes(genTexCoords.data(), vertexCnt * sizeof(Pt), colorHash);
+            }
+            frameStats.Add(frameTimer.ElapsedMs());
+            DepthInstrumentStats frameCounters;
+            if (tracePath != nullptr && GetContextStats(ctx, &frameCounters))
+            {
+                for (int stage = 0; stage < InstrumentStageCount; ++stage)
+                    instrumentStats[stage].Add(frameCounters.stageMs[stage]);
+                instrumentTotals.tilesVisited += frameCounters.tilesVisited;
+                instrumentTotals.splits += frameCounters.splits;
+                instrumentTotals.leaves += frameCounters.leaves;
+                instrumentTotals.pixelsScanned += frameCounters.pixelsScanned;
+                instrumentTotals.coverageRejected += frameCounters.coverageRejected;
+                instrumentTotals.neighborEdges += frameCounters.neighborEdges;
+                instrumentTotals.samePlaneEdges += frameCounters.samePlaneEdges;
+                instrumentTotals.mergedGroups += frameCounters.mergedGroups;
+            }
+
+            // The same outputs written straight into packed vertices,
+            // checked against the Pt arrays before later stages reuse them.
+            if (layout)
+            {
+                VertexLayout pixelLayout = PackedLayout(packedPixels);
+                StopWatch timer;
+                DepthFindNormalsLayoutCtx(layoutCtx, framePts, &pixelLayout, -1, -1);
+                normalLayoutStats.Add(timer.ElapsedMs());
+                const Pt* pts = (const Pt*)framePts;
+                for (int y = 1; y < height - 1; ++y)
+                {
+                    for (int x = 1; x < width - 1; ++x)
+                    {
+                        size_t idx = (size_t)y * width + x;
+                        layoutMatch = layoutMatch && PackedMatches(packedPixels[idx], pts[idx], &normVals[idx * 3]);
+                    }
+                }
+
+                VertexLayout planeLayout = PackedLayout(packedVertices);
+                StopWatch planeTimer;
+                int packedCnt = 0;
+                DepthMakePlanesLayoutCtx(layoutCtx, framePts, &planeLayout, (int)packedVertices.size(), &packedCnt,
+                    -1, -1);
+                planeLayoutStats.Add(planeTimer.ElapsedMs());
+                layoutMatch = layoutMatch && packedCnt == lastVertexCnt;
+                for (int idx = 0; idx < packedCnt && layoutMatch; ++idx)
+                    layoutMatch = PackedMatches(packedVertices[idx], genVertices[idx], &genTexCoords[idx].x);
+            }
+
+            if (describe)
+            {
+                StopWatch timer;
+                int planeCnt = 0, tileCnt = 0;
+                DepthDescribePlanesCtx(ctx, framePts, planeDescs.data(), (int)planeDescs.size(), &planeCnt,
+                    planeTiles.data(), (int)planeTiles.size(), &tileCnt);
+                describeStats.Add(timer.ElapsedMs());
+                // One tile per quad of the triangle output.
+                describeMatch = describeMatch && tileCnt * 6 == lastVertexCnt;
+                describedPlanes += planeCnt;
+                for (int idx = 0; idx < planeCnt; ++idx)
+                {
+                    describedInliers += planeDescs[idx].inlierCount;
+                    describedArea += planeDescs[idx].area;
+                    maxPlaneRms = std::max(maxPlaneRms, planeDescs[idx].rmsDist);
+                    describedRmsSq += (double)planeDescs[idx].inlierCount *
+                        planeDescs[idx].rmsDist * planeDescs[idx].rmsDist;
+                }
+            }
+            // Both use the normals found above.
+            if (ransac)
+            {
+                StopWatch timer;
+                int planeCnt = 0;
+                DepthRansacPlanesCtx(ctx, framePts, altPlanes.data(), (int)altPlanes.size(), &planeCnt,
+                    altLabels.data());
+                ransacStats.stage.Add(timer.ElapsedMs());
+                ransacStats.Add(altPlanes, planeCnt, altLabels);
+            }
+            if (segment)
+            {
+                StopWatch timer;
+                int planeCnt = 0;
+                DepthSegmentPlanesCtx(ctx, framePts, altPlanes.data(), (int)altPlanes.size(), &planeCnt,
+                    altLabels.data());
+                segmentStats.stage.Add(timer.ElapsedMs());
+                segmentStats.Add(altPlanes, planeCnt, altLabels);
+            }
+            if (ransac || segment)
+            {
+                Pt* srcPts = (Pt*)framePts;
+                for (size_t idx = 0; idx < numPts; ++idx)
+                    validPoints += srcPts[idx].IsValid();
+            }
+
+            if (filter)
+            {
+                Pt* srcPts = (Pt*)rawPts;
+                for (size_t idx = 0; idx < numPts; ++idx)
+                    flyingRemoved += srcPts[idx].IsValid() && !filteredPts[idx].IsValid();
+                StopWatch timer;
+                int rawVertexCnt = 0;
+                DepthMakePlanesCtx(rawCtx, rawPts, refVertices.data(), genTexCoords.data(),
+                    (int)refVertices.size(), &rawVertexCnt, -1, -1);
+                rawPlaneStats.Add(timer.ElapsedMs());
+                rawTotalVertices += rawVertexCnt;
+                rawTotalGroups += CountGroups(genTexCoords, rawVertexCnt);
+            }
+
+            // Reference run is kept out of the frame time.
+            if (compare)
+            {
+                if (filter)
+                {
+                    DepthFilterPointsCtx(refCtx, rawPts, (float*)refFilteredPts.data());
+                    filterMatch = filterMatch &&
+                        memcmp(filteredPts.data(), refFilteredPts.data(), numPts * sizeof(Pt)) == 0;
+                }
+                StopWatch timer;
+                DepthFindNormalsCtx(refCtx, framePts, refNormVals.data(), -1, -1);
+                refNormalStats.Add(timer.ElapsedMs());
+                maxNormalDiff = std::max(maxNormalDiff, MaxAbsDiff(normVals, refNormVals));
+                DepthFindEdgesCtx(refCtx, depthVals.data(), refEdgeVals.data());
+                edgesMatch = edgesMatch && MaxAbsDiff(edgeVals, refEdgeVals) == 0;
+                DepthFindEdgeMaskCtx(refCtx, depthVals.data(), refEdgeMask.data(), nullptr);
+                edgesMatch = edgesMatch && edgeMask == refEdgeMask;
+                StopWatch planeTimer;
+                int refVertexCnt = 0;
+                DepthMakePlanesCtx(refCtx, framePts, refVertices.data(), genTexCoords.data(),
+                    (int)refVertices.size(), &refVertexCnt, -1, -1);
+                refPlaneStats.Add(planeTimer.ElapsedMs());
+                refTotalVertices += refVertexCnt;
+            }
+            if (mesh)
+            {
+                StopWatch timer;
+                int meshVertexCnt = 0, meshIndexCnt = 0, meshGroupCnt = 0;
+                DepthMakePlaneMeshCtx(meshCtx, framePts, meshVertices.data(), (int)meshVertices.size(),
+                    &meshVertexCnt, meshIndices.data(), (int)meshIndices.size(), &meshIndexCnt,
+                    meshColors.data(), meshGroupStarts.data(), (int)meshColors.size(), &meshGroupCnt, -1, -1);
+                meshStats.Add(timer.ElapsedMs());
+                meshTotalVertices += meshVertexCnt;
+                meshTotalIndices += meshIndexCnt;
+                meshTotalGroups += meshGroupCnt;
+                // Merged quads keep their tiles' outer corners, so every
+                // vertex is one of the unindexed ones.
+                sortedVertices.assign(genVertices.begin(), genVertices.begin() + lastVertexCnt);
+                std::sort(sortedVertices.begin(), sortedVertices.end(), PtLess);
+                meshMatch = meshMatch && meshIndexCnt <= lastVertexCnt;
+                for (int idx = 0; idx < meshVertexCnt; ++idx)
+                {
+                    meshMatch = meshMatch && std::binary_search(sortedVertices.begin(), sortedVertices.end(),
+                        meshVertices[idx], PtLess);
+                }
+            }
+            if (unproject)
+            {
+                if (UpdateRays((const Pt*)framePts, numPts, rays))
+                {
+                    SetContextDepthRays(ctx, rays.data());
+                    SetContextDepthRays(refCtx, rays.data());
+                }
+                StopWatch timer;
+                DepthUnprojectCtx(ctx, depthVals.data(), (float*)unprojPts.data());
+                unprojectStats.Add(timer.ElapsedMs());
+                DepthUnprojectCtx(refCtx, depthVals.data(), (float*)refUnprojPts.data());
+                unprojectMatch = unprojectMatch &&
+                    memcmp(unprojPts.data(), refUnprojPts.data(), numPts * sizeof(Pt)) == 0;
+                Pt* srcPts = (Pt*)framePts;
+                for (size_t idx = 0; idx < numPts; ++idx)
+                {
+                    if (unprojPts[idx].IsValid() != srcPts[idx].IsValid())
+                        unprojectMatch = false;
+                    else if (srcPts[idx].IsValid())
+                    {
+                        Pt diff = unprojPts[idx] - srcPts[idx];
+                        float pointDiff = std::max(fabsf(diff.x), std::max(fabsf(diff.y), fabsf(diff.z)));
+                        maxUnprojectDiff = std::max(maxUnprojectDiff, pointDiff);
+                    }
+                }
+            }
+            if (neighbors)
+            {
+                StopWatch timer;
+                int sweepVertexCnt = 0;
+                DepthMakePlanesCtx(sweepCtx, framePts, refVertices.data(), genTexCoords.data(),
+                    (int)refVertices.size(), &sweepVertexCnt, -1, -1);
+                sweepPlaneStats.Add(timer.ElapsedMs());
+                sweepTotalGroups += CountGroups(genTexCoords, sweepVertexCnt);
+                sweepMatch = sweepMatch && sweepVertexCnt == lastVertexCnt &&
+                    memcmp(refVertices.data(), genVertices.data(), lastVertexCnt * sizeof(Pt)) == 0;
+                // Both searches over the same tiles.
+                int maxPairs = (int)gridPairs.size() / 2;
+                int sweepPairCnt = 0, gridPairCnt = 0;
+                DepthPlaneNeighborsCtx(sweepCtx, framePts, sweepPairs.data(), maxPairs, &sweepPairCnt);
+                SetContextNeighborSearch(sweepCtx, NeighborSearchGrid);
+                DepthPlaneNeighborsCtx(sweepCtx, framePts, gridPairs.data(), maxPairs, &gridPairCnt);
+                SetContextNeighborSearch(sweepCtx, NeighborSearchSweep);
+                neighborsMatch = neighborsMatch && gridPairCnt == sweepPairCnt && gridPairCnt <= maxPairs &&
+                    SortedPairs(gridPairs, gridPairCnt) == SortedPairs(sweepPairs, sweepPairCnt);
+            }
+            if (coarse)
+            {
+                StopWatch timer;
+                int fullScanVertexCnt = 0;
+                DepthMakePlanesCtx(fullScanCtx, framePts, refVertices.data(), genTexCoords.data(),
+                    (int)refVertices.size(), &fullScanVertexCnt, -1, -1);
+                fullScanPlaneStats.Add(timer.ElapsedMs());
+                fullScanMatch = fullScanMatch && fullScanVertexCnt == lastVertexCnt &&
+                    memcmp(refVertices.data(), genVertices.data(), lastVertexCnt * sizeof(Pt)) == 0;
+            }
+            if (temporal > 0)
+            {
+                StopWatch timer;
+                int temporalVertexCnt = 0;
+                DepthMakePlanesCtx(temporalCtx, framePts, refVertices.data(), genTexCoords.data(),
+                    (int)refVertices.size(), &temporalVertexCnt, -1, -1);
+                temporalPlaneStats.Add(timer.ElapsedMs());
+                temporalTotalVertices += temporalVertexCnt;
+                temporalTotalGroups += CountGroups(genTexCoords, temporalVertexCnt);
+                int temporalFullVertexCnt = 0;
+                DepthMakePlanesCtx(temporalFullCtx, framePts, temporalVertices.data(), temporalTexCoords.data(),
+                    (int)temporalVertices.size(), &temporalFullVertexCnt, -1, -1);
+                temporalMergeMatch = temporalMergeMatch && temporalFullVertexCnt == temporalVertexCnt &&
+                    memcmp(refVertices.data(), temporalVertices.data(), temporalVertexCnt * sizeof(Pt)) == 0 &&
+                    memcmp(genTexCoords.data(), temporalTexCoords.data(), temporalVertexCnt * sizeof(Pt)) == 0;
+                DepthInstrumentStats temporalCounters, temporalFullCounters;
+                if (GetContextStats(temporalCtx, &temporalCounters) &&
+                    GetContextStats(temporalFullCtx, &temporalFullCounters))
+                {
+                    temporalMergeMs += temporalCounters.stageMs[InstrumentNeighbors] +
+                        temporalCounters.stageMs[InstrumentMerge];
+                    temporalFullMergeMs += temporalFullCounters.stageMs[InstrumentNeighbors] +
+                        temporalFullCounters.stageMs[InstrumentMerge];
+                }
+            }
+            frameCnt++;
+        }
+    }
+    double wallMs = wallClock.ElapsedMs();
+
+    // Decode the compressed copy and compare it with the source frames.
+    long long encodedBytes = 0;
+    bool depthExact = true;
+    const int replayReaders = 4;
+    bool replayMatch = true;
+    float maxPointDiff = 0;
+    if (encoder != nullptr)
+    {
+        CloseDepthRecordingWriter(encoder);
+        FILE* encodedFile = fopen(encodePath, "rb");
+        if (encodedFile != nullptr)
+        {
+            fseek(encodedFile, 0, SEEK_END);
+            encodedBytes = ftell(encodedFile);
+            fclose(encodedFile);
+        }
+        MappedRecording* encoded = OpenDepthRecording(encodePath, width, height, 0);
+        int encodedFrames = encoded != nullptr ? GetRecordingFrameCount(encoded) : 0;
+        depthExact = encodedFrames == (int)encodeStats.Count();
+        std::vector<unsigned int> decodedHashes(encodedFrames);
+        for (int frameIdx = 0; frameIdx < encodedFrames; ++frameIdx)
+        {
+            const Pt* srcPts;
+            if (recording != nullptr)
+                srcPts = (const Pt*)GetRecordingFrame(recording, frameIdx);
+            else
+            {
+                MakeSyntheticFrame(frameIdx, width, height, depthPts.data(), clutter);
+                srcPts = depthPts.data();
+            }
+            StopWatch timer;
+            const Pt* decoded = (const Pt*)GetRecordingFrame(encoded, frameIdx);
+            decodeStats.Add(timer.ElapsedMs());
+            decodedHashes[frameIdx] = HashBytes(decoded, numPts * sizeof(Pt), 2166136261u);
+            for (size_t idx = 0; idx < numPts; ++idx)
+            {
+                uint16_t srcDepth = PointDepthMm(srcPts[idx]);
+                if (PointDepthMm(decoded[idx]) != srcDepth)
+                    depthExact = false;
+                // Points are only expected back to the millimetre.
+                if (srcDepth != 0)
+                {
+                    Pt diff = decoded[idx] - srcPts[idx];
+                    float pointDiff = std::max(fabsf(diff.x), std::max(fabsf(diff.y), fabsf(diff.z)));
+                    maxPointDiff = std::max(maxPointDiff, pointDiff);
+                }
+            }
+        }
+        if (encoded != nullptr)
+            CloseDepthRecording(encoded);
+
+        // Several threads replaying one recording at once, each from a
+        // different frame, with no prefetch so the decode slots run out.
+        encoded = OpenDepthRecording(encodePath, width, height, 0);
+        if (encoded != nullptr)
+        {
+            std::atomic<int> mismatches(0);
+            std::vector<std::thread> readers;
+            for (int reader = 0; reader < replayReaders; ++reader)
+            {
+                readers.emplace_back([&, reader]
+                    {
+                        std::vector<Pt> pts(numPts);
+                        for (int step = 0; step < encodedFrames * 2; ++step)
+                        {
+                            int frameIdx = (reader * encodedFrames / replayReaders + step) % encodedFrames;
+                            if (!ReadRecordingFrame(encoded, frameIdx, (float*)pts.data()) ||
+                                HashBytes(pts.data(), numPts * sizeof(Pt), 2166136261u) != decodedHashes[frameIdx])
+                                mismatches++;
+                        }
+                    });
+            }
+            for (std::thread& thread : readers)
+                thread.join();
+            replayMatch = mismatches == 0;
+            CloseDepthRecording(encoded);
+        }
+        else
+            replayMatch = false;
+    }
+
+    // The same frames again through a pipeline. This thread fills each
+    // frame's input buffer, filtering it if asked, while the stages work
+    // on the frames before it.
+    StageStats pipeInputStats("pipe-input");
+    StageStats pipeStageStats[PipelineStageCount] = {
+        StageStats("pipe-normals"), StageStats("pipe-tree"), StageStats("pipe-merge"), StageStats("pipe-output") };
+    StageStats pipeLatencyStats("pipe-latency");
+    double pipeWaitMs[PipelineStageCount] = {};
+    double pipelineMs = 0;
+    bool pipelineMatch = true;
+    if (pipeline > 0)
+    {
+        DepthPipeline* pipe = CreateDepthPipeline(width, height, pipeline);
+        for (int slot = 0; slot < pipeline; ++slot)
+            SetContextPlaneFit(GetPipelineContext(pipe, slot), planeFit);
+        std::vector<std::vector<Pt>> pipeInputs(pipeline, std::vector<Pt>(numPts));
+        std::vector<std::vector<float>> pipeNormals(pipeline, std::vector<float>(numPts * 3));
+        std::vector<std::vector<Pt>> pipeVertices(pipeline, std::vector<Pt>(numPts * 6));
+        std::vector<std::vector<Pt>> pipeTexCoords(pipeline, std::vector<Pt>(numPts * 6));
+        unsigned int pipePlaneHash = 2166136261u;
+        unsigned int pipeColorHash = 2166136261u;
+        int inFlight = 0;
+        auto pollFrame = [&]()
+        {
+            DepthFrameStatus status;
+            PollDepthFrame(pipe, 1, &status);
+            inFlight--;
+            int slot = (int)(status.frameId % pipeline);
+            pipePlaneHash = HashBytes(pipeVertices[slot].data(), status.vertexCount * sizeof(Pt), pipePlaneHash);
+            pipeColorHash = HashBytes(pipeTexCoords[slot].data(), status.vertexCount * sizeof(Pt), pipeColorHash);
+            for (int stage = 0; stage < PipelineStageCount; ++stage)
+            {
+                pipeStageStats[stage].Add(status.stageMs[stage]);
+                pipeWaitMs[stage] += status.waitMs[stage];
+            }
+            pipeLatencyStats.Add(status.latencyMs);
+        };
+
+        StopWatch pipeClock;
+        for (int frame = 0; frame < frameCnt; ++frame)
+        {
+            // The slot's buffers are free again once its last frame is polled.
+            if (inFlight == pipeline)
+                pollFrame();
+            StopWatch timer;
+            int slot = frame % pipeline;
+            int frameIdx = frame % sourceFrames;
+            Pt* input = pipeInputs[slot].data();
+            if (recording != nullptr)
+                std::copy_n((const Pt*)GetRecordingFrame(recording, frameIdx), numPts, input);
+            else
+                MakeSyntheticFrame(frameIdx, width, height, input, clutter);
+            if (flying > 0)
+                AddFlyingPixels(frameIdx, input, width, height, flying);
+            if (noise > 0)
+                AddDepthNoise(frameIdx, input, numPts, noise);
+            if (filter)
+                DepthFilterPointsCtx(ctx, (float*)input, (float*)input);
+            pipeInputStats.Add(timer.ElapsedMs());
+            SubmitDepthFrame(pipe, frame, (float*)input, pipeNormals[slot].data(), pipeVertices[slot].data(),
+                pipeTexCoords[slot].data(), (int)pipeVertices[slot].size());
+            inFlight++;
+        }
+        while (inFlight > 0)
+            pollFrame();
+        pipelineMs = pipeClock.ElapsedMs();
+        DestroyDepthPipeline(pipe);
+        pipelineMatch = pipePlaneHash == planeHash && pipeColorHash == colorHash;
+    }
+    unsigned long long ctxAllocations = GetContextAllocationCount(ctx) - ctxAllocationsStart;
+    ctxAllocationsSteady = GetContextAllocationCount(ctx) - ctxAllocationsSteady;
+    bool traceWritten = tracePath != nullptr && WriteContextTrace(ctx, tracePath);
+    DestroyDepthContext(ctx);
+    DestroyDepthContext(refCtx);
+    DestroyDepthContext(sweepCtx);
+    DestroyDepthContext(temporalCtx);
+    DestroyDepthContext(temporalFullCtx);
+    DestroyDepthContext(meshCtx);
+    DestroyDepthContext(layoutCtx);
+    DestroyDepthContext(fullScanCtx);
+    DestroyDepthContext(rawCtx);
+    if (recording != nullptr)
+        CloseDepthRecording(recording);
+    if (recordFile != nullptr)
+        fclose(recordFile);
+
+    if (frameCnt == 0)
+    {
+        fprintf(stderr, "ptsbench: no frames processed\n");
+        return 1;
+    }
+
+    printf("source: %s (%dx%d), %d frames, simd: %s\n", path != nullptr ? path : "synthetic",
+        width, height, frameCnt, GetSimdBackend());
+    if (recording != nullptr)
+        printf("recording: %d frames indexed in %.3f ms\n", sourceFrames, openMs);
+    PrintStageHeader();
+    if (filter)
+        PrintStage(filterStats);
+    PrintStage(edgeStats);
+    PrintStage(edgeMaskStats);
+    PrintStage(normalStats);
+    if (compare)
+        PrintStage(refNormalStats);
+    PrintStage(planeStats);
+    if (compare)
+        PrintStage(refPlaneStats);
+    if (filter)
+        PrintStage(rawPlaneStats);
+    if (neighbors)
+        PrintStage(sweepPlaneStats);
+    if (coarse)
+        PrintStage(fullScanPlaneStats);
+    if (temporal > 0)
+        PrintStage(temporalPlaneStats);
+    if (mesh)
+        PrintStage(meshStats);
+    if (layout)
+    {
+        PrintStage(normalLayoutStats);
+        PrintStage(planeLayoutStats);
+    }
+    if (describe)
+        PrintStage(describeStats);
+    if (ransac)
+        PrintStage(ransacStats.stage);
+    if (segment)
+        PrintStage(segmentStats.stage);
+    if (unproject)
+        PrintStage(unprojectStats);
+    if (tracePath != nullptr)
+    {
+        // Corner search and residual scan times are summed over the
+        // quadtree's workers, so with several they can exceed quadtree.
+        for (const StageStats& stats : instrumentStats)
+        {
+            if (stats.Total() > 0)
+                PrintStage(stats);
+        }
+    }
+    if (pipeline > 0)
+    {
+        PrintStage(pipeInputStats);
+        for (const StageStats& stats : pipeStageStats)
+            PrintStage(stats);
+        PrintStage(pipeLatencyStats);
+    }
+    PrintStage(frameStats);
+    printf("processing fps: %.2f (wall incl. I/O: %.2f)\n",
+        frameCnt * 1000.0 / frameStats.Total(), frameCnt * 1000.0 / wallMs);
+    printf("mean plane vertices/frame: %lld, groups/frame: %.1f, checksum %08x\n",
+        totalVertices / frameCnt, (double)totalGroups / frameCnt, planeHash);
+    printf("edge pixels/frame: %.1f%%\n", 100.0 * edgePixels / ((double)frameCnt * numPts));
+    if (filter)
+    {
+        // A vertex count of 6 per leaf tile.
+        printf("filtered vs raw points: %.1f flying pixels/frame removed, leaves/frame %lld / %lld, "
+            "groups/frame %.1f / %.1f, filter + planes %.3f ms vs planes %.3f ms\n",
+            (double)flyingRemoved / frameCnt, totalVertices / frameCnt / 6, rawTotalVertices / frameCnt / 6,
+            (double)totalGroups / frameCnt, (double)rawTotalGroups / frameCnt,
+            (filterStats.Total() + planeStats.Total()) / frameCnt, rawPlaneStats.Total() / frameCnt);
+    }
+    if (neighbors)
+    {
+        printf("neighbour search grid vs sweep: planes %.3f / %.3f ms, groups/frame %.1f / %.1f, "
+            "neighbours %s, output %s\n", planeStats.Total() / frameCnt, sweepPlaneStats.Total() / frameCnt,
+            (double)totalGroups / frameCnt, (double)sweepTotalGroups / frameCnt,
+            neighborsMatch ? "identical" : "MISMATCH", sweepMatch ? "identical" : "MISMATCH");
+    }
+    if (coarse)
+    {
+        printf("coarse split test vs full scans: planes %.3f / %.3f ms, output %s\n",
+            planeStats.Total() / frameCnt, fullScanPlaneStats.Total() / frameCnt,
+            fullScanMatch ? "identical" : "MISMATCH");
+    }
+    if (tracePath != nullptr)
+    {
+        printf("instrumented per frame: %.0f tiles visited, %.0f splits, %.0f leaves, %.0f rejected by coverage, "
+            "%.0f pixels scanned, %.0f neighbour edges (%.0f same plane), %.1f groups; trace %s %s\n",
+            (double)instrumentTotals.tilesVisited / frameCnt, (double)instrumentTotals.splits / frameCnt,
+            (double)instrumentTotals.leaves / frameCnt, (double)instrumentTotals.coverageRejected / frameCnt,
+            (double)instrumentTotals.pixelsScanned / frameCnt, (double)instrumentTotals.neighborEdges / frameCnt,
+            (double)instrumentTotals.samePlaneEdges / frameCnt, (double)instrumentTotals.mergedGroups / frameCnt,
+            traceWritten ? "written to" : "could not be written to", tracePath);
+    }
+    if (pipeline > 0)
+    {
+        // Stages overlap only when there are cores for them, so on one
+        // core the pipeline is no faster than running them in turn.
+        double serialMs = normalStats.Total() + planeStats.Total() + (filter ? filterStats.Total() : 0);
+        printf("pipeline, %d frames in flight: %.2f fps incl. input vs serial normals + planes %.2f fps, "
+            "mean wait ms before normals %.3f, tree %.3f, merge %.3f, output %.3f, results %s\n",
+            pipeline, frameCnt * 1000.0 / pipelineMs, frameCnt * 1000.0 / serialMs,
+            pipeWaitMs[PipelineNormals] / frameCnt, pipeWaitMs[PipelineQuadtree] / frameCnt,
+            pipeWaitMs[PipelineMerge] / frameCnt, pipeWaitMs[PipelineOutput] / frameCnt,
+            pipelineMatch ? "identical" : "MISMATCH");
+    }
+    if (temporal > 0)
+    {
+        // Reused tiles keep last frame's fit, so the output drifts from a
+        // full run by up to the threshold.
+        printf("incremental vs full: planes %.3f / %.3f ms, vertices/frame %lld / %lld, groups/frame %.1f / %.1f\n",
+            temporalPlaneStats.Total() / frameCnt, planeStats.Total() / frameCnt,
+            temporalTotalVertices / frameCnt, totalVertices / frameCnt,
+            (double)temporalTotalGroups / frameCnt, (double)totalGroups / frameCnt);
+        printf("incremental neighbours and merge vs full search of the same tiles: %.3f / %.3f ms, output %s\n",
+            temporalMergeMs / frameCnt, temporalFullMergeMs / frameCnt,
+            temporalMergeMatch ? "identical" : "MISMATCH");
+    }
+    if (mesh)
+    {
+        // Unindexed: a position and a colour per vertex. Indexed: welded
+        // positions, 32-bit indices and a colour and index start per group.
+        double flatBytes = (double)totalVertices * 2 * sizeof(Pt);
+        double meshBytes = (double)meshTotalVertices * sizeof(Pt) + meshTotalIndices * sizeof(unsigned int) +
+            meshTotalGroups * (sizeof(Pt) + sizeof(int));
+        printf("indexed mesh: %lld vertices, %lld indices/frame (%.1f KB) vs %lld unindexed (%.1f KB), "
+            "%.1fx less, %.1fx fewer vertices, vertices from tile corners: %s\n",
+            meshTotalVertices / frameCnt, meshTotalIndices / frameCnt, meshBytes / frameCnt / 1024,
+            totalVertices / frameCnt, flatBytes / frameCnt / 1024, flatBytes / std::max(1.0, meshBytes),
+            (double)totalVertices / std::max(1ll, meshTotalVertices), meshMatch ? "ok" : "FAILED");
+    }
+    if (layout)
+    {
+        // The Pt outputs are what a caller would otherwise copy into its
+        // vertex buffers.
+        printf("packed vertex layout: normals %.3f ms vs %.3f, planes %.3f ms vs %.3f, "
+            "positions and colours %s\n",
+            normalLayoutStats.Total() / frameCnt, normalStats.Total() / frameCnt,
+            planeLayoutStats.Total() / frameCnt, planeStats.Total() / frameCnt,
+            layoutMatch ? "match" : "MISMATCH");
+    }
+    if (describe)
+    {
+        printf("plane descriptors: %.1f planes/frame, %.0f inliers and %.2f m^2 per plane, max rms %g m, tiles %s\n",
+            (double)describedPlanes / frameCnt, (double)describedInliers / std::max(1ll, describedPlanes),
+            describedArea / std::max(1ll, describedPlanes), maxPlaneRms, describeMatch ? "ok" : "MISMATCH");
+    }
+    if (ransac)
+    {
+        PrintPlaneComparison(ransacStats, frameCnt, planeStats.Total() + describeStats.Total(),
+            describedPlanes, describedInliers, describedRmsSq, validPoints);
+    }
+    if (segment)
+    {
+        PrintPlaneComparison(segmentStats, frameCnt, planeStats.Total() + describeStats.Total(),
+            describedPlanes, describedInliers, describedRmsSq, validPoints);
+    }
+    if (unproject)
+    {
+        // Depth is truncated to whole millimetres, so points only come back to 1 mm.
+        printf("unproject from depth: max |point diff| %g m, validity and scalar output %s\n",
+            maxUnprojectDiff, unprojectMatch ? "match" : "MISMATCH");
+    }
+    if (compare)
+    {
+        // The visualization output is (n + 1) / 2, so halve the tolerance.
+        printf("normals speedup vs scalar: %.2fx, max |diff| %g (tolerance %g) %s\n",
+            refNormalStats.Total() / normalStats.Total(), maxNormalDiff,
+            normalSimdTolerance * 0.5f, maxNormalDiff <= normalSimdTolerance * 0.5f ? "ok" : "FAILED");
+        printf("edges and edge mask match single-threaded scalar: %s\n", edgesMatch ? "ok" : "FAILED");
+        if (filter)
+            printf("filter matches single-threaded scalar: %s\n", filterMatch ? "ok" : "FAILED");
+        // Mask scans sum tile residuals in a different order, so only report drift.
+        printf("plane vertices/frame vs scalar: %lld / %lld\n", totalVertices / frameCnt,
+            refTotalVertices / frameCnt);
+    }
+    if (encoder != nullptr)
+    {
+        PrintStage(encodeStats);
+        PrintStage(decodeStats);
+        double rawBytes = (double)encodeStats.Count() * (8 + numPts * sizeof(Pt));
+        printf("codec: %.1f KB/frame, %.1fx smaller than raw, depth %s, max |point diff| %g m\n",
+            encodedBytes / 1024.0 / std::max<size_t>(1, encodeStats.Count()),
+            rawBytes / std::max(1ll, encodedBytes), depthExact ? "exact" : "MISMATCH", maxPointDiff);
+        printf("decoded replay, %d threads at once: %s\n", replayReaders, replayMatch ? "identical" : "MISMATCH");
+    }
+    if (frameCnt > 1)
+    {
+        printf("planes heap allocations/frame after the first: %.1f (context storage: %llu)\n",
+            (double)planeAllocations / (frameCnt - 1), ctxAllocations);
+    }
+    if (steadyFrames > 0)
+    {
+        // Every frame has been seen once, so nothing should need to grow.
+        printf("planes heap allocations after the first loop: %llu in %d frames (context storage: %llu), %s\n",
+            steadyAllocations, steadyFrames, ctxAllocationsSteady,
+            steadyAllocations == 0 && ctxAllocationsSteady == 0 ? "none" : "FAILED");
+    }
+    printf("peak rss: %.1f MB\n", PeakRssKb() / 1024.0);
+    return 0;
+}
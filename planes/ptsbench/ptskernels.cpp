@@ -0,0 +1,315 @@
+// ptskernels: times ptslib's hot kernels one at a time over synthetic
+// frames, at several resolutions and thread counts.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "Pt.h"
+#include "ptslib.h"
+#include "Recording.h"
+#include "Stats.h"
+
+namespace
+{
+    void Usage()
+    {
+        printf("usage: ptskernels [options]\n"
+            "  --size WxH        resolution to run, repeatable (default: 512x424, 640x480 and 256x192)\n"
+            "  --threads LIST    comma-separated thread counts, 0 for one per core (default: 1,2,4)\n"
+            "  --iterations N    timed calls per kernel (default: 100)\n"
+            "  --clutter N       add N small objects to the synthetic scene\n"
+            "  --fit MODE        plane fitting: corners (default) or moments\n");
+    }
+
+    // Distinct synthetic frames the calls cycle through, so the box moves
+    // and the quadtree differs from call to call.
+    const int frameCount = 8;
+
+    struct Size
+    {
+        int width;
+        int height;
+    };
+
+    // One kernel's timings at one size and thread count. pixels is what a
+    // call works on, the frame unless the kernel only visits some of it;
+    // bytes, the least memory traffic per pixel, 0 where the kernel's
+    // traffic depends on the tree rather than the pixels.
+    struct KernelStats
+    {
+        explicit KernelStats(const char* name) :
+            stats(name),
+            pixels(0),
+            bytesPerPixel(0),
+            allocations(0),
+            timedAllocations(false)
+        {
+        }
+
+        StageStats stats;
+        double pixels;
+        double bytesPerPixel;
+        unsigned long long allocations;
+        bool timedAllocations;
+    };
+
+    // Calls fn(frame) iterations times, then after(frame) outside the
+    // timed and counted part of each call.
+    template <typename Fn, typename After> void TimeCalls(int iterations, KernelStats& kernel, Fn fn,
+        After after)
+    {
+        for (int call = 0; call < iterations; ++call)
+        {
+            int frame = call % frameCount;
+            unsigned long long allocsBefore = HeapAllocationCount();
+            StopWatch timer;
+            fn(frame);
+            double ms = timer.ElapsedMs();
+            kernel.allocations += HeapAllocationCount() - allocsBefore;
+            kernel.stats.Add(ms);
+            after(frame);
+        }
+        kernel.timedAllocations = true;
+    }
+
+    template <typename Fn> void TimeCalls(int iterations, KernelStats& kernel, Fn fn)
+    {
+        TimeCalls(iterations, kernel, fn, [](int) {});
+    }
+
+    // Best of a few large copies, counting bytes read and written: the
+    // memory roof the bandwidth-bound kernels are compared against.
+    double CopyBandwidthGBs()
+    {
+        size_t bytes = (size_t)64 << 20;
+        std::vector<char> src(bytes, 1);
+        std::vector<char> dst(bytes, 0);
+        double bestMs = 0;
+        for (int pass = 0; pass < 5; ++pass)
+        {
+            StopWatch timer;
+            memcpy(dst.data(), src.data(), bytes);
+            double ms = timer.ElapsedMs();
+            if (pass == 0 || ms < bestMs)
+                bestMs = ms;
+        }
+        return 2.0 * bytes / (bestMs * 1e6);
+    }
+
+    void PrintKernelHeader()
+    {
+        printf("%-14s %9s %7s %9s %9s %8s %7s %12s\n", "kernel", "size", "threads", "p50 ms",
+            "ns/px", "GB/s", "% roof", "allocs/call");
+    }
+
+    // ns/px and GB/s from the median call, so a stray descheduled call does
+    // not move them.
+    void PrintKernel(const KernelStats& kernel, const Size& size, int threads, double roofGBs)
+    {
+        double ms = kernel.stats.Percentile(50);
+        char sizeText[32];
+        snprintf(sizeText, sizeof(sizeText), "%dx%d", size.width, size.height);
+        char threadText[16];
+        if (threads > 0)
+            snprintf(threadText, sizeof(threadText), "%d", threads);
+        else
+            snprintf(threadText, sizeof(threadText), "auto");
+        double nsPerPixel = kernel.pixels > 0 ? ms * 1e6 / kernel.pixels : 0;
+        printf("%-14s %9s %7s %9.3f %9.3f", kernel.stats.Name().c_str(), sizeText, threadText, ms, nsPerPixel);
+        if (kernel.bytesPerPixel > 0 && ms > 0)
+        {
+            double gbs = kernel.pixels * kernel.bytesPerPixel / (ms * 1e6);
+            printf(" %8.2f %6.0f%%", gbs, 100.0 * gbs / roofGBs);
+        }
+        else
+            printf(" %8s %7s", "-", "-");
+        if (kernel.timedAllocations)
+            printf(" %12.1f\n", (double)kernel.allocations / kernel.stats.Count());
+        else
+            printf(" %12s\n", "-");
+    }
+
+    bool ParseThreads(const char* text, std::vector<int>& out)
+    {
+        out.clear();
+        for (const char* p = text; *p != '\0';)
+        {
+            char* end;
+            long value = strtol(p, &end, 10);
+            if (end == p || value < 0)
+                return false;
+            out.push_back((int)value);
+            p = *end == ',' ? end + 1 : end;
+            if (*end != ',' && *end != '\0')
+                return false;
+        }
+        return !out.empty();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<Size> sizes;
+    std::vector<int> threadCounts = { 1, 2, 4 };
+    int iterations = 100;
+    int clutter = 0;
+    int planeFit = PlaneFitCorners;
+
+    for (int argIdx = 1; argIdx < argc; ++argIdx)
+    {
+        const char* arg = argv[argIdx];
+        bool hasValue = argIdx + 1 < argc;
+        if (strcmp(arg, "--size") == 0 && hasValue)
+        {
+            Size size;
+            if (sscanf(argv[++argIdx], "%dx%d", &size.width, &size.height) != 2 ||
+                size.width < 3 || size.height < 3)
+            {
+                Usage();
+                return 1;
+            }
+            sizes.push_back(size);
+        }
+        else if (strcmp(arg, "--threads") == 0 && hasValue)
+        {
+            if (!ParseThreads(argv[++argIdx], threadCounts))
+            {
+                Usage();
+                return 1;
+            }
+        }
+        else if (strcmp(arg, "--iterations") == 0 && hasValue)
+            iterations = std::max(1, atoi(argv[++argIdx]));
+        else if (strcmp(arg, "--clutter") == 0 && hasValue)
+            clutter = atoi(argv[++argIdx]);
+        else if (strcmp(arg, "--fit") == 0 && hasValue)
+        {
+            const char* mode = argv[++argIdx];
+            if (strcmp(mode, "corners") == 0)
+                planeFit = PlaneFitCorners;
+            else if (strcmp(mode, "moments") == 0)
+                planeFit = PlaneFitMoments;
+            else
+            {
+                Usage();
+                return 1;
+            }
+        }
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+    // Kinect v2, VGA, and an iPhone LiDAR depth map.
+    if (sizes.empty())
+        sizes = { { depthFrameWidth, depthFrameHeight }, { 640, 480 }, { 256, 192 } };
+
+    double roofGBs = CopyBandwidthGBs();
+    printf("simd: %s, %d calls per kernel, memcpy roof %.2f GB/s\n", GetSimdBackend(), iterations, roofGBs);
+    printf("corners, residual, neighbors and merge are timed inside planes by SetContextInstrument;\n"
+        "corners and residual sum every worker's time, and residual counts only the pixels it scanned\n");
+    PrintKernelHeader();
+
+    for (const Size& size : sizes)
+    {
+        size_t numPts = (size_t)size.width * size.height;
+        std::vector<std::vector<Pt>> frames(frameCount, std::vector<Pt>(numPts));
+        std::vector<std::vector<unsigned short>> depthFrames(frameCount,
+            std::vector<unsigned short>(numPts));
+        for (int frame = 0; frame < frameCount; ++frame)
+        {
+            MakeSyntheticFrame(frame, size.width, size.height, frames[frame].data(), clutter);
+            PointsToDepth(frames[frame].data(), size.width, size.height, depthFrames[frame].data());
+        }
+        std::vector<float> edgeVals(numPts * 3);
+        std::vector<unsigned long long> edgeMask((size_t)(size.width + 63) / 64 * size.height);
+        std::vector<Pt> vertices(numPts * 6);
+        std::vector<Pt> texCoords(numPts * 6);
+
+        for (int threads : threadCounts)
+        {
+            DepthContext* ctx = CreateDepthContext(size.width, size.height);
+            SetContextThreadCount(ctx, threads);
+            SetContextPlaneFit(ctx, planeFit);
+            SetContextInstrument(ctx, 1, 0);
+
+            auto edges = [&](int frame) { DepthFindEdgesCtx(ctx, depthFrames[frame].data(), edgeVals.data()); };
+            auto edgeMaskPass = [&](int frame)
+                {
+                    DepthFindEdgeMaskCtx(ctx, depthFrames[frame].data(), edgeMask.data(), nullptr);
+                };
+            // Without an output buffer only the cross/normalize loop runs.
+            auto normals = [&](int frame) { DepthFindNormalsCtx(ctx, (float*)frames[frame].data(), nullptr, -1, -1); };
+            auto planes = [&](int frame)
+                {
+                    int vertexCount = 0;
+                    DepthMakePlanesCtx(ctx, (float*)frames[frame].data(), vertices.data(), texCoords.data(),
+                        (int)vertices.size(), &vertexCount, -1, -1);
+                };
+            // Warm up: the pool's threads, and every list and arena at the
+            // size these frames need.
+            for (int frame = 0; frame < frameCount; ++frame)
+            {
+                edges(frame);
+                edgeMaskPass(frame);
+                normals(frame);
+                planes(frame);
+            }
+
+            // Depth in; the visualization out, or one bit per pixel.
+            KernelStats edgeStats("edges");
+            edgeStats.pixels = (double)numPts;
+            edgeStats.bytesPerPixel = sizeof(unsigned short) + 3 * sizeof(float);
+            TimeCalls(iterations, edgeStats, edges);
+            KernelStats edgeMaskStats("edge-mask");
+            edgeMaskStats.pixels = (double)numPts;
+            edgeMaskStats.bytesPerPixel = sizeof(unsigned short) + 1.0 / 8;
+            TimeCalls(iterations, edgeMaskStats, edgeMaskPass);
+            // Points in, unit normals out.
+            KernelStats normalStats("normals");
+            normalStats.pixels = (double)numPts;
+            normalStats.bytesPerPixel = 2 * sizeof(Pt);
+            TimeCalls(iterations, normalStats, normals);
+
+            KernelStats planeStats("planes");
+            planeStats.pixels = (double)numPts;
+            KernelStats cornerStats("corners");
+            cornerStats.pixels = (double)numPts;
+            KernelStats residualStats("residual");
+            // Each scanned point is read once.
+            residualStats.bytesPerPixel = sizeof(Pt);
+            KernelStats neighborStats("neighbors");
+            neighborStats.pixels = (double)numPts;
+            KernelStats mergeStats("merge");
+            mergeStats.pixels = (double)numPts;
+            long long scanned = 0;
+            TimeCalls(iterations, planeStats, planes, [&](int)
+                {
+                    DepthInstrumentStats frameStats;
+                    if (!GetContextStats(ctx, &frameStats))
+                        return;
+                    cornerStats.stats.Add(frameStats.stageMs[InstrumentCornerSearch]);
+                    residualStats.stats.Add(frameStats.stageMs[InstrumentResidualScan]);
+                    neighborStats.stats.Add(frameStats.stageMs[InstrumentNeighbors]);
+                    mergeStats.stats.Add(frameStats.stageMs[InstrumentMerge]);
+                    scanned += frameStats.pixelsScanned;
+                });
+            residualStats.pixels = (double)scanned / iterations;
+
+            PrintKernel(edgeStats, size, threads, roofGBs);
+            PrintKernel(edgeMaskStats, size, threads, roofGBs);
+            PrintKernel(normalStats, size, threads, roofGBs);
+            PrintKernel(planeStats, size, threads, roofGBs);
+            PrintKernel(cornerStats, size, threads, roofGBs);
+            // Moment fits scan no pixels.
+            if (residualStats.pixels > 0)
+                PrintKernel(residualStats, size, threads, roofGBs);
+            PrintKernel(neighborStats, size, threads, roofGBs);
+            PrintKernel(mergeStats, size, threads, roofGBs);
+            DestroyDepthContext(ctx);
+        }
+    }
+    return 0;
+}
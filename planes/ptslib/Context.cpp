@@ -0,0 +1,305 @@
+#include "pch.h"
+#include <algorithm>
+#include <memory>
+#include "Context.h"
+#include "ptslib.h"
+
+DepthContext::DepthContext(int depthWidth, int depthHeight) :
+    width(depthWidth),
+    height(depthHeight),
+    threadCount(0),
+    normals(depthWidth * depthHeight),
+    simdEnabled(true),
+    planeFit(PlaneFitCorners),
+    coarseSplit(true),
+    neighborSearch(NeighborSearchGrid),
+    moveThreshold(0),
+    lastPickedId(0),
+    colorSeed(1)
+{
+}
+
+ThreadPool& DepthContext::Pool()
+{
+    if (pool == nullptr)
+        pool.reset(new ThreadPool(ResolveThreadCount(threadCount)));
+    return *pool;
+}
+
+void PlaneScratch::BeginFrame(int workerCount, int width, int height)
+{
+    size_t leftCount = (size_t)(width + 1) * height;
+    size_t topCount = (size_t)(height + 1) * width;
+    if (leftEdges.size() != leftCount || topEdges.size() != topCount)
+    {
+        leftEdges.assign(leftCount, -1);
+        topEdges.assign(topCount, -1);
+        allocations += 2;
+    }
+    while ((int)arenas.size() < workerCount)
+    {
+        arenas.emplace_back(new FrameArena());
+        allocations++;
+    }
+    if ((int)workerResults.size() < workerCount)
+    {
+        workerResults.resize(workerCount);
+        workerLinks.resize(workerCount);
+        workerRecords.resize(workerCount);
+        workerCounters.resize(workerCount);
+        allocations += 4;
+    }
+    if (tileQueues.WorkerCount() != workerCount)
+    {
+        tileQueues.Resize(workerCount);
+        allocations++;
+    }
+    size_t arenaBytes = 0;
+    size_t resultCount = 0;
+    size_t recordCount = 0;
+    for (const std::unique_ptr<FrameArena>& arena : arenas)
+        arenaBytes += arena->Used();
+    for (const std::vector<Result*>& list : workerResults)
+        resultCount += list.size();
+    for (const std::vector<TileRecord>& list : workerRecords)
+        recordCount += list.size();
+    m_mostArenaBytes = std::max(m_mostArenaBytes, arenaBytes);
+    m_mostResults = std::max(m_mostResults, resultCount);
+    m_mostRecords = std::max(m_mostRecords, recordCount);
+    for (std::unique_ptr<FrameArena>& arena : arenas)
+    {
+        arena->Reset();
+        arena->Reserve(m_mostArenaBytes);
+    }
+    for (std::vector<Result*>& list : workerResults)
+    {
+        list.clear();
+        if (list.capacity() < m_mostResults)
+        {
+            list.reserve(m_mostResults);
+            allocations++;
+        }
+    }
+    for (std::vector<std::pair<int, int>>& list : workerLinks)
+        list.clear();
+    for (std::vector<TileRecord>& list : workerRecords)
+    {
+        list.clear();
+        if (list.capacity() < m_mostRecords)
+        {
+            list.reserve(m_mostRecords);
+            allocations++;
+        }
+    }
+    for (TileCounters& counters : workerCounters)
+        counters = TileCounters();
+    results.clear();
+    groups.clear();
+    groupStarts.clear();
+
+    size_t capacity = m_capacities.capacity();
+    ListCapacities(m_capacities);
+    if (m_capacities.capacity() != capacity)
+        allocations++;
+}
+
+void PlaneScratch::EndFrame()
+{
+    size_t capacity = m_endCapacities.capacity();
+    ListCapacities(m_endCapacities);
+    if (m_endCapacities.capacity() != capacity)
+        allocations++;
+    for (size_t idx = 0; idx < m_capacities.size(); ++idx)
+    {
+        if (m_endCapacities[idx] != m_capacities[idx])
+            allocations++;
+    }
+}
+
+void PlaneScratch::ListCapacities(std::vector<size_t>& out) const
+{
+    out.clear();
+    for (const std::vector<Result*>& list : workerResults)
+        out.push_back(list.capacity());
+    for (const std::vector<std::pair<int, int>>& list : workerLinks)
+        out.push_back(list.capacity());
+    for (const std::vector<TileRecord>& list : workerRecords)
+        out.push_back(list.capacity());
+    out.push_back(results.capacity());
+    out.push_back(planeSets.Capacity());
+    out.push_back(groups.capacity());
+    out.push_back(groupStarts.capacity());
+    out.push_back(groupOf.capacity());
+    out.push_back(groupColors.capacity());
+    out.push_back(lastGroupStarts.capacity());
+    out.push_back(lastGroupTiles.capacity());
+    out.push_back(tileLinks.capacity());
+    out.push_back(linkTileIds.capacity());
+    out.push_back(linkTileSlots.capacity());
+    out.push_back(tileSlots.capacity());
+    out.push_back(slotTiles.capacity());
+    out.push_back(slotGroups.capacity());
+    out.push_back(freeSlots.capacity());
+    out.push_back(groupDirty.capacity());
+    out.push_back(groupSeeds.capacity());
+}
+
+namespace
+{
+    std::unique_ptr<DepthContext> g_defaultContext;
+    PlaneConstants g_defaultConstants;
+}
+
+DepthContext* GetDefaultContext(int depthWidth, int depthHeight)
+{
+    if (g_defaultContext == nullptr ||
+        g_defaultContext->width != depthWidth ||
+        g_defaultContext->height != depthHeight)
+    {
+        g_defaultContext.reset(new DepthContext(depthWidth, depthHeight));
+        g_defaultContext->constants = g_defaultConstants;
+    }
+    return g_defaultContext.get();
+}
+
+extern "C"
+{
+    DEXPORT DepthContext* CreateDepthContext(int depthWidth, int depthHeight)
+    {
+        if (depthWidth <= 0 || depthHeight <= 0)
+            return nullptr;
+        return new DepthContext(depthWidth, depthHeight);
+    }
+
+    DEXPORT void DestroyDepthContext(DepthContext* ctx)
+    {
+        delete ctx;
+    }
+
+    DEXPORT void SetContextPlaneConstants(DepthContext* ctx, float minDist, float splitThreshold,
+        float minDPVal)
+    {
+        ctx->constants.minDist = minDist;
+        ctx->constants.splitThreshold = splitThreshold;
+        ctx->constants.minDPVal = minDPVal;
+        ctx->tileHistory.Invalidate();
+    }
+
+    DEXPORT void SetContextSimd(DepthContext* ctx, int enable)
+    {
+        ctx->simdEnabled = enable != 0;
+        ctx->tileHistory.Invalidate();
+    }
+
+    DEXPORT void SetContextCoarseSplit(DepthContext* ctx, int enable)
+    {
+        ctx->coarseSplit = enable != 0;
+    }
+
+    DEXPORT void SetContextDepthRays(DepthContext* ctx, const float* rays)
+    {
+        if (rays == nullptr)
+        {
+            ctx->rayX.clear();
+            ctx->rayY.clear();
+            return;
+        }
+        size_t numPts = (size_t)ctx->width * ctx->height;
+        ctx->rayX.resize(numPts);
+        ctx->rayY.resize(numPts);
+        for (size_t idx = 0; idx < numPts; ++idx)
+        {
+            ctx->rayX[idx] = rays[idx * 2];
+            ctx->rayY[idx] = rays[idx * 2 + 1];
+        }
+    }
+
+    DEXPORT void SetContextThreadCount(DepthContext* ctx, int threadCount)
+    {
+        if (threadCount == ctx->threadCount)
+            return;
+        ctx->threadCount = threadCount;
+        ctx->pool.reset();
+    }
+
+    DEXPORT void SetContextPlaneFit(DepthContext* ctx, int planeFit)
+    {
+        ctx->planeFit = planeFit;
+        ctx->tileHistory.Invalidate();
+    }
+
+    DEXPORT void SetContextNeighborSearch(DepthContext* ctx, int neighborSearch)
+    {
+        ctx->neighborSearch = neighborSearch;
+        ctx->tileHistory.Invalidate();
+    }
+
+    DEXPORT void SetContextIncremental(DepthContext* ctx, float moveThreshold)
+    {
+        ctx->moveThreshold = moveThreshold > 0 ? moveThreshold : 0;
+        ctx->tileHistory.Invalidate();
+    }
+
+    DEXPORT void SetContextRansac(DepthContext* ctx, float inlierDist, float inlierMinDot,
+        int minInliers, int maxIterations, float confidence)
+    {
+        ctx->ransac.inlierDist = inlierDist;
+        ctx->ransac.inlierMinDot = inlierMinDot;
+        ctx->ransac.minInliers = minInliers;
+        ctx->ransac.maxIterations = maxIterations;
+        ctx->ransac.confidence = confidence;
+    }
+
+    DEXPORT void SetContextFilter(DepthContext* ctx, int radius, float rangeRatio, float flyingJump,
+        int flyingSupport)
+    {
+        ctx->filter.radius = radius;
+        ctx->filter.rangeRatio = rangeRatio;
+        ctx->filter.flyingJump = flyingJump;
+        ctx->filter.flyingSupport = flyingSupport;
+    }
+
+    DEXPORT void SetContextSegment(DepthContext* ctx, float minNormalDot, float maxPlaneDist,
+        int minPoints)
+    {
+        ctx->segment.minNormalDot = minNormalDot;
+        ctx->segment.maxPlaneDist = maxPlaneDist;
+        ctx->segment.minPoints = minPoints;
+    }
+
+    DEXPORT unsigned long long GetContextAllocationCount(DepthContext* ctx)
+    {
+        const PlaneScratch& scratch = ctx->planeScratch;
+        unsigned long long count = scratch.allocations + scratch.tileQueues.Allocations();
+        for (const std::unique_ptr<FrameArena>& arena : scratch.arenas)
+            count += arena->BlockAllocations();
+        return count;
+    }
+
+    DEXPORT void SetContextInstrument(DepthContext* ctx, int enable, int maxTraceEvents)
+    {
+        ctx->instrument.Enable(enable != 0, maxTraceEvents);
+    }
+
+    DEXPORT int GetContextStats(DepthContext* ctx, DepthInstrumentStats* outStats)
+    {
+        return ctx->instrument.LastFrame(*outStats) ? 1 : 0;
+    }
+
+    DEXPORT int WriteContextTrace(DepthContext* ctx, const char* path)
+    {
+        return ctx->instrument.WriteTrace(path) ? 1 : 0;
+    }
+
+    DEXPORT void SetPlaneConstants(float minDist, float splitThreshold, float minDPVal)
+    {
+        g_defaultConstants.minDist = minDist;
+        g_defaultConstants.splitThreshold = splitThreshold;
+        g_defaultConstants.minDPVal = minDPVal;
+        if (g_defaultContext != nullptr)
+        {
+            g_defaultContext->constants = g_defaultConstants;
+            g_defaultContext->tileHistory.Invalidate();
+        }
+    }
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include "DisjointSet.h"
+#include "FrameArena.h"
+#include "Instrument.h"
+#include "Moments.h"
+#include "Pt.h"
+#include "Ransac.h"
+#include "Segment.h"
+#include "ThreadPool.h"
+#include "TileHistory.h"
+#include "ValidMask.h"
+#include "WorkStealing.h"
+
+struct PlaneConstants
+{
+    PlaneConstants() :
+        minDist(0.05f),
+        splitThreshold(0.005f),
+        minDPVal(0.9f)
+    {
+    }
+
+    // Max point-to-plane distance before a tile is split, and before two
+    // neighbouring tiles are considered the same plane.
+    float minDist;
+    // Max mean point-to-plane distance before a tile is split.
+    float splitThreshold;
+    // Min |dot| between neighbour normals for them to be merged.
+    float minDPVal;
+};
+
+struct FilterParams
+{
+    FilterParams() :
+        radius(2),
+        rangeRatio(0.02f),
+        flyingJump(0.03f),
+        flyingSupport(3)
+    {
+    }
+
+    // Smoothing taps on either side of a pixel, 0 for no smoothing.
+    int radius;
+    // Depth difference, as a fraction of the pixel's depth, past which a
+    // tap gets no weight.
+    float rangeRatio;
+    // Depth difference, likewise, within which a neighbour supports a
+    // pixel.
+    float flyingJump;
+    // Supporting neighbours a pixel needs to be kept, 0 to keep all.
+    int flyingSupport;
+};
+
+struct Result;
+struct Tile;
+
+// Incremental mode: a pair of neighbouring tiles, by slot, and whether
+// they are on the same plane.
+struct TileLink
+{
+    int a;
+    int b;
+    bool samePlane;
+};
+
+// A quadtree tile queued for subdivision.
+struct TileTask
+{
+    Tile* tile;
+    int level;
+};
+
+// DepthMakePlanes storage kept from frame to frame. Tiles, results and
+// neighbour lists come from the arenas, which are reset at the start of
+// each frame, and the lists keep their capacity, so once the largest
+// scene has been seen a frame makes no heap allocations for them.
+struct PlaneScratch
+{
+    PlaneScratch() :
+        linksValid(false),
+        linkGroupCount(0),
+        weldGeneration(0),
+        allocations(0),
+        m_mostArenaBytes(0),
+        m_mostResults(0),
+        m_mostRecords(0)
+    {
+    }
+
+    // Grows the per-worker arenas and result lists to workerCount, sizes
+    // the edge grids and resets everything for a new frame.
+    void BeginFrame(int workerCount, int width, int height);
+    // Counts the lists that had to grow during the frame.
+    void EndFrame();
+
+    // One arena and accepted-tile list per subdivision worker; arena 0 is
+    // also used for the single-threaded stages.
+    std::vector<std::unique_ptr<FrameArena>> arenas;
+    std::vector<std::vector<Result*>> workerResults;
+    // Incremental mode: every tile each worker visited, for TileHistory.
+    std::vector<std::vector<TileRecord>> workerRecords;
+    // Each worker's tile counters, summed once the tree is done.
+    std::vector<TileCounters> workerCounters;
+    StealingQueues<TileTask> tileQueues;
+    std::vector<Result*> results;
+    // Neighbour pairs on the same plane, found by each merge task, and
+    // the sets they are joined in.
+    std::vector<std::vector<std::pair<int, int>>> workerLinks;
+    DisjointSet planeSets;
+    // Connected groups, flattened: group g is
+    // groups[groupStarts[g], groupStarts[g + 1]). groupOf maps a set
+    // root to its group while they are gathered.
+    std::vector<Result*> groups;
+    std::vector<size_t> groupStarts;
+    std::vector<int> groupOf;
+    // Colour each group was drawn in.
+    std::vector<Pt> groupColors;
+    // Incremental mode: last frame's groups as result indices, reused
+    // when none of the tree moved.
+    std::vector<size_t> lastGroupStarts;
+    std::vector<int> lastGroupTiles;
+    // NeighborSearchGrid: the leaf whose left edge is on column line x at
+    // row y, at leftEdges[x * height + y], and whose top edge is on row
+    // line y at column x, at topEdges[y * width + x]. -1 between frames
+    // unless linksValid.
+    std::vector<int> leftEdges;
+    std::vector<int> topEdges;
+    // Incremental mode with NeighborSearchGrid: neighbour pairs and groups
+    // carried over from last frame, so only re-fit tiles are searched and
+    // tested. A tile keeps its slot for as long as it is replayed;
+    // leftEdges, topEdges, rightEdges and bottomEdges then hold the slot
+    // of the leaf with that edge on each line, and are kept between frames.
+    bool linksValid;
+    std::vector<TileLink> tileLinks;
+    // Last frame's tiles in result order, and this frame's slots.
+    std::vector<unsigned long long> linkTileIds;
+    std::vector<int> linkTileSlots;
+    std::vector<int> tileSlots;
+    // Each slot's current result index, -1 when free, and its last group.
+    std::vector<int> slotTiles;
+    std::vector<int> slotGroups;
+    std::vector<int> freeSlots;
+    std::vector<int> rightEdges;
+    std::vector<int> bottomEdges;
+    // Last frame's groups that lost a tile, and a tile kept from each of
+    // the others.
+    int linkGroupCount;
+    std::vector<char> groupDirty;
+    std::vector<int> groupSeeds;
+    // DepthMakePlaneMeshCtx: the vertex made for a frame pixel's quad
+    // corners, valid where weldStamps matches the current group's
+    // weldGeneration, so nothing is cleared between groups.
+    std::vector<unsigned int> weldStamps;
+    std::vector<int> weldVertices;
+    unsigned int weldGeneration;
+
+    // Heap allocations made for this storage so far.
+    unsigned long long allocations;
+
+private:
+    void ListCapacities(std::vector<size_t>& out) const;
+
+    // Capacity of every list at BeginFrame and EndFrame.
+    std::vector<size_t> m_capacities;
+    std::vector<size_t> m_endCapacities;
+    // The most arena bytes, results and records all workers together have
+    // used in a frame. Every worker is given room for that much, as work
+    // stealing may hand any one of them all of it.
+    size_t m_mostArenaBytes;
+    size_t m_mostResults;
+    size_t m_mostRecords;
+};
+
+// Per-stream state. Everything a frame needs is sized once for the
+// context's resolution so the entry points never allocate scratch memory,
+// and two contexts can be used from different threads at the same time.
+struct DepthContext
+{
+    DepthContext(int depthWidth, int depthHeight);
+
+    // Worker pool for the banded kernels, created on first use.
+    ThreadPool& Pool();
+
+    int width;
+    int height;
+    PlaneConstants constants;
+
+    // Requested thread count, 0 for one per core.
+    int threadCount;
+    std::unique_ptr<ThreadPool> pool;
+
+    // DepthUnproject per-pixel rays (x / z, y / z), split into planes for
+    // the vector loads. Empty until SetContextDepthRays.
+    std::vector<float> rayX;
+    std::vector<float> rayY;
+
+    // DepthFilterPointsCtx settings, and its depth planes: the input's,
+    // then with flying pixels removed, then smoothed along rows.
+    FilterParams filter;
+    std::vector<float> filterDepth;
+    std::vector<float> filterClean;
+    std::vector<float> filterRows;
+
+    // DepthFindNormals unit normals.
+    std::vector<Pt> normals;
+    bool simdEnabled;
+
+    // DepthMakePlanes tile fitting, one of PlaneFitMode.
+    int planeFit;
+    MomentTable moments;
+    // Packed Pt::IsValid bits for the SIMD tile scans.
+    ValidMask validMask;
+    // SIMD corner fits test large tiles on a sparse grid first.
+    bool coarseSplit;
+    // Tile adjacency, one of NeighborSearch.
+    int neighborSearch;
+    PlaneScratch planeScratch;
+    // Incremental mode: depth change in metres below which a tile's last
+    // result is reused, 0 when off.
+    float moveThreshold;
+    TileHistory tileHistory;
+
+    // DepthRansacPlanesCtx settings and storage.
+    RansacParams ransac;
+    RansacScratch ransacScratch;
+    // DepthSegmentPlanesCtx settings and storage.
+    SegmentParams segment;
+    SegmentScratch segmentScratch;
+
+    // SetContextInstrument stage timers, counters and trace.
+    Instrument instrument;
+
+    unsigned long long lastPickedId;
+    unsigned int colorSeed;
+};
+
+// Next colour channel in [0, 1] from a DepthContext::colorSeed.
+inline float NextColor(unsigned int& seed)
+{
+    seed = seed * 1103515245u + 12345u;
+    return (float)((seed >> 16) & 0x7FFF) / 0x7FFF;
+}
+
+// Context backing the legacy entry points that take no handle. It is
+// recreated whenever the requested resolution changes.
+DepthContext* GetDefaultContext(int depthWidth, int depthHeight);
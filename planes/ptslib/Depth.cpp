@@ -1,148 +1,297 @@
 // dllmain.cpp : Defines the entry point for the DLL application.
 #include "pch.h"
 #include <cmath>
+#include <cstring>
 #include <vector>
 #include <map>
 #include <memory>
 #include <algorithm>
 #include "Pt.h"
+#include "Context.h"
+#include "Kernels.h"
+#include "VertexWriter.h"
+#include "ptslib.h"
 
-extern "C" {
-    DXY* tmpDbuf = nullptr;
-    DXY* tmpDbuf2 = nullptr;
-    __declspec (dllexport) void DepthFindEdges(unsigned short* dbuf, float* outpts, int depthWidth, int depthHeight)
+namespace
+{
+    void NormalRows(DepthContext* ctx, const Pt* depthPts, Pt* outNrm, bool writeColors, int y0, int y1)
     {
-        if (tmpDbuf == nullptr)
+        int depthWidth = ctx->width;
+        Pt* tmpNrm = ctx->normals.data();
+        for (int y = y0; y < y1; ++y)
         {
-            tmpDbuf = new DXY[depthWidth * depthHeight];
-            tmpDbuf2 = new DXY[depthWidth * depthHeight];
-        }
-        for (int y = 0; y < depthHeight; ++y)
-        {
-            for (int x = 1; x < depthWidth; ++x)
+            if (ctx->simdEnabled)
+                FindNormalsRowSimd(depthPts, tmpNrm, depthWidth, y, 1, depthWidth - 1);
+            else
+                FindNormalsRowScalar(depthPts, tmpNrm, depthWidth, y, 1, depthWidth - 1);
+
+            if (!writeColors)
+                continue;
+            for (int x = 1; x < depthWidth - 1; ++x)
             {
-                unsigned short px = dbuf[y * depthWidth + x - 1];
-                unsigned short nx = dbuf[y * depthWidth + x];
-                tmpDbuf[y * depthWidth + x].dx = (px > 0 && nx > 0) ?
-                    nx - px : badval;
+                Pt nrm = tmpNrm[y * depthWidth + x];
+                nrm += Pt(1, 1, 1);
+                nrm *= 0.5f;
+                outNrm[y * depthWidth + x] = nrm;
             }
         }
+    }
 
-        for (int y = 1; y < depthHeight; ++y)
-        {
-            for (int x = 0; x < depthWidth; ++x)
+    // Splits rows [first, last) into bands and runs them on the context's pool.
+    template <typename Fn> void ForEachBand(DepthContext* ctx, int first, int last, int bytesPerRow, Fn fn)
+    {
+        int bandRows = BandRows(bytesPerRow);
+        int bandCount = (last - first + bandRows - 1) / bandRows;
+        ctx->Pool().Run(bandCount, [&](int band)
             {
-                unsigned short py = dbuf[(y - 1) * depthWidth + x];
-                unsigned short ny = dbuf[y * depthWidth + x];
-                tmpDbuf[y * depthWidth + x].dy = (py > 0 && ny > 0) ?
-                    ny - py : badval;
-            }
-        }
+                int y0 = first + band * bandRows;
+                fn(y0, std::min(last, y0 + bandRows));
+            });
+    }
 
-        int maxx = 0;
-        int maxy = 0;
-        for (int y = 1; y < depthHeight - 1; ++y)
+    // Normals of rows [y0, y1), then a vertex per pixel of them. Border
+    // pixels have no normal, like invalid ones.
+    void NormalLayoutRows(DepthContext* ctx, const Pt* depthPts, const VertexLayout& layout, int px, int py,
+        int y0, int y1)
+    {
+        int depthWidth = ctx->width;
+        int depthHeight = ctx->height;
+        for (int y = y0; y < y1; ++y)
         {
-            for (int x = 1; x < depthWidth - 1; ++x)
+            if (y >= 1 && y < depthHeight - 1)
+                NormalRows(ctx, depthPts, nullptr, false, y, y + 1);
+            size_t first = (size_t)y * depthWidth;
+            const Pt* rowPts = depthPts + first;
+            const Pt* rowNrm = ctx->normals.data() + first;
+            WriteVertices(layout.position, first, depthWidth, 1, [&](int x) { return rowPts[x]; });
+            WriteVertices(layout.normal, first, depthWidth, 0, [&](int x) { return rowNrm[x]; });
+            if (px < 0)
             {
-                DXY& d = tmpDbuf[y * depthWidth + x];
-                DXY& dx1 = tmpDbuf[y * depthWidth + x - 1];
-                DXY& dy1 = tmpDbuf[(y - 1) * depthWidth + x];
-                if (d.IsValid() && dx1.IsValid() && dy1.IsValid())
-                {
-                    DXY ddx = d - dx1;
-                    DXY ddy = d - dy1;
-                    tmpDbuf2[y * depthWidth + x] = DXY(ddx.LengthSq(),
-                        ddy.LengthSq());
-                    maxx = max(maxx, tmpDbuf2[y * depthWidth + x].dx);
-                    maxy = max(maxy, tmpDbuf2[y * depthWidth + x].dy);
-                }
-                else
-                    tmpDbuf2[y * depthWidth + x] = DXY(badval, badval);
+                WriteVertices(layout.color, first, depthWidth, 1, [&](int x)
+                    {
+                        Pt nrm = rowNrm[x];
+                        nrm += Pt(1, 1, 1);
+                        nrm *= 0.5f;
+                        return nrm;
+                    });
             }
-        }
-
-        float* outNrm = (float*)outpts;
-        for (int y = 1; y < depthHeight - 1; ++y)
-        {
-            for (int x = 1; x < depthWidth - 1; ++x)
+            else
             {
-                float fvx = (float)tmpDbuf2[y * depthWidth + x].dx;
-                float fvy = (float)tmpDbuf2[y * depthWidth + x].dy;
-                float fdd = tmpDbuf2->IsValid() ? (float)tmpDbuf2[y * depthWidth + x].LengthSq() : 0;
-                float fd = tmpDbuf->IsValid() ? (float)tmpDbuf[y * depthWidth + x].LengthSq() : 0;
-                int ptIdx = y * depthWidth + x;
-                outNrm[ptIdx * 3] = 0;
-                outNrm[ptIdx * 3 + 1] = fd - 3000.0f;
-                outNrm[ptIdx * 3 + 2] = fdd - 3000.0f;
+                WriteVertices(layout.color, first, depthWidth, 1, [&](int x)
+                    {
+                        return x == px && y == py ? Pt(1, 1, 1) : Pt(0.4f, 0.4f, 0.4f);
+                    });
             }
         }
     }
 }
 
-extern "C"
-{
+extern "C" {
+    DEXPORT int DepthUnprojectCtx(DepthContext* ctx, const unsigned short* dbuf, float* outPts)
+    {
+        if (ctx->rayX.empty())
+            return 0;
+        int depthWidth = ctx->width;
+        const float* rayX = ctx->rayX.data();
+        const float* rayY = ctx->rayY.data();
+        Pt* pts = (Pt*)outPts;
+        bool simdEnabled = ctx->simdEnabled;
+        ForEachBand(ctx, 0, ctx->height, depthWidth * (int)(sizeof(short) + 2 * sizeof(float) + sizeof(Pt)),
+            [&](int y0, int y1)
+            {
+                for (int y = y0; y < y1; ++y)
+                {
+                    if (simdEnabled)
+                        UnprojectRowSimd(dbuf, rayX, rayY, pts, depthWidth, y, 0, depthWidth);
+                    else
+                        UnprojectRowScalar(dbuf, rayX, rayY, pts, depthWidth, y, 0, depthWidth);
+                }
+            });
+        return 1;
+    }
 
-    Pt* tmpNrm = nullptr;
-    static float threshhold = .75;
-    __declspec (dllexport) void DepthFindNormals(float* vals, float* outpts, int px, int py, int depthWidth, int depthHeight)
+    DEXPORT void DepthFilterPointsCtx(DepthContext* ctx, const float* vals, float* outPts)
     {
-        tmpNrm = new Pt[depthWidth * depthHeight];
+        StageScope stage(ctx->instrument, InstrumentFilter);
+        int depthWidth = ctx->width;
+        int depthHeight = ctx->height;
+        const FilterParams& params = ctx->filter;
+        size_t numPts = (size_t)depthWidth * depthHeight;
+        if (ctx->filterDepth.size() != numPts)
+        {
+            ctx->filterDepth.assign(numPts, 0);
+            ctx->filterClean.assign(numPts, 0);
+            ctx->filterRows.assign(numPts, 0);
+        }
+        const Pt* pts = (const Pt*)vals;
+        Pt* filtered = (Pt*)outPts;
+        float* depth = ctx->filterDepth.data();
+        float* clean = ctx->filterClean.data();
+        float* rows = ctx->filterRows.data();
+        bool simdEnabled = ctx->simdEnabled;
 
+        int radius = std::min(std::max(params.radius, 0), maxFilterRadius);
+        bool smooth = radius > 0 && params.rangeRatio > 0;
+        bool removeFlying = params.flyingSupport > 0;
+        // Binomial weights, 1 4 6 4 1 for radius 2.
+        float weights[maxFilterRadius + 1];
+        weights[0] = 1;
+        for (int k = 1; k <= radius; ++k)
+            weights[0] = weights[0] * (2 * radius - k + 1) / k;
+        for (int k = 1; k <= radius; ++k)
+            weights[k] = weights[k - 1] * (radius - k + 1) / (radius + k);
+        const float* cleanSrc = removeFlying ? clean : depth;
 
-        Pt* depthPts = (Pt*)vals;
-        for (int y = 1; y < depthHeight - 1; ++y)
-        {
-            for (int x = 1; x < depthWidth - 1; ++x)
+        // Each pass reads its neighbours' rows from the one before, so the
+        // passes are separate band runs.
+        ForEachBand(ctx, 0, depthHeight, depthWidth * (int)(sizeof(Pt) + sizeof(float)),
+            [&](int y0, int y1)
             {
-                Pt& ptx1 = depthPts[y * depthWidth + x + 1];
-                Pt& ptx2 = depthPts[y * depthWidth + x - 1];
-                Pt& pty1 = depthPts[(y - 1) * depthWidth + x];
-                Pt& pty2 = depthPts[(y + 1) * depthWidth + x];
-                Pt& outPt = tmpNrm[y * depthWidth + x];
-                if (ptx1.IsValid() && ptx2.IsValid() &&
-                    pty1.IsValid() && pty2.IsValid())
+                for (int y = y0; y < y1; ++y)
                 {
-                    Pt dx = ptx1 - ptx2;
-                    Pt dy = pty1 - pty2;
-                    outPt = Cross(dx, dy);
-                    outPt.Normalize();
+                    if (simdEnabled)
+                        DepthFromPointsRowSimd(pts, depth, depthWidth, y, 0, depthWidth);
+                    else
+                        DepthFromPointsRowScalar(pts, depth, depthWidth, y, 0, depthWidth);
                 }
-                else
+            });
+        if (removeFlying || smooth)
+        {
+            ForEachBand(ctx, 0, depthHeight, depthWidth * (int)(6 * sizeof(float)),
+                [&](int y0, int y1)
                 {
-                    outPt = Pt(0, 0, 0);
-                }
-
-            }
+                    for (int y = y0; y < y1; ++y)
+                    {
+                        if (removeFlying && simdEnabled)
+                            RemoveFlyingRowSimd(depth, clean, depthWidth, depthHeight, y, 0, depthWidth,
+                                params.flyingJump, params.flyingSupport);
+                        else if (removeFlying)
+                            RemoveFlyingRowScalar(depth, clean, depthWidth, depthHeight, y, 0, depthWidth,
+                                params.flyingJump, params.flyingSupport);
+                        if (smooth && simdEnabled)
+                            SmoothDepthRowSimd(cleanSrc, rows, depthWidth, depthHeight, y, 0, depthWidth, 1,
+                                weights, radius, params.rangeRatio);
+                        else if (smooth)
+                            SmoothDepthRowScalar(cleanSrc, rows, depthWidth, depthHeight, y, 0, depthWidth, 1,
+                                weights, radius, params.rangeRatio);
+                    }
+                });
         }
+        // The column pass writes over the input depth, which nothing reads
+        // any more.
+        const float* result = smooth ? depth : cleanSrc;
+        ForEachBand(ctx, 0, depthHeight, depthWidth * (int)((2 * radius + 2) * sizeof(float) + 2 * sizeof(Pt)),
+            [&](int y0, int y1)
+            {
+                for (int y = y0; y < y1; ++y)
+                {
+                    if (smooth && simdEnabled)
+                        SmoothDepthRowSimd(rows, depth, depthWidth, depthHeight, y, 0, depthWidth, depthWidth,
+                            weights, radius, params.rangeRatio);
+                    else if (smooth)
+                        SmoothDepthRowScalar(rows, depth, depthWidth, depthHeight, y, 0, depthWidth, depthWidth,
+                            weights, radius, params.rangeRatio);
+                    if (simdEnabled)
+                        RescalePointsRowSimd(pts, result, filtered, depthWidth, y, 0, depthWidth);
+                    else
+                        RescalePointsRowScalar(pts, result, filtered, depthWidth, y, 0, depthWidth);
+                }
+            });
+    }
 
-        if (px >= 0)
+    DEXPORT void DepthFindEdgeMaskCtx(DepthContext* ctx, const unsigned short* dbuf,
+        unsigned long long* outMask, float* outpts)
+    {
+        int depthWidth = ctx->width;
+        int depthHeight = ctx->height;
+        uint64_t* mask = (uint64_t*)outMask;
+        size_t wordsPerRow = EdgeMaskWordsPerRow(depthWidth);
+        if (mask != nullptr)
         {
-            Pt* outNrm = (Pt*)outpts;
-            for (int y = 1; y < depthHeight - 1; ++y)
+            memset(mask, 0, wordsPerRow * sizeof(uint64_t));
+            memset(mask + wordsPerRow * (depthHeight - 1), 0, wordsPerRow * sizeof(uint64_t));
+        }
+        bool simdEnabled = ctx->simdEnabled;
+        // Every row reads only the raw depth, so bands need no halo pass.
+        ForEachBand(ctx, 1, depthHeight - 1, depthWidth * (int)(3 * sizeof(short) + 3 * sizeof(float)),
+            [&](int y0, int y1)
             {
-                for (int x = 1; x < depthWidth - 1; ++x)
+                for (int y = y0; y < y1; ++y)
                 {
-                    outNrm[y * depthWidth + x] = Pt(0.4f, 0.4f, 0.4f);
+                    if (mask != nullptr)
+                        memset(mask + wordsPerRow * y, 0, wordsPerRow * sizeof(uint64_t));
+                    if (simdEnabled)
+                        FindEdgesRowSimd(dbuf, outpts, mask, depthWidth, y, 1, depthWidth - 1);
+                    else
+                        FindEdgesRowScalar(dbuf, outpts, mask, depthWidth, y, 1, depthWidth - 1);
                 }
-            }
+            });
+    }
 
-            outNrm[py * depthWidth + px] = Pt(1, 1, 1);
-        }
-        else
+    DEXPORT void DepthFindEdgesCtx(DepthContext* ctx, unsigned short* dbuf, float* outpts)
+    {
+        DepthFindEdgeMaskCtx(ctx, dbuf, nullptr, outpts);
+    }
+
+    DEXPORT void DepthFindEdges(unsigned short* dbuf, float* outpts, int depthWidth, int depthHeight)
+    {
+        DepthFindEdgesCtx(GetDefaultContext(depthWidth, depthHeight), dbuf, outpts);
+    }
+}
+
+extern "C"
+{
+
+    DEXPORT void DepthFindNormalsCtx(DepthContext* ctx, float* vals, float* outpts, int px, int py)
+    {
+        StageScope stage(ctx->instrument, InstrumentNormals);
+        int depthWidth = ctx->width;
+        int depthHeight = ctx->height;
+        Pt* depthPts = (Pt*)vals;
+        Pt* outNrm = (Pt*)outpts;
+        bool writeColors = px < 0 && outNrm != nullptr;
+
+        // Rows only read their y - 1 and y + 1 neighbours from the input, so
+        // bands write disjoint output and need no synchronization.
+        ForEachBand(ctx, 1, depthHeight - 1, depthWidth * (int)(5 * sizeof(Pt)),
+            [&](int y0, int y1) { NormalRows(ctx, depthPts, outNrm, writeColors, y0, y1); });
+
+        if (px >= 0 && outNrm != nullptr)
         {
-            Pt* outNrm = (Pt*)outpts;
             for (int y = 1; y < depthHeight - 1; ++y)
             {
                 for (int x = 1; x < depthWidth - 1; ++x)
                 {
-                    Pt nrm = tmpNrm[y * depthWidth + x];
-                    nrm += Pt(1, 1, 1);
-                    nrm *= 0.5f;
-                    outNrm[y * depthWidth + x] = nrm;
+                    outNrm[y * depthWidth + x] = Pt(0.4f, 0.4f, 0.4f);
                 }
             }
+
+            outNrm[py * depthWidth + px] = Pt(1, 1, 1);
         }
     }
+
+    DEXPORT void DepthFindNormalsLayoutCtx(DepthContext* ctx, float* vals, const VertexLayout* layout,
+        int px, int py)
+    {
+        StageScope stage(ctx->instrument, InstrumentNormals);
+        ForEachBand(ctx, 0, ctx->height, ctx->width * (int)(5 * sizeof(Pt)),
+            [&](int y0, int y1) { NormalLayoutRows(ctx, (const Pt*)vals, *layout, px, py, y0, y1); });
+    }
+
+    DEXPORT const char* GetSimdBackend()
+    {
+        return SimdBackendName();
+    }
+
+    DEXPORT void DepthFindNormals(float* vals, float* outpts, int px, int py, int depthWidth, int depthHeight)
+    {
+        DepthFindNormalsCtx(GetDefaultContext(depthWidth, depthHeight), vals, outpts, px, py);
+    }
+
+    DEXPORT void DepthFindNormalsLayout(float* vals, const VertexLayout* layout, int px, int py,
+        int depthWidth, int depthHeight)
+    {
+        DepthFindNormalsLayoutCtx(GetDefaultContext(depthWidth, depthHeight), vals, layout, px, py);
+    }
 }
 
@@ -0,0 +1,434 @@
+#include "pch.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "DepthCodec.h"
+#include "Kernels.h"
+#include "ptslib.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+    // Unary prefixes at least this long are followed by the raw value.
+    const int escapeLength = 24;
+    const int rawValueBits = 17;
+
+    inline int LeadingZeros(uint64_t v)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanReverse64(&idx, v);
+        return 63 - (int)idx;
+#else
+        return __builtin_clzll(v);
+#endif
+    }
+
+    // MSB-first bit stream.
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& out) : m_out(out), m_acc(0), m_used(0) {}
+
+        // bits in [1, 56].
+        void Put(uint64_t value, int bits)
+        {
+            m_acc |= value << (64 - m_used - bits);
+            m_used += bits;
+            while (m_used >= 8)
+            {
+                m_out.push_back((uint8_t)(m_acc >> 56));
+                m_acc <<= 8;
+                m_used -= 8;
+            }
+        }
+
+        void Flush()
+        {
+            if (m_used > 0)
+                m_out.push_back((uint8_t)(m_acc >> 56));
+            m_acc = 0;
+            m_used = 0;
+        }
+
+    private:
+        std::vector<uint8_t>& m_out;
+        uint64_t m_acc;
+        int m_used;
+    };
+
+    class BitReader
+    {
+    public:
+        BitReader(const uint8_t* data, size_t size) :
+            m_next(data), m_end(data + size), m_acc(0), m_avail(0), m_consumed(0),
+            m_totalBits((unsigned long long)size * 8)
+        {
+        }
+
+        // bits in [1, 32].
+        uint32_t Get(int bits)
+        {
+            Refill();
+            uint32_t value = (uint32_t)(m_acc >> (64 - bits));
+            Consume(bits);
+            return value;
+        }
+
+        // A Golomb-Rice code with parameter k, from one refill.
+        uint32_t Rice(int k)
+        {
+            Refill();
+            int zeros = LeadingZeros(m_acc | (1ull << (63 - escapeLength)));
+            if (zeros >= escapeLength)
+            {
+                Consume(escapeLength);
+                return Get(rawValueBits);
+            }
+            // Shifting by 63 - k and then 1 keeps k = 0 defined.
+            uint64_t rest = m_acc << (zeros + 1);
+            uint32_t low = (uint32_t)((rest >> 1) >> (63 - k));
+            Consume(zeros + 1 + k);
+            return ((uint32_t)zeros << k) | low;
+        }
+
+        // Read into the zeros past the end of the data: it was corrupt.
+        bool Overrun() const { return m_consumed > m_totalBits; }
+
+    private:
+        void Refill()
+        {
+            if (m_avail > 56)
+                return;
+            if (m_end - m_next >= 8)
+            {
+                // Whole bytes that fit, in one big-endian load.
+                uint64_t word = 0;
+                for (int idx = 0; idx < 8; ++idx)
+                    word = (word << 8) | m_next[idx];
+                m_acc |= word >> m_avail;
+                m_next += (63 - m_avail) >> 3;
+                m_avail |= 56;
+                return;
+            }
+            while (m_avail <= 56)
+            {
+                uint64_t byte = m_next < m_end ? *m_next++ : 0;
+                m_acc |= byte << (56 - m_avail);
+                m_avail += 8;
+            }
+        }
+
+        void Consume(int bits)
+        {
+            m_acc <<= bits;
+            m_avail -= bits;
+            m_consumed += bits;
+        }
+
+        const uint8_t* m_next;
+        const uint8_t* m_end;
+        uint64_t m_acc;
+        int m_avail;
+        unsigned long long m_consumed;
+        unsigned long long m_totalBits;
+    };
+
+    // Adaptive Golomb-Rice parameter from the running mean magnitude, as
+    // in JPEG-LS.
+    struct RiceState
+    {
+        RiceState() : sum(4), count(1), k(2) {}
+
+        // k stays the smallest with count << k >= sum; it rarely moves, so
+        // it is stepped rather than searched for.
+        void Update(uint32_t value)
+        {
+            sum += value;
+            if (++count == 64)
+            {
+                sum >>= 1;
+                count >>= 1;
+            }
+            while ((count << k) < sum && k < 16)
+                ++k;
+            while (k > 0 && (count << (k - 1)) >= sum)
+                --k;
+        }
+
+        uint32_t sum;
+        uint32_t count;
+        int k;
+    };
+
+    void PutRice(BitWriter& bits, RiceState& state, uint32_t value)
+    {
+        int k = state.k;
+        uint32_t q = value >> k;
+        if (q < (uint32_t)escapeLength)
+            bits.Put(((uint64_t)1 << k) | (value & ((1u << k) - 1)), (int)q + 1 + k);
+        else
+        {
+            bits.Put(0, escapeLength);
+            bits.Put(value, rawValueBits);
+        }
+        state.Update(value);
+    }
+
+    uint32_t GetRice(BitReader& bits, RiceState& state)
+    {
+        uint32_t value = bits.Rice(state.k);
+        state.Update(value);
+        return value;
+    }
+
+    const int contextCount = 8;
+
+    // Residual context by local gradient, 0 for flat up to 6; 7 is for
+    // pixels next to invalid ones.
+    const uint8_t activityContext[64] =
+    {
+        0, 1, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4,
+        4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+        5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+        5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6
+    };
+
+    // Prediction for a valid pixel from its reconstructed left, above and
+    // above-left neighbours, 0 where invalid, and the Rice context to code
+    // the residual in.
+    inline int Predict(int a, int b, int c, int lastValid, int& context)
+    {
+        if (a != 0 && b != 0 && c != 0)
+        {
+            int activity = std::min(abs(a - c) + abs(b - c), 63);
+            context = activityContext[activity];
+            // Median edge detector: the median of a, b and a + b - c.
+            int lo = std::min(a, b);
+            int hi = std::max(a, b);
+            return std::max(lo, std::min(hi, a + b - c));
+        }
+        context = contextCount - 1;
+        if (a != 0 && b != 0)
+            return (a + b) / 2;
+        if (a != 0)
+            return a;
+        if (b != 0)
+            return b;
+        return lastValid;
+    }
+
+    inline uint32_t ZigZag(int v) { return v >= 0 ? (uint32_t)v << 1 : ((uint32_t)-v << 1) - 1; }
+    inline int UnZigZag(uint32_t u) { return (u & 1) ? -(int)((u + 1) >> 1) : (int)(u >> 1); }
+}
+
+void EncodeDepth(const uint16_t* depth, int width, int height, std::vector<uint8_t>& out)
+{
+    BitWriter bits(out);
+    RiceState runState;
+    RiceState residualStates[contextCount];
+    int lastValid = 0;
+    for (int y = 0; y < height; ++y)
+    {
+        const uint16_t* row = depth + (size_t)y * width;
+        const uint16_t* above = y > 0 ? row - width : nullptr;
+
+        // Alternating invalid / valid run lengths, starting with invalid.
+        bool valid = false;
+        int runStart = 0;
+        for (int x = 0; x <= width; ++x)
+        {
+            if (x == width || (row[x] != 0) != valid)
+            {
+                // Only the first run can be empty.
+                PutRice(bits, runState, (uint32_t)(x - runStart));
+                runStart = x;
+                valid = !valid;
+            }
+        }
+
+        for (int x = 0; x < width; ++x)
+        {
+            int d = row[x];
+            if (d == 0)
+                continue;
+            int a = x > 0 ? row[x - 1] : 0;
+            int b = above != nullptr ? above[x] : 0;
+            int c = (above != nullptr && x > 0) ? above[x - 1] : 0;
+            int context;
+            int pred = Predict(a, b, c, lastValid, context);
+            PutRice(bits, residualStates[context], ZigZag(d - pred));
+            lastValid = d;
+        }
+    }
+    bits.Flush();
+}
+
+bool DecodeDepth(const uint8_t* data, size_t size, int width, int height, uint16_t* outDepth)
+{
+    BitReader bits(data, size);
+    RiceState runState;
+    RiceState residualStates[contextCount];
+    int lastValid = 0;
+    for (int y = 0; y < height; ++y)
+    {
+        uint16_t* row = outDepth + (size_t)y * width;
+        const uint16_t* above = y > 0 ? row - width : nullptr;
+
+        // Valid pixels are marked 1 until their depth is decoded.
+        bool valid = false;
+        int x = 0;
+        while (x < width)
+        {
+            uint32_t run = GetRice(bits, runState);
+            if (run > (uint32_t)(width - x) || bits.Overrun())
+                return false;
+            std::fill(row + x, row + x + run, valid ? 1 : 0);
+            x += run;
+            valid = !valid;
+        }
+
+        for (x = 0; x < width; ++x)
+        {
+            if (row[x] == 0)
+                continue;
+            int a = x > 0 ? row[x - 1] : 0;
+            int b = above != nullptr ? above[x] : 0;
+            int c = (above != nullptr && x > 0) ? above[x - 1] : 0;
+            int context;
+            int pred = Predict(a, b, c, lastValid, context);
+            int d = pred + UnZigZag(GetRice(bits, residualStates[context]));
+            if (d <= 0 || d > 65535)
+                return false;
+            row[x] = (uint16_t)d;
+            lastValid = d;
+        }
+        if (bits.Overrun())
+            return false;
+    }
+    return true;
+}
+
+void UnprojectDepth(const uint16_t* depth, const float* rayX, const float* rayY, int width, int height,
+    Pt* outPts)
+{
+    for (int y = 0; y < height; ++y)
+        UnprojectRowSimd(depth, rayX, rayY, outPts, width, y, 0, width);
+}
+
+DepthRecordingWriter::DepthRecordingWriter(int width, int height) :
+    m_file(nullptr),
+    m_width(width),
+    m_height(height),
+    m_headerWritten(false),
+    m_bytesWritten(0)
+{
+}
+
+DepthRecordingWriter::~DepthRecordingWriter()
+{
+    Close();
+}
+
+bool DepthRecordingWriter::Open(const char* path)
+{
+    Close();
+    m_file = fopen(path, "wb");
+    if (m_file == nullptr)
+        return false;
+    size_t numPts = (size_t)m_width * m_height;
+    m_rays.assign(numPts * 2, 0);
+    m_rayKnown.assign(numPts, 0);
+    m_depth.resize(numPts);
+    m_headerWritten = false;
+    m_bytesWritten = 0;
+    return true;
+}
+
+void DepthRecordingWriter::Close()
+{
+    if (m_file != nullptr)
+        fclose(m_file);
+    m_file = nullptr;
+}
+
+bool DepthRecordingWriter::Write(const void* data, size_t size)
+{
+    if (fwrite(data, 1, size, m_file) != size)
+        return false;
+    m_bytesWritten += size;
+    return true;
+}
+
+bool DepthRecordingWriter::WriteFrame(long long timestamp, const Pt* pts)
+{
+    if (m_file == nullptr)
+        return false;
+    size_t numPts = (size_t)m_width * m_height;
+    m_patches.clear();
+    for (size_t idx = 0; idx < numPts; ++idx)
+    {
+        uint16_t d = PointDepthMm(pts[idx]);
+        m_depth[idx] = d;
+        if (d == 0 || m_rayKnown[idx])
+            continue;
+        // The ray is fixed per pixel; the first valid sample gives it.
+        RayPatch patch = { (uint32_t)idx, pts[idx].x / pts[idx].z, pts[idx].y / pts[idx].z };
+        m_rays[idx * 2] = patch.x;
+        m_rays[idx * 2 + 1] = patch.y;
+        m_rayKnown[idx] = 1;
+        if (m_headerWritten)
+            m_patches.push_back(patch);
+    }
+
+    if (!m_headerWritten)
+    {
+        DepthCodecHeader header;
+        memcpy(header.magic, depthCodecMagic, sizeof(header.magic));
+        header.version = depthCodecVersion;
+        header.width = m_width;
+        header.height = m_height;
+        if (!Write(&header, sizeof(header)) || !Write(m_rays.data(), m_rays.size() * sizeof(float)))
+            return false;
+        m_headerWritten = true;
+    }
+
+    m_payload.clear();
+    EncodeDepth(m_depth.data(), m_width, m_height, m_payload);
+    DepthFrameHeader frame;
+    frame.timestamp = timestamp;
+    frame.payloadBytes = (uint32_t)m_payload.size();
+    frame.rayCount = (uint32_t)m_patches.size();
+    return Write(&frame, sizeof(frame)) &&
+        Write(m_patches.data(), m_patches.size() * sizeof(RayPatch)) &&
+        Write(m_payload.data(), m_payload.size());
+}
+
+extern "C"
+{
+    DEXPORT DepthRecordingWriter* OpenDepthRecordingWriter(const char* path, int depthWidth, int depthHeight)
+    {
+        if (path == nullptr || depthWidth <= 0 || depthHeight <= 0)
+            return nullptr;
+        DepthRecordingWriter* writer = new DepthRecordingWriter(depthWidth, depthHeight);
+        if (!writer->Open(path))
+        {
+            delete writer;
+            return nullptr;
+        }
+        return writer;
+    }
+
+    DEXPORT int WriteDepthRecordingFrame(DepthRecordingWriter* writer, long long timestamp, const float* pts)
+    {
+        return writer->WriteFrame(timestamp, (const Pt*)pts) ? 1 : 0;
+    }
+
+    DEXPORT void CloseDepthRecordingWriter(DepthRecordingWriter* writer)
+    {
+        delete writer;
+    }
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "Pt.h"
+
+// Compressed depth recordings. A camera-space point is its pixel's fixed
+// ray scaled by its depth, so a file stores the rays once and each frame
+// as 16-bit millimetre depth: a validity run-length per row, then every
+// valid pixel as the residual from a median edge predictor, coded with
+// adaptive Golomb-Rice codes. Frames decode independently of each other.
+//
+// Layout, little-endian:
+//   header   "PTDZ", uint32 version, int32 width, int32 height,
+//            float rays[width * height][2] (x / z, y / z; 0 if not seen yet)
+//   frame    int64 timestamp, uint32 payloadBytes, uint32 rayCount,
+//            RayPatch rays[rayCount], payload
+// Rays of pixels that first become valid after the header are patched in
+// by the frame they appear in.
+
+const char depthCodecMagic[4] = { 'P', 'T', 'D', 'Z' };
+const uint32_t depthCodecVersion = 1;
+
+struct DepthCodecHeader
+{
+    char magic[4];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+};
+
+struct DepthFrameHeader
+{
+    int64_t timestamp;
+    uint32_t payloadBytes;
+    uint32_t rayCount;
+};
+
+struct RayPatch
+{
+    uint32_t pixel;
+    float x;
+    float y;
+};
+
+// Millimetre depth of a camera-space point, 0 when it is not valid.
+inline uint16_t PointDepthMm(const Pt& pt)
+{
+    Pt p = pt;
+    if (!p.IsValid() || !(p.z > 0))
+        return 0;
+    float mm = p.z * 1000.0f + 0.5f;
+    return mm >= 65535.0f ? 65535 : (uint16_t)mm;
+}
+
+// Appends one frame's depth to out.
+void EncodeDepth(const uint16_t* depth, int width, int height, std::vector<uint8_t>& out);
+// Fills outDepth from a payload written by EncodeDepth. False if the
+// payload is truncated or corrupt.
+bool DecodeDepth(const uint8_t* data, size_t size, int width, int height, uint16_t* outDepth);
+
+// Points from millimetre depth and the per-pixel rays, with the Kinect's
+// -inf for pixels without depth.
+void UnprojectDepth(const uint16_t* depth, const float* rayX, const float* rayY, int width, int height,
+    Pt* outPts);
+
+// Writes camera-space frames as a compressed recording that
+// OpenDepthRecording reads. Depth is kept to the millimetre, and points
+// come back as ray * depth, which matches the input to float rounding.
+class DepthRecordingWriter
+{
+public:
+    DepthRecordingWriter(int width, int height);
+    ~DepthRecordingWriter();
+
+    bool Open(const char* path);
+    bool WriteFrame(long long timestamp, const Pt* pts);
+    void Close();
+
+    // Bytes written so far.
+    unsigned long long BytesWritten() const { return m_bytesWritten; }
+
+private:
+    bool Write(const void* data, size_t size);
+
+    FILE* m_file;
+    int m_width;
+    int m_height;
+    bool m_headerWritten;
+    unsigned long long m_bytesWritten;
+    std::vector<float> m_rays;
+    std::vector<uint8_t> m_rayKnown;
+    std::vector<RayPatch> m_patches;
+    std::vector<uint16_t> m_depth;
+    std::vector<uint8_t> m_payload;
+};
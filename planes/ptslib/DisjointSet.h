@@ -0,0 +1,51 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+// Union-find over 0..count-1 with path compression and union by rank.
+// Storage is kept between Reset calls.
+class DisjointSet
+{
+public:
+    void Reset(int count)
+    {
+        m_parent.resize(count);
+        m_rank.assign(count, 0);
+        for (int idx = 0; idx < count; ++idx)
+            m_parent[idx] = idx;
+    }
+
+    int Find(int idx)
+    {
+        int root = idx;
+        while (m_parent[root] != root)
+            root = m_parent[root];
+        while (m_parent[idx] != root)
+        {
+            int next = m_parent[idx];
+            m_parent[idx] = root;
+            idx = next;
+        }
+        return root;
+    }
+
+    void Union(int a, int b)
+    {
+        a = Find(a);
+        b = Find(b);
+        if (a == b)
+            return;
+        if (m_rank[a] < m_rank[b])
+            std::swap(a, b);
+        m_parent[b] = a;
+        if (m_rank[a] == m_rank[b])
+            m_rank[a]++;
+    }
+
+    size_t Capacity() const { return m_parent.capacity() + m_rank.capacity(); }
+
+private:
+    std::vector<int> m_parent;
+    std::vector<int> m_rank;
+};
@@ -0,0 +1,116 @@
+#include "pch.h"
+#include "Kernels.h"
+#include "Simd.h"
+
+namespace
+{
+    // to - from, valid only if both pixels have depth.
+    inline bool DepthDiff(unsigned short from, unsigned short to, float& diff)
+    {
+        diff = (float)to - (float)from;
+        return from > 0 && to > 0;
+    }
+
+    // ORs 8 mask bits starting at column x into a row of 64-bit words.
+    inline void SetMaskBits(uint64_t* maskRow, int x, uint64_t bits)
+    {
+        int shift = x & 63;
+        maskRow[x >> 6] |= bits << shift;
+        if (shift > 56)
+            maskRow[(x >> 6) + 1] |= bits >> (64 - shift);
+    }
+}
+
+void FindEdgesRowScalar(const unsigned short* dbuf, float* outVis, uint64_t* outMask,
+    int width, int y, int x0, int x1)
+{
+    const unsigned short* row = dbuf + y * width;
+    const unsigned short* rowUp = row - width;
+    uint64_t* maskRow = outMask != nullptr ? outMask + (size_t)y * EdgeMaskWordsPerRow(width) : nullptr;
+    for (int x = x0; x < x1; ++x)
+    {
+        float dX, dY, leftX, leftY, upX, upY;
+        bool valid = DepthDiff(row[x - 1], row[x], dX) & DepthDiff(rowUp[x], row[x], dY);
+        // Column 0 has no horizontal difference and row 0 no vertical
+        // one; both read as 0.
+        bool leftValid = DepthDiff(rowUp[x - 1], row[x - 1], leftY);
+        leftX = 0;
+        if (x >= 2)
+            leftValid &= DepthDiff(row[x - 2], row[x - 1], leftX);
+        bool upValid = DepthDiff(rowUp[x - 1], rowUp[x], upX);
+        upY = 0;
+        if (y >= 2)
+            upValid &= DepthDiff(rowUp[x - width], rowUp[x], upY);
+
+        float fd = valid ? dX * dX + dY * dY : 0;
+        float fdd = 0;
+        if (valid && leftValid && upValid)
+        {
+            float ax = dX - leftX, ay = dY - leftY;
+            float bx = dX - upX, by = dY - upY;
+            float a = ax * ax + ay * ay;
+            float b = bx * bx + by * by;
+            fdd = a * a + b * b;
+        }
+        if (outVis != nullptr)
+        {
+            float* vis = outVis + (size_t)(y * width + x) * 3;
+            vis[0] = 0;
+            vis[1] = fd - edgeJumpSq;
+            vis[2] = fdd - edgeJumpSq;
+        }
+        if (maskRow != nullptr && fd > edgeJumpSq)
+            maskRow[x >> 6] |= 1ull << (x & 63);
+    }
+}
+
+void FindEdgesRowSimd(const unsigned short* dbuf, float* outVis, uint64_t* outMask,
+    int width, int y, int x0, int x1)
+{
+    using namespace simd;
+    // The first two rows and columns read the zero differences at the
+    // border, which the scalar kernel handles.
+    if (y < 2)
+    {
+        FindEdgesRowScalar(dbuf, outVis, outMask, width, y, x0, x1);
+        return;
+    }
+    int x = x0;
+    if (x < 2)
+    {
+        FindEdgesRowScalar(dbuf, outVis, outMask, width, y, x, 2);
+        x = 2;
+    }
+    const unsigned short* row = dbuf + y * width;
+    const unsigned short* rowUp = row - width;
+    const unsigned short* rowUp2 = rowUp - width;
+    uint64_t* maskRow = outMask != nullptr ? outMask + (size_t)y * EdgeMaskWordsPerRow(width) : nullptr;
+    F8 zero = Set1(0);
+    F8 jump = Set1(edgeJumpSq);
+    for (; x + 8 <= x1; x += 8)
+    {
+        F8 c = LoadU16(row + x);
+        F8 l = LoadU16(row + x - 1);
+        F8 ll = LoadU16(row + x - 2);
+        F8 u = LoadU16(rowUp + x);
+        F8 ul = LoadU16(rowUp + x - 1);
+        F8 uu = LoadU16(rowUp2 + x);
+        F8 cValid = CmpGt(c, zero), lValid = CmpGt(l, zero), uValid = CmpGt(u, zero);
+        F8 ulValid = CmpGt(ul, zero);
+
+        F8 dX = c - l, dY = c - u;
+        F8 valid = cValid & lValid & uValid;
+        F8 allValid = valid & ulValid & CmpGt(ll, zero) & CmpGt(uu, zero);
+        F8 ax = dX - (l - ll), ay = dY - (l - ul);
+        F8 bx = dX - (u - ul), by = dY - (u - uu);
+        F8 a = ax * ax + ay * ay;
+        F8 b = bx * bx + by * by;
+        F8 fd = Select(valid, dX * dX + dY * dY, zero);
+        F8 fdd = Select(allValid, a * a + b * b, zero);
+        if (outVis != nullptr)
+            StorePts((Pt*)(outVis + (size_t)(y * width + x) * 3), zero, fd - jump, fdd - jump);
+        if (maskRow != nullptr)
+            SetMaskBits(maskRow, x, (uint64_t)MoveMask(CmpGt(fd, jump)));
+    }
+    FindEdgesRowScalar(dbuf, outVis, outMask, width, y, x, x1);
+}
@@ -0,0 +1,205 @@
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include "Kernels.h"
+#include "Simd.h"
+
+void DepthFromPointsRowScalar(const Pt* pts, float* outDepth, int width, int y, int x0, int x1)
+{
+    for (int x = x0; x < x1; ++x)
+    {
+        int idx = y * width + x;
+        Pt pt = pts[idx];
+        outDepth[idx] = pt.IsValid() ? pt.z : 0;
+    }
+}
+
+void DepthFromPointsRowSimd(const Pt* pts, float* outDepth, int width, int y, int x0, int x1)
+{
+    using namespace simd;
+    F8 zero = Set1(0);
+    int x = x0;
+    for (; x + 8 <= x1; x += 8)
+    {
+        int idx = y * width + x;
+        F8 px, py, pz;
+        LoadPts(pts + idx, px, py, pz);
+        Store(outDepth + idx, Select(ValidMask(px, py), pz, zero));
+    }
+    DepthFromPointsRowScalar(pts, outDepth, width, y, x, x1);
+}
+
+void RemoveFlyingRowScalar(const float* depth, float* outDepth, int width, int height, int y,
+    int x0, int x1, float maxJump, int minSupport)
+{
+    for (int x = x0; x < x1; ++x)
+    {
+        float d = depth[y * width + x];
+        float jump = d * maxJump;
+        int support = 0;
+        for (int ny = std::max(0, y - 1); ny <= std::min(height - 1, y + 1); ++ny)
+        {
+            for (int nx = std::max(0, x - 1); nx <= std::min(width - 1, x + 1); ++nx)
+            {
+                if ((nx != x || ny != y) && jump > fabsf(depth[ny * width + nx] - d))
+                    support++;
+            }
+        }
+        outDepth[y * width + x] = support >= minSupport ? d : 0;
+    }
+}
+
+void RemoveFlyingRowSimd(const float* depth, float* outDepth, int width, int height, int y,
+    int x0, int x1, float maxJump, int minSupport)
+{
+    using namespace simd;
+    if (y < 1 || y >= height - 1)
+    {
+        RemoveFlyingRowScalar(depth, outDepth, width, height, y, x0, x1, maxJump, minSupport);
+        return;
+    }
+    int xs = std::max(x0, 1);
+    int xe = std::min(x1, width - 1);
+    RemoveFlyingRowScalar(depth, outDepth, width, height, y, x0, xs, maxJump, minSupport);
+    const float* row = depth + y * width;
+    F8 zero = Set1(0);
+    F8 one = Set1(1);
+    F8 jumpRatio = Set1(maxJump);
+    F8 minCount = Set1(minSupport - 0.5f);
+    int x = xs;
+    for (; x + 8 <= xe; x += 8)
+    {
+        F8 d = Load(row + x);
+        F8 jump = d * jumpRatio;
+        F8 support = zero;
+        for (int dy = -1; dy <= 1; ++dy)
+        {
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                if (dx == 0 && dy == 0)
+                    continue;
+                F8 n = Load(row + dy * width + x + dx);
+                support = support + (CmpGt(jump, Abs(n - d)) & one);
+            }
+        }
+        Store(outDepth + y * width + x, Select(CmpGt(support, minCount), d, zero));
+    }
+    RemoveFlyingRowScalar(depth, outDepth, width, height, y, x, x1, maxJump, minSupport);
+}
+
+void SmoothDepthRowScalar(const float* depth, float* outDepth, int width, int height, int y,
+    int x0, int x1, int step, const float* weights, int radius, float rangeRatio)
+{
+    int limit = step == 1 ? width : height;
+    for (int x = x0; x < x1; ++x)
+    {
+        int idx = y * width + x;
+        float d = depth[idx];
+        if (d == 0)
+        {
+            outDepth[idx] = 0;
+            continue;
+        }
+        float c = d * rangeRatio;
+        float cSq = c * c;
+        int pos = step == 1 ? x : y;
+        float sum = 0, weightSum = 0;
+        for (int k = -radius; k <= radius; ++k)
+        {
+            if (pos + k < 0 || pos + k >= limit)
+                continue;
+            float n = depth[idx + k * step];
+            float diff = n - d;
+            float t = cSq - diff * diff;
+            if (t > 0)
+            {
+                float w = weights[abs(k)] * t * t;
+                sum = sum + w * n;
+                weightSum = weightSum + w;
+            }
+        }
+        outDepth[idx] = sum / weightSum;
+    }
+}
+
+void SmoothDepthRowSimd(const float* depth, float* outDepth, int width, int height, int y,
+    int x0, int x1, int step, const float* weights, int radius, float rangeRatio)
+{
+    using namespace simd;
+    // Only pixels whose taps are all inside the frame are vectorized.
+    int xs = x0, xe = x1;
+    if (step == 1)
+    {
+        xs = std::max(x0, radius);
+        xe = std::max(xs, std::min(x1, width - radius));
+    }
+    else if (y < radius || y >= height - radius)
+        xs = xe = x1;
+    SmoothDepthRowScalar(depth, outDepth, width, height, y, x0, xs, step, weights, radius, rangeRatio);
+    const float* row = depth + y * width;
+    F8 zero = Set1(0);
+    F8 ratio = Set1(rangeRatio);
+    int x = xs;
+    for (; x + 8 <= xe; x += 8)
+    {
+        F8 d = Load(row + x);
+        F8 c = d * ratio;
+        F8 cSq = c * c;
+        F8 sum = zero, weightSum = zero;
+        for (int k = -radius; k <= radius; ++k)
+        {
+            F8 n = Load(row + x + k * step);
+            F8 diff = n - d;
+            F8 t = cSq - diff * diff;
+            // Taps without weight add exactly 0, as the scalar loop's
+            // skipped ones do.
+            F8 w = Select(CmpGt(t, zero), Set1(weights[abs(k)]) * t * t, zero);
+            sum = sum + w * n;
+            weightSum = weightSum + w;
+        }
+        Store(outDepth + y * width + x, Select(CmpGt(d, zero), sum / weightSum, zero));
+    }
+    SmoothDepthRowScalar(depth, outDepth, width, height, y, x, x1, step, weights, radius, rangeRatio);
+}
+
+void RescalePointsRowScalar(const Pt* pts, const float* depth, Pt* outPts, int width, int y, int x0, int x1)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    for (int x = x0; x < x1; ++x)
+    {
+        int idx = y * width + x;
+        float d = depth[idx];
+        if (d == 0)
+        {
+            outPts[idx] = Pt(-inf, -inf, -inf);
+            continue;
+        }
+        Pt pt = pts[idx];
+        float scale = d / pt.z;
+        outPts[idx] = Pt(pt.x * scale, pt.y * scale, d);
+    }
+}
+
+void RescalePointsRowSimd(const Pt* pts, const float* depth, Pt* outPts, int width, int y, int x0, int x1)
+{
+    using namespace simd;
+    F8 zero = Set1(0);
+    F8 invalid = Set1(-INFINITY);
+    int x = x0;
+    for (; x + 8 <= x1; x += 8)
+    {
+        int idx = y * width + x;
+        F8 px, py, pz;
+        LoadPts(pts + idx, px, py, pz);
+        F8 d = Load(depth + idx);
+        F8 valid = CmpGt(d, zero);
+        F8 scale = d / pz;
+        StorePts(outPts + idx,
+            Select(valid, px * scale, invalid),
+            Select(valid, py * scale, invalid),
+            Select(valid, d, invalid));
+    }
+    RescalePointsRowScalar(pts, depth, outPts, width, y, x, x1);
+}
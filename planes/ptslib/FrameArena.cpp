@@ -0,0 +1,92 @@
+#include "pch.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include "FrameArena.h"
+
+namespace
+{
+    const size_t minBlockSize = 64 * 1024;
+}
+
+FrameArena::FrameArena() :
+    m_block(0),
+    m_offset(0),
+    m_blockAllocations(0)
+{
+}
+
+FrameArena::~FrameArena()
+{
+    for (Block& block : m_blocks)
+        free(block.data);
+}
+
+void* FrameArena::Allocate(size_t size, size_t align)
+{
+    for (;;)
+    {
+        if (m_block < m_blocks.size())
+        {
+            Block& block = m_blocks[m_block];
+            uintptr_t base = (uintptr_t)block.data;
+            size_t offset = ((base + m_offset + align - 1) & ~(uintptr_t)(align - 1)) - base;
+            if (offset + size <= block.size)
+            {
+                m_offset = offset + size;
+                return block.data + offset;
+            }
+            if (m_block + 1 < m_blocks.size())
+            {
+                m_block++;
+                m_offset = 0;
+                continue;
+            }
+        }
+
+        // Out of blocks: each new one is at least as big as all the others
+        // together, so a frame's needs are covered in a few steps.
+        size_t total = 0;
+        for (const Block& block : m_blocks)
+            total += block.size;
+        Block block;
+        block.size = std::max(std::max(minBlockSize, total), size + align);
+        block.data = (char*)malloc(block.size);
+        if (block.data == nullptr)
+            throw std::bad_alloc();
+        m_blocks.push_back(block);
+        m_blockAllocations++;
+        m_block = m_blocks.size() - 1;
+        m_offset = 0;
+    }
+}
+
+void FrameArena::Reset()
+{
+    m_block = 0;
+    m_offset = 0;
+}
+
+void FrameArena::Reserve(size_t size)
+{
+    if (size == 0 || (!m_blocks.empty() && m_blocks[0].size >= size))
+        return;
+    // Requests may be padded differently from frame to frame.
+    size += size / 8;
+    char* data = (char*)malloc(size);
+    if (data == nullptr)
+        throw std::bad_alloc();
+    for (Block& block : m_blocks)
+        free(block.data);
+    m_blocks.clear();
+    m_blocks.push_back(Block{ data, size });
+    m_blockAllocations++;
+}
+
+size_t FrameArena::Used() const
+{
+    size_t used = m_offset;
+    for (size_t idx = 0; idx < m_block && idx < m_blocks.size(); ++idx)
+        used += m_blocks[idx].size;
+    return used;
+}
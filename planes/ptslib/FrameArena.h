@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator for objects that only live for one frame. Reset rewinds
+// it without freeing, so once its blocks have grown to what a frame needs
+// it makes no more heap allocations. Nothing is ever destroyed, so only
+// trivially destructible types belong here. Not thread safe; give each
+// worker its own arena.
+class FrameArena
+{
+public:
+    FrameArena();
+    ~FrameArena();
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator = (const FrameArena&) = delete;
+
+    void* Allocate(size_t size, size_t align);
+
+    // Uninitialized storage for count objects of T.
+    template <typename T> T* Allocate(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "FrameArena never runs destructors");
+        return static_cast<T*>(Allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    template <typename T, typename... Args> T* New(Args&&... args)
+    {
+        return new (Allocate<T>(1)) T(std::forward<Args>(args)...);
+    }
+
+    // Makes every block available again; earlier allocations become invalid.
+    void Reset();
+    // Right after Reset: makes sure size bytes of requests fit without
+    // another block, replacing the blocks with one big enough if not.
+    void Reserve(size_t size);
+    // Bytes handed out since Reset, counting the unused ends of full blocks.
+    size_t Used() const;
+
+    // Heap blocks allocated over the arena's lifetime.
+    unsigned long long BlockAllocations() const { return m_blockAllocations; }
+
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block> m_blocks;
+    size_t m_block;
+    size_t m_offset;
+    unsigned long long m_blockAllocations;
+};
@@ -0,0 +1,133 @@
+#include "pch.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include "Instrument.h"
+#include "ptslib.h"
+
+namespace
+{
+    const char* const stageNames[InstrumentStageCount] =
+    {
+        "filter",
+        "normals",
+        "tile-history",
+        "tile-masks",
+        "quadtree",
+        "corner-search",
+        "residual-scan",
+        "coverage-filter",
+        "neighbors",
+        "merge",
+        "output"
+    };
+
+    // Small, stable trace ids for the threads that run stages.
+    int TraceThread()
+    {
+        static std::atomic<int> nextThread(1);
+        thread_local int thread = nextThread++;
+        return thread;
+    }
+
+    double Ms(Instrument::Clock::duration d)
+    {
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+
+    double Us(Instrument::Clock::duration d)
+    {
+        return std::chrono::duration<double, std::micro>(d).count();
+    }
+}
+
+Instrument::Instrument() :
+    m_enabled(false),
+    m_frame(),
+    m_last(),
+    m_maxEvents(0)
+{
+}
+
+void Instrument::Enable(bool enable, int maxTraceEvents)
+{
+    m_enabled = enable;
+    m_frame = DepthInstrumentStats();
+    m_last = DepthInstrumentStats();
+    m_maxEvents = enable ? (size_t)std::max(0, maxTraceEvents) : 0;
+    m_origin = Clock::now();
+    m_spans.clear();
+    m_frames.clear();
+    m_spans.reserve(m_maxEvents);
+    m_frames.reserve(m_maxEvents);
+}
+
+void Instrument::AddStage(int stage, Clock::time_point start, Clock::time_point end)
+{
+    m_frame.stageMs[stage] += (float)Ms(end - start);
+    if (m_spans.size() + m_frames.size() < m_maxEvents)
+        m_spans.push_back(TraceSpan{ start, end, stage, TraceThread() });
+}
+
+void Instrument::AddTileCounters(const TileCounters& counters)
+{
+    m_frame.tilesVisited += counters.tilesVisited;
+    m_frame.splits += counters.splits;
+    m_frame.leaves += counters.leaves;
+    m_frame.pixelsScanned += counters.pixelsScanned;
+    m_frame.stageMs[InstrumentCornerSearch] += (float)counters.cornerMs;
+    m_frame.stageMs[InstrumentResidualScan] += (float)counters.residualMs;
+}
+
+void Instrument::EndFrame()
+{
+    if (!m_enabled)
+        return;
+    m_frame.frame = m_last.frame + 1;
+    m_last = m_frame;
+    m_frame = DepthInstrumentStats();
+    if (m_spans.size() + m_frames.size() < m_maxEvents)
+        m_frames.push_back(TraceFrame{ Clock::now(), m_last });
+}
+
+bool Instrument::LastFrame(DepthInstrumentStats& outStats) const
+{
+    outStats = m_last;
+    return m_last.frame > 0;
+}
+
+bool Instrument::WriteTrace(const char* path) const
+{
+    FILE* file = fopen(path, "w");
+    if (file == nullptr)
+        return false;
+    fprintf(file, "{\"traceEvents\":[\n");
+    const char* separator = "";
+    for (const TraceSpan& span : m_spans)
+    {
+        fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"ptslib\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":1,\"tid\":%d}", separator, stageNames[span.stage], Us(span.start - m_origin),
+            Us(span.end - span.start), span.thread);
+        separator = ",\n";
+    }
+    // Counters go on the timeline as they stood at the end of each frame;
+    // per-tile stage times with them, as they have no span of their own.
+    for (const TraceFrame& frame : m_frames)
+    {
+        const DepthInstrumentStats& s = frame.stats;
+        fprintf(file, "%s{\"name\":\"tiles\",\"cat\":\"ptslib\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,"
+            "\"args\":{\"visited\":%lld,\"splits\":%lld,\"leaves\":%lld,\"coverageRejected\":%lld}}",
+            separator, Us(frame.end - m_origin), s.tilesVisited, s.splits, s.leaves, s.coverageRejected);
+        separator = ",\n";
+        fprintf(file, "%s{\"name\":\"pixelsScanned\",\"cat\":\"ptslib\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,"
+            "\"args\":{\"pixels\":%lld}}", separator, Us(frame.end - m_origin), s.pixelsScanned);
+        fprintf(file, "%s{\"name\":\"edges\",\"cat\":\"ptslib\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,"
+            "\"args\":{\"neighbors\":%lld,\"samePlane\":%lld,\"groups\":%lld}}",
+            separator, Us(frame.end - m_origin), s.neighborEdges, s.samePlaneEdges, s.mergedGroups);
+        fprintf(file, "%s{\"name\":\"tileWorkMs\",\"cat\":\"ptslib\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,"
+            "\"args\":{\"cornerSearch\":%.4f,\"residualScan\":%.4f}}", separator, Us(frame.end - m_origin),
+            s.stageMs[InstrumentCornerSearch], s.stageMs[InstrumentResidualScan]);
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    return fclose(file) == 0;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include "ptslib.h"
+
+// Quadtree counters of one subdivision worker. Padded so that no two
+// workers' counters share a cache line, as they are kept side by side.
+struct TileCounters
+{
+    TileCounters() :
+        tilesVisited(0),
+        splits(0),
+        leaves(0),
+        pixelsScanned(0),
+        cornerMs(0),
+        residualMs(0)
+    {
+    }
+
+    long long tilesVisited;
+    long long splits;
+    long long leaves;
+    long long pixelsScanned;
+    // Only added to while instrumentation is on.
+    double cornerMs;
+    double residualMs;
+    char padding[64];
+};
+
+// A context's stage timers, counters and trace. Stages are recorded by
+// StageScope; per-tile work is summed into TileCounters and added at the
+// end of the quadtree.
+class Instrument
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    Instrument();
+
+    void Enable(bool enable, int maxTraceEvents);
+    bool Enabled() const { return m_enabled; }
+
+    // Counters and stage times of the frame in progress.
+    DepthInstrumentStats& Frame() { return m_frame; }
+    void AddStage(int stage, Clock::time_point start, Clock::time_point end);
+    void AddTileCounters(const TileCounters& counters);
+    // The frame in progress becomes the last one.
+    void EndFrame();
+
+    // False until a frame has completed.
+    bool LastFrame(DepthInstrumentStats& outStats) const;
+    bool WriteTrace(const char* path) const;
+
+private:
+    struct TraceSpan
+    {
+        Clock::time_point start;
+        Clock::time_point end;
+        int stage;
+        int thread;
+    };
+
+    struct TraceFrame
+    {
+        Clock::time_point end;
+        DepthInstrumentStats stats;
+    };
+
+    bool m_enabled;
+    DepthInstrumentStats m_frame;
+    DepthInstrumentStats m_last;
+    // Trace events are kept up to the capacity reserved by Enable, so
+    // recording never allocates.
+    size_t m_maxEvents;
+    Clock::time_point m_origin;
+    std::vector<TraceSpan> m_spans;
+    std::vector<TraceFrame> m_frames;
+};
+
+// Times its scope as one run of a stage, if instrumentation is on.
+class StageScope
+{
+public:
+    StageScope(Instrument& instrument, int stage) :
+        m_instrument(instrument.Enabled() ? &instrument : nullptr),
+        m_stage(stage)
+    {
+        if (m_instrument != nullptr)
+            m_start = Instrument::Clock::now();
+    }
+
+    ~StageScope()
+    {
+        End();
+    }
+
+    // Ends the stage before the scope does.
+    void End()
+    {
+        if (m_instrument != nullptr)
+            m_instrument->AddStage(m_stage, m_start, Instrument::Clock::now());
+        m_instrument = nullptr;
+    }
+
+private:
+    Instrument* m_instrument;
+    int m_stage;
+    Instrument::Clock::time_point m_start;
+};
+
+// Adds its scope's time to ms when timed, for work done per tile, which
+// is too fine to trace.
+class TileTimer
+{
+public:
+    TileTimer(bool timed, double& ms) :
+        m_ms(timed ? &ms : nullptr)
+    {
+        if (m_ms != nullptr)
+            m_start = Instrument::Clock::now();
+    }
+
+    ~TileTimer()
+    {
+        if (m_ms != nullptr)
+            *m_ms += std::chrono::duration<double, std::milli>(Instrument::Clock::now() - m_start).count();
+    }
+
+private:
+    double* m_ms;
+    Instrument::Clock::time_point m_start;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include "Pt.h"
+
+// Row kernels shared by the Depth entry points. Each one writes only the
+// pixels [x0, x1) of row y of its output.
+
+// Unit normal from the cross product of the horizontal and vertical central
+// differences, or (0, 0, 0) if any of the four neighbours is invalid.
+void FindNormalsRowScalar(const Pt* depthPts, Pt* outNrm, int width, int y, int x0, int x1);
+
+// Vectorized FindNormalsRowScalar, 8 pixels per iteration. The rsqrt
+// estimate plus one Newton step keeps every component within
+// normalSimdTolerance of the scalar result.
+void FindNormalsRowSimd(const Pt* depthPts, Pt* outNrm, int width, int y, int x0, int x1);
+
+const float normalSimdTolerance = 1e-5f;
+
+// Adds |dot(pt - planePt, nrm)| and the count of valid points in row y,
+// columns [x0, x1), to sum and count. Returns true, possibly before the
+// row is finished, as soon as a distance exceeds maxDist.
+bool PlaneResidualRowSimd(const Pt* pts, int width, int y, int x0, int x1,
+    const Pt& planePt, const Pt& nrm, float maxDist, float& sum, float& count);
+
+// Squared first difference of depth, in mm^2, above which a pixel is an
+// edge: a step of about 55 mm. The edge visualization is offset by it.
+const float edgeJumpSq = 3000.0f;
+
+inline int EdgeMaskWordsPerRow(int width) { return (width + 63) / 64; }
+
+// Depth discontinuities for row y, columns [x0, x1), all within one pixel
+// of the border, read straight from the raw depth rows y - 2 to y. Writes
+// (0, |first difference|^2 - edgeJumpSq, |second difference|^2 - edgeJumpSq)
+// per pixel to outVis and ORs a bit per edge pixel into outMask, either of
+// which may be null. Differences involving a pixel without depth count as 0.
+void FindEdgesRowScalar(const unsigned short* dbuf, float* outVis, uint64_t* outMask,
+    int width, int y, int x0, int x1);
+
+// Vectorized FindEdgesRowScalar. Depth differences are exact in float and
+// the products are evaluated in the same order, so the output is
+// bit-identical.
+void FindEdgesRowSimd(const unsigned short* dbuf, float* outVis, uint64_t* outMask,
+    int width, int y, int x0, int x1);
+
+// Camera-space points for row y, columns [x0, x1), from millimetre depth
+// and per-pixel rays (x / z, y / z). Pixels with no depth get -inf in all
+// three components, like the Kinect CoordinateMapper.
+void UnprojectRowScalar(const unsigned short* depth, const float* rayX, const float* rayY,
+    Pt* outPts, int width, int y, int x0, int x1);
+
+// Vectorized UnprojectRowScalar; the products are the same, so the output
+// is bit-identical.
+void UnprojectRowSimd(const unsigned short* depth, const float* rayX, const float* rayY,
+    Pt* outPts, int width, int y, int x0, int x1);
+
+// Depth pre-filter. Depth planes hold each pixel's z in metres, 0 where
+// it has none.
+
+// Largest DepthFilterPointsCtx smoothing radius.
+const int maxFilterRadius = 4;
+
+// z of row y, columns [x0, x1), of the points, or 0 where Pt::IsValid
+// fails.
+void DepthFromPointsRowScalar(const Pt* pts, float* outDepth, int width, int y, int x0, int x1);
+void DepthFromPointsRowSimd(const Pt* pts, float* outDepth, int width, int y, int x0, int x1);
+
+// Copies row y, columns [x0, x1), of depth, zeroing flying pixels: those
+// with fewer than minSupport of their 8 neighbours within maxJump * z of
+// their own depth. Pixels stranded between a foreground and background
+// surface have none; a surface's own pixels have at least three, even at
+// a corner of its silhouette.
+void RemoveFlyingRowScalar(const float* depth, float* outDepth, int width, int height, int y,
+    int x0, int x1, float maxJump, int minSupport);
+void RemoveFlyingRowSimd(const float* depth, float* outDepth, int width, int height, int y,
+    int x0, int x1, float maxJump, int minSupport);
+
+// Edge-preserving smoothing of row y, columns [x0, x1), of depth along the
+// row (step 1) or the column (step width): the average of the 2 * radius + 1
+// taps weighted by weights[|offset|] and the biweight
+// max(0, c^2 - (tap - z)^2)^2, with c = rangeRatio * z. Taps across a
+// depth step of more than c, pixels without depth and taps outside the
+// frame get no weight. The SIMD version evaluates the same products in
+// the same order, so its output is bit-identical except on 32-bit NEON,
+// which has no exact divide.
+void SmoothDepthRowScalar(const float* depth, float* outDepth, int width, int height, int y,
+    int x0, int x1, int step, const float* weights, int radius, float rangeRatio);
+void SmoothDepthRowSimd(const float* depth, float* outDepth, int width, int height, int y,
+    int x0, int x1, int step, const float* weights, int radius, float rangeRatio);
+
+// Moves row y, columns [x0, x1), of the points along their rays to the
+// filtered depth, or to -inf where it is 0. pts may be outPts.
+void RescalePointsRowScalar(const Pt* pts, const float* depth, Pt* outPts, int width, int y, int x0, int x1);
+void RescalePointsRowSimd(const Pt* pts, const float* depth, Pt* outPts, int width, int y, int x0, int x1);
+
+// Name of the vector instruction set the kernels were compiled for.
+const char* SimdBackendName();
@@ -0,0 +1,493 @@
+#include "pch.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "DepthCodec.h"
+#include "MappedRecording.h"
+#include "ptslib.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const size_t pageBytes = 4096;
+}
+
+MappedRecording::MappedRecording(int width, int height) :
+    m_width(width),
+    m_height(height),
+    m_data(nullptr),
+    m_size(0),
+#if defined(_WIN32)
+    m_fileHandle(nullptr),
+    m_mapHandle(nullptr),
+#endif
+    m_compressed(false),
+    m_prefetchFrames(0),
+    m_current(-1),
+    m_previous(-1),
+    m_stop(false)
+{
+}
+
+MappedRecording::~MappedRecording()
+{
+    Close();
+}
+
+bool MappedRecording::MapFile(const char* path)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* data = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (data == nullptr)
+    {
+        if (mapping != nullptr)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    m_fileHandle = file;
+    m_mapHandle = mapping;
+    m_size = (size_t)fileSize.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file open.
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    m_size = (size_t)st.st_size;
+#endif
+    m_data = (const unsigned char*)data;
+    return true;
+}
+
+bool MappedRecording::IndexRaw()
+{
+    // A trailing partial frame, from a capture that was cut off, is ignored.
+    size_t frameCount = m_size / RawFrameBytes();
+    m_timestamps.resize(frameCount);
+    m_offsets.resize(frameCount);
+    for (size_t idx = 0; idx < frameCount; ++idx)
+    {
+        m_offsets[idx] = RawFrameBytes() * idx;
+        memcpy(&m_timestamps[idx], m_data + m_offsets[idx], sizeof(long long));
+    }
+    return true;
+}
+
+bool MappedRecording::IndexCompressed()
+{
+    DepthCodecHeader header;
+    memcpy(&header, m_data, sizeof(header));
+    size_t numPts = (size_t)m_width * m_height;
+    size_t offset = sizeof(header) + numPts * 2 * sizeof(float);
+    if (header.version != depthCodecVersion || header.width != m_width ||
+        header.height != m_height || m_size < offset)
+        return false;
+    m_rayX.resize(numPts);
+    m_rayY.resize(numPts);
+    const unsigned char* rays = m_data + sizeof(header);
+    for (size_t idx = 0; idx < numPts; ++idx)
+    {
+        memcpy(&m_rayX[idx], rays + idx * 2 * sizeof(float), sizeof(float));
+        memcpy(&m_rayY[idx], rays + (idx * 2 + 1) * sizeof(float), sizeof(float));
+    }
+
+    // Rays never change once seen, so every frame's patches can be applied
+    // up front and any frame decoded on its own.
+    while (m_size - offset >= sizeof(DepthFrameHeader))
+    {
+        DepthFrameHeader frame;
+        memcpy(&frame, m_data + offset, sizeof(frame));
+        size_t patchBytes = (size_t)frame.rayCount * sizeof(RayPatch);
+        size_t recordBytes = sizeof(frame) + patchBytes + frame.payloadBytes;
+        if (m_size - offset < recordBytes)
+            break;
+        const unsigned char* patches = m_data + offset + sizeof(frame);
+        for (uint32_t idx = 0; idx < frame.rayCount; ++idx)
+        {
+            RayPatch patch;
+            memcpy(&patch, patches + idx * sizeof(RayPatch), sizeof(patch));
+            if (patch.pixel >= numPts)
+                return false;
+            m_rayX[patch.pixel] = patch.x;
+            m_rayY[patch.pixel] = patch.y;
+        }
+        m_offsets.push_back(offset);
+        m_timestamps.push_back(frame.timestamp);
+        offset += recordBytes;
+    }
+    return true;
+}
+
+bool MappedRecording::Open(const char* path, int prefetchFrames)
+{
+    Close();
+    if (!MapFile(path))
+        return false;
+
+    m_compressed = m_size >= sizeof(DepthCodecHeader) &&
+        memcmp(m_data, depthCodecMagic, sizeof(depthCodecMagic)) == 0;
+    if (!(m_compressed ? IndexCompressed() : IndexRaw()))
+    {
+        Close();
+        return false;
+    }
+
+    m_prefetchFrames = std::max(0, prefetchFrames);
+    if (m_compressed)
+    {
+        // The prefetch window plus the current, previous and one spare.
+        m_slots.resize(m_prefetchFrames + 3);
+        for (Slot& slot : m_slots)
+        {
+            slot.depth.resize((size_t)m_width * m_height);
+            slot.pts.resize((size_t)m_width * m_height);
+        }
+    }
+    m_current = m_previous = -1;
+    m_stop = false;
+    if (m_prefetchFrames > 0 && FrameCount() > 0)
+        m_prefetchThread = std::thread(&MappedRecording::PrefetchLoop, this);
+    return true;
+}
+
+void MappedRecording::Close()
+{
+    if (m_prefetchThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_one();
+        m_prefetchThread.join();
+    }
+    m_resident.clear();
+    m_timestamps.clear();
+    m_offsets.clear();
+    m_rayX.clear();
+    m_rayY.clear();
+    m_slots.clear();
+    m_compressed = false;
+    if (m_data == nullptr)
+        return;
+#if defined(_WIN32)
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapHandle);
+    CloseHandle(m_fileHandle);
+    m_mapHandle = m_fileHandle = nullptr;
+#else
+    munmap((void*)m_data, m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+int MappedRecording::FindFrame(long long timestamp) const
+{
+    auto it = std::upper_bound(m_timestamps.begin(), m_timestamps.end(), timestamp);
+    if (it == m_timestamps.begin())
+        return 0;
+    return (int)(it - m_timestamps.begin()) - 1;
+}
+
+MappedRecording::Slot* MappedRecording::FindSlot(int frameIdx)
+{
+    for (Slot& slot : m_slots)
+    {
+        if (slot.frame == frameIdx)
+            return &slot;
+    }
+    return nullptr;
+}
+
+MappedRecording::Slot* MappedRecording::FreeSlot(bool windowOnly)
+{
+    Slot* found = nullptr;
+    for (Slot& slot : m_slots)
+    {
+        if (slot.frame < 0)
+            return &slot;
+        if (!slot.ready || slot.readers > 0 || slot.frame == m_current || slot.frame == m_previous)
+            continue;
+        bool outside = m_current < 0 || !InWindow(slot.frame, m_current);
+        if (outside)
+            found = &slot;
+        else if (!windowOnly && found == nullptr)
+            found = &slot;
+    }
+    return found;
+}
+
+void MappedRecording::Decode(int frameIdx, Slot& slot) const
+{
+    const unsigned char* record = m_data + m_offsets[frameIdx];
+    DepthFrameHeader frame;
+    memcpy(&frame, record, sizeof(frame));
+    const unsigned char* payload = record + sizeof(frame) + (size_t)frame.rayCount * sizeof(RayPatch);
+    // A corrupt frame comes out empty rather than half decoded.
+    if (!DecodeDepth(payload, frame.payloadBytes, m_width, m_height, slot.depth.data()))
+        std::fill(slot.depth.begin(), slot.depth.end(), 0);
+    UnprojectDepth(slot.depth.data(), m_rayX.data(), m_rayY.data(), m_width, m_height, slot.pts.data());
+}
+
+const Pt* MappedRecording::Frame(int frameIdx)
+{
+    if (!m_compressed)
+    {
+        if (m_prefetchFrames > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_current = frameIdx;
+            }
+            m_wake.notify_one();
+        }
+        return (const Pt*)(m_data + m_offsets[frameIdx] + sizeof(long long));
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return DecodedSlot(frameIdx, lock)->pts.data();
+}
+
+void MappedRecording::ReadFrame(int frameIdx, Pt* outPts)
+{
+    size_t numPts = (size_t)m_width * m_height;
+    if (!m_compressed)
+    {
+        const Pt* pts = Frame(frameIdx);
+        std::copy_n(pts, numPts, outPts);
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Slot* slot = DecodedSlot(frameIdx, lock);
+    slot->readers++;
+    lock.unlock();
+    std::copy_n(slot->pts.data(), numPts, outPts);
+    lock.lock();
+    if (--slot->readers == 0)
+        m_decoded.notify_all();
+}
+
+MappedRecording::Slot* MappedRecording::DecodedSlot(int frameIdx, std::unique_lock<std::mutex>& lock)
+{
+    if (frameIdx != m_current)
+    {
+        m_previous = m_current;
+        m_current = frameIdx;
+        m_wake.notify_one();
+    }
+    for (;;)
+    {
+        Slot* slot = FindSlot(frameIdx);
+        if (slot != nullptr && slot->ready)
+            return slot;
+        if (slot == nullptr)
+            slot = FreeSlot(false);
+        if (slot == nullptr || (!slot->ready && slot->frame == frameIdx))
+        {
+            // Another thread is decoding it, or every slot is being
+            // decoded into, read or held for the current frames.
+            m_decoded.wait(lock);
+            continue;
+        }
+        slot->frame = frameIdx;
+        slot->ready = false;
+        lock.unlock();
+        Decode(frameIdx, *slot);
+        lock.lock();
+        slot->ready = true;
+        m_decoded.notify_all();
+        return slot;
+    }
+}
+
+void MappedRecording::Touch(int frameIdx) const
+{
+    const volatile unsigned char* start = m_data + m_offsets[frameIdx];
+    size_t bytes = RawFrameBytes();
+    unsigned char sum = 0;
+    for (size_t offset = 0; offset < bytes; offset += pageBytes)
+        sum += start[offset];
+    sum += start[bytes - 1];
+    (void)sum;
+}
+
+void MappedRecording::Release(int frameIdx) const
+{
+    // Only whole pages inside the frame, so neighbouring frames keep theirs.
+    uintptr_t start = (uintptr_t)(m_data + m_offsets[frameIdx]);
+    uintptr_t end = start + RawFrameBytes();
+    start = (start + pageBytes - 1) & ~(uintptr_t)(pageBytes - 1);
+    end &= ~(uintptr_t)(pageBytes - 1);
+    if (end <= start)
+        return;
+#if defined(_WIN32)
+    // Unlocking pages that are not locked drops them from the working set.
+    VirtualUnlock((void*)start, end - start);
+#else
+    madvise((void*)start, end - start, MADV_DONTNEED);
+#endif
+}
+
+bool MappedRecording::InWindow(int frameIdx, int current) const
+{
+    // The previous frame, which a caller may still be reading, the current
+    // one and the next window, wrapping like a looped playback.
+    int frameCount = FrameCount();
+    int window = std::min(m_prefetchFrames, frameCount - 1);
+    int ahead = (frameIdx - current + frameCount) % frameCount;
+    return ahead <= window || ahead == frameCount - 1;
+}
+
+void MappedRecording::PrefetchLoop()
+{
+    int frameCount = FrameCount();
+    int window = std::min(m_prefetchFrames, frameCount - 1);
+    int seen = -1;
+    for (;;)
+    {
+        int current;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_current != seen; });
+            if (m_stop)
+                return;
+            current = seen = m_current;
+        }
+
+        if (!m_compressed)
+        {
+            for (size_t idx = 0; idx < m_resident.size();)
+            {
+                if (!InWindow(m_resident[idx], current))
+                {
+                    Release(m_resident[idx]);
+                    m_resident[idx] = m_resident.back();
+                    m_resident.pop_back();
+                }
+                else
+                    ++idx;
+            }
+        }
+
+        for (int ahead = 1; ahead <= window; ++ahead)
+        {
+            int frameIdx = (current + ahead) % frameCount;
+            if (m_compressed)
+            {
+                Slot* slot;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    if (m_stop || m_current != seen)
+                        break;
+                    if (FindSlot(frameIdx) != nullptr)
+                        continue;
+                    slot = FreeSlot(true);
+                    if (slot == nullptr)
+                        break;
+                    slot->frame = frameIdx;
+                    slot->ready = false;
+                }
+                Decode(frameIdx, *slot);
+                std::lock_guard<std::mutex> lock(m_mutex);
+                slot->ready = true;
+                m_decoded.notify_all();
+            }
+            else
+            {
+                if (std::find(m_resident.begin(), m_resident.end(), frameIdx) != m_resident.end())
+                    continue;
+                Touch(frameIdx);
+                m_resident.push_back(frameIdx);
+                // Follow a seek instead of finishing the old window.
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_stop || m_current != seen)
+                    break;
+            }
+        }
+    }
+}
+
+extern "C"
+{
+    DEXPORT MappedRecording* OpenDepthRecording(const char* path, int depthWidth, int depthHeight,
+        int prefetchFrames)
+    {
+        if (path == nullptr || depthWidth <= 0 || depthHeight <= 0)
+            return nullptr;
+        MappedRecording* rec = new MappedRecording(depthWidth, depthHeight);
+        if (!rec->Open(path, prefetchFrames))
+        {
+            delete rec;
+            return nullptr;
+        }
+        return rec;
+    }
+
+    DEXPORT void CloseDepthRecording(MappedRecording* rec)
+    {
+        delete rec;
+    }
+
+    DEXPORT int GetRecordingFrameCount(MappedRecording* rec)
+    {
+        return rec->FrameCount();
+    }
+
+    DEXPORT long long GetRecordingTimestamp(MappedRecording* rec, int frameIdx)
+    {
+        if (frameIdx < 0 || frameIdx >= rec->FrameCount())
+            return -1;
+        return rec->Timestamp(frameIdx);
+    }
+
+    DEXPORT int FindRecordingFrame(MappedRecording* rec, long long timestamp)
+    {
+        if (rec->FrameCount() == 0)
+            return -1;
+        return rec->FindFrame(timestamp);
+    }
+
+    DEXPORT const float* GetRecordingFrame(MappedRecording* rec, int frameIdx)
+    {
+        if (frameIdx < 0 || frameIdx >= rec->FrameCount())
+            return nullptr;
+        return (const float*)rec->Frame(frameIdx);
+    }
+
+    DEXPORT int ReadRecordingFrame(MappedRecording* rec, int frameIdx, float* outPts)
+    {
+        if (frameIdx < 0 || frameIdx >= rec->FrameCount())
+            return 0;
+        rec->ReadFrame(frameIdx, (Pt*)outPts);
+        return 1;
+    }
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Pt.h"
+
+// depth.out recording as written by ProcessDepthThread in
+// kinectwall/DepthVid.cs: each frame is an int64 timestamp followed by
+// width * height camera-space points. The file is memory-mapped and frames
+// are handed out as views into the mapping, so opening a recording only
+// reads the timestamps and memory use does not grow with its length.
+//
+// Compressed recordings (DepthCodec.h) are mapped the same way; their
+// frames are decoded into a small set of buffers, ahead of time by the
+// prefetch thread.
+class MappedRecording
+{
+public:
+    MappedRecording(int width, int height);
+    ~MappedRecording();
+
+    // prefetchFrames > 0 starts a thread that faults in (or decodes) the
+    // frames after the last one handed out and releases the ones behind it.
+    bool Open(const char* path, int prefetchFrames);
+    void Close();
+
+    bool Compressed() const { return m_compressed; }
+    int FrameCount() const { return (int)m_timestamps.size(); }
+    long long Timestamp(int frameIdx) const { return m_timestamps[frameIdx]; }
+    // Last frame at or before timestamp, or the first frame.
+    int FindFrame(long long timestamp) const;
+
+    // The frame's points. Read-only: the mapping is. Raw frames stay valid
+    // until Close; decoded ones until two more frames have been fetched,
+    // which only holds while one thread is fetching.
+    const Pt* Frame(int frameIdx);
+    // Copies the frame's points to outPts. Safe from any number of
+    // threads at once: the slot a decoded frame is copied from is pinned
+    // until the copy is done.
+    void ReadFrame(int frameIdx, Pt* outPts);
+
+private:
+    // A decoded compressed frame.
+    struct Slot
+    {
+        Slot() : frame(-1), ready(false), readers(0) {}
+
+        int frame;
+        bool ready;
+        // ReadFrame calls copying out of it; it is not reused until 0.
+        int readers;
+        std::vector<uint16_t> depth;
+        std::vector<Pt> pts;
+    };
+
+    bool MapFile(const char* path);
+    bool IndexRaw();
+    bool IndexCompressed();
+    size_t RawFrameBytes() const { return sizeof(long long) + (size_t)m_width * m_height * sizeof(Pt); }
+    void PrefetchLoop();
+    bool InWindow(int frameIdx, int current) const;
+    void Touch(int frameIdx) const;
+    void Release(int frameIdx) const;
+    // Caller holds m_mutex. A slot to decode into, never the current or
+    // previous frame's, one being decoded or one being read; with
+    // windowOnly, never one holding a frame in the prefetch window either.
+    // Null if none.
+    Slot* FreeSlot(bool windowOnly);
+    // Caller holds lock. Makes frameIdx the current frame and returns its
+    // decoded slot, decoding it on this thread unless the prefetch thread
+    // already is; waits while every slot is busy.
+    Slot* DecodedSlot(int frameIdx, std::unique_lock<std::mutex>& lock);
+    Slot* FindSlot(int frameIdx);
+    void Decode(int frameIdx, Slot& slot) const;
+
+    int m_width;
+    int m_height;
+    const unsigned char* m_data;
+    size_t m_size;
+#if defined(_WIN32)
+    void* m_fileHandle;
+    void* m_mapHandle;
+#endif
+    bool m_compressed;
+    std::vector<long long> m_timestamps;
+    // Start of each frame's record.
+    std::vector<size_t> m_offsets;
+    // Compressed: per-pixel rays with every frame's patches applied.
+    std::vector<float> m_rayX;
+    std::vector<float> m_rayY;
+    std::vector<Slot> m_slots;
+
+    int m_prefetchFrames;
+    std::thread m_prefetchThread;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_decoded;
+    // Frames last and second to last handed out, -1 before.
+    int m_current;
+    int m_previous;
+    bool m_stop;
+    // Raw frames the prefetch thread has faulted in and not yet released.
+    std::vector<int> m_resident;
+};
@@ -0,0 +1,199 @@
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include "Moments.h"
+#include "ThreadPool.h"
+
+Moments& Moments::operator += (const Moments& rhs)
+{
+    n += rhs.n;
+    sx += rhs.sx; sy += rhs.sy; sz += rhs.sz;
+    sxx += rhs.sxx; sxy += rhs.sxy; sxz += rhs.sxz;
+    syy += rhs.syy; syz += rhs.syz; szz += rhs.szz;
+    return *this;
+}
+
+Moments& Moments::operator -= (const Moments& rhs)
+{
+    n -= rhs.n;
+    sx -= rhs.sx; sy -= rhs.sy; sz -= rhs.sz;
+    sxx -= rhs.sxx; sxy -= rhs.sxy; sxz -= rhs.sxz;
+    syy -= rhs.syy; syz -= rhs.syz; szz -= rhs.szz;
+    return *this;
+}
+
+void MomentTable::Build(const Pt* pts, int width, int height, ThreadPool& pool)
+{
+    int stride = width + 1;
+    if (m_width != width || m_height != height)
+    {
+        m_width = width;
+        m_height = height;
+        m_table.assign((size_t)stride * (height + 1), Moments());
+    }
+
+    // Row 0 and column 0 stay zero. Each band of rows is summed as if it
+    // started the frame, and Sum adds in the band's carry, the moments of
+    // every row above it. The band count is fixed rather than per thread
+    // so the sums, and the planes fit from them, are the same for any
+    // thread count.
+    const int maxBands = 8;
+    m_bandCount = std::max(1, std::min(height, maxBands));
+    m_bandRows = (height + m_bandCount - 1) / m_bandCount;
+    pool.Run(m_bandCount, [&](int band)
+        {
+            int y0 = band * m_bandRows;
+            int y1 = std::min(height, y0 + m_bandRows);
+            for (int y = y0; y < y1; ++y)
+            {
+                Moments rowSum = Moments();
+                const Pt* row = pts + y * width;
+                Moments* out = &m_table[(size_t)(y + 1) * stride + 1];
+                const Moments* above = out - stride;
+                for (int x = 0; x < width; ++x)
+                {
+                    Pt pt = row[x];
+                    if (pt.IsValid())
+                        rowSum.Add(pt);
+                    out[x] = rowSum;
+                    if (y > y0)
+                        out[x] += above[x];
+                }
+            }
+        });
+
+    // carry[b] sums the last table row of every band before b.
+    m_carry.resize((size_t)m_bandCount * stride);
+    std::fill(m_carry.begin(), m_carry.begin() + stride, Moments());
+    for (int band = 1; band < m_bandCount; ++band)
+    {
+        const Moments* prevCarry = &m_carry[(size_t)(band - 1) * stride];
+        const Moments* prevLast = &m_table[(size_t)std::min(height, band * m_bandRows) * stride];
+        Moments* carry = &m_carry[(size_t)band * stride];
+        for (int x = 0; x <= width; ++x)
+        {
+            carry[x] = prevCarry[x];
+            carry[x] += prevLast[x];
+        }
+    }
+}
+
+Moments SumMoments(const Pt* pts, int width, int x0, int y0, int x1, int y1)
+{
+    Moments m = Moments();
+    for (int y = y0; y < y1; ++y)
+    {
+        const Pt* row = pts + y * width;
+        for (int x = x0; x < x1; ++x)
+        {
+            Pt pt = row[x];
+            if (pt.IsValid())
+                m.Add(pt);
+        }
+    }
+    return m;
+}
+
+Moments MomentTable::At(int x, int y) const
+{
+    int stride = m_width + 1;
+    Moments m = m_table[(size_t)y * stride + x];
+    // Table row y ends at pixel row y - 1, which is in band (y - 1) / bandRows.
+    int band = y > 0 ? (y - 1) / m_bandRows : 0;
+    if (band > 0)
+        m += m_carry[(size_t)band * stride + x];
+    return m;
+}
+
+Moments MomentTable::Sum(int x0, int y0, int x1, int y1) const
+{
+    x0 = std::max(0, std::min(x0, m_width));
+    x1 = std::max(0, std::min(x1, m_width));
+    y0 = std::max(0, std::min(y0, m_height));
+    y1 = std::max(0, std::min(y1, m_height));
+    Moments m = At(x1, y1);
+    m -= At(x1, y0);
+    m -= At(x0, y1);
+    m += At(x0, y0);
+    return m;
+}
+
+bool FitPlane(const Moments& m, Pt& centroid, Pt& normal, float& rmsDist)
+{
+    if (m.n < 3)
+        return false;
+
+    double inv = 1.0 / m.n;
+    double cx = m.sx * inv, cy = m.sy * inv, cz = m.sz * inv;
+    double a[3][3];
+    a[0][0] = m.sxx * inv - cx * cx;
+    a[0][1] = a[1][0] = m.sxy * inv - cx * cy;
+    a[0][2] = a[2][0] = m.sxz * inv - cx * cz;
+    a[1][1] = m.syy * inv - cy * cy;
+    a[1][2] = a[2][1] = m.syz * inv - cy * cz;
+    a[2][2] = m.szz * inv - cz * cz;
+
+    // Smallest eigenvalue of the covariance, closed form for symmetric 3x3.
+    double minEig;
+    double p1 = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+    double q = (a[0][0] + a[1][1] + a[2][2]) / 3.0;
+    if (p1 <= 1e-30)
+    {
+        minEig = std::min(a[0][0], std::min(a[1][1], a[2][2]));
+    }
+    else
+    {
+        double p2 = (a[0][0] - q) * (a[0][0] - q) + (a[1][1] - q) * (a[1][1] - q) +
+            (a[2][2] - q) * (a[2][2] - q) + 2.0 * p1;
+        double p = sqrt(p2 / 6.0);
+        double b[3][3];
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 3; ++j)
+                b[i][j] = (a[i][j] - (i == j ? q : 0.0)) / p;
+        double detB = b[0][0] * (b[1][1] * b[2][2] - b[1][2] * b[2][1]) -
+            b[0][1] * (b[1][0] * b[2][2] - b[1][2] * b[2][0]) +
+            b[0][2] * (b[1][0] * b[2][1] - b[1][1] * b[2][0]);
+        double r = std::max(-1.0, std::min(1.0, detB / 2.0));
+        double phi = acos(r) / 3.0;
+        minEig = q + 2.0 * p * cos(phi + 2.0 * 3.14159265358979323846 / 3.0);
+    }
+
+    // The normal is orthogonal to every row of (A - minEig * I); take the
+    // best conditioned cross product of two rows.
+    double r0[3] = { a[0][0] - minEig, a[0][1], a[0][2] };
+    double r1[3] = { a[1][0], a[1][1] - minEig, a[1][2] };
+    double r2[3] = { a[2][0], a[2][1], a[2][2] - minEig };
+    const double* rows[3][2] = { { r0, r1 }, { r0, r2 }, { r1, r2 } };
+    double best[3] = { 0, 0, 0 };
+    double bestLenSq = 0;
+    for (int idx = 0; idx < 3; ++idx)
+    {
+        const double* u = rows[idx][0];
+        const double* v = rows[idx][1];
+        double c[3] = { u[1] * v[2] - u[2] * v[1],
+            u[2] * v[0] - u[0] * v[2],
+            u[0] * v[1] - u[1] * v[0] };
+        double lenSq = c[0] * c[0] + c[1] * c[1] + c[2] * c[2];
+        if (lenSq > bestLenSq)
+        {
+            bestLenSq = lenSq;
+            best[0] = c[0]; best[1] = c[1]; best[2] = c[2];
+        }
+    }
+    if (bestLenSq <= 1e-30)
+        return false;
+
+    double invLen = 1.0 / sqrt(bestLenSq);
+    centroid = Pt((float)cx, (float)cy, (float)cz);
+    normal = Pt((float)(best[0] * invLen), (float)(best[1] * invLen), (float)(best[2] * invLen));
+    rmsDist = (float)sqrt(std::max(0.0, minEig));
+    return true;
+}
+
+void PlaneAxes(const Pt& normal, Pt& axisU, Pt& axisV)
+{
+    bool yorz = fabs(normal.y) > fabs(normal.z);
+    axisU = Cross(normal, yorz ? Pt(0, 0, 1) : Pt(0, 1, 0));
+    axisU.Normalize();
+    axisV = Cross(axisU, normal);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include "Pt.h"
+
+class ThreadPool;
+
+// Sums of the valid points in a region and of their pairwise products,
+// enough for a least-squares plane fit. Doubles, because the summed-area
+// table accumulates a whole frame.
+struct Moments
+{
+    double n;
+    double sx, sy, sz;
+    double sxx, sxy, sxz, syy, syz, szz;
+
+    Moments& operator += (const Moments& rhs);
+    Moments& operator -= (const Moments& rhs);
+
+    void Add(const Pt& pt)
+    {
+        double px = pt.x, py = pt.y, pz = pt.z;
+        n += 1;
+        sx += px; sy += py; sz += pz;
+        sxx += px * px; sxy += px * py; sxz += px * pz;
+        syy += py * py; syz += py * pz; szz += pz * pz;
+    }
+};
+
+// Moments of the valid pixels in [x0, x1) x [y0, y1) summed directly, for
+// when only a few regions are needed and a table is not worth building.
+Moments SumMoments(const Pt* pts, int width, int x0, int y0, int x1, int y1);
+
+// Summed-area table of point moments, rebuilt once per frame, so the
+// moments of any axis-aligned rectangle cost four lookups.
+class MomentTable
+{
+public:
+    // Built in fixed bands of rows spread over the pool's threads.
+    void Build(const Pt* pts, int width, int height, ThreadPool& pool);
+
+    // Moments of the pixels in [x0, x1) x [y0, y1), clamped to the frame.
+    Moments Sum(int x0, int y0, int x1, int y1) const;
+
+private:
+    // Table entry (x, y): moments of pixels [0, x) x [0, y).
+    Moments At(int x, int y) const;
+
+    int m_width = 0;
+    int m_height = 0;
+    int m_bandCount = 1;
+    int m_bandRows = 1;
+    std::vector<Moments> m_table;
+    std::vector<Moments> m_carry;
+};
+
+// Least-squares plane through the points summarized by m: the centroid,
+// the unit normal (eigenvector of the smallest covariance eigenvalue) and
+// the RMS point-to-plane distance. False if there are fewer than 3 points
+// or they do not span a plane.
+bool FitPlane(const Moments& m, Pt& centroid, Pt& normal, float& rmsDist);
+
+// Unit axes spanning the plane with unit normal normal, picked from the
+// normal alone so every plane facing the same way gets the same ones.
+void PlaneAxes(const Pt& normal, Pt& axisU, Pt& axisV);
@@ -0,0 +1,67 @@
+#include "pch.h"
+#include "Kernels.h"
+#include "Simd.h"
+
+void FindNormalsRowScalar(const Pt* depthPts, Pt* outNrm, int width, int y, int x0, int x1)
+{
+    for (int x = x0; x < x1; ++x)
+    {
+        Pt ptx1 = depthPts[y * width + x + 1];
+        Pt ptx2 = depthPts[y * width + x - 1];
+        Pt pty1 = depthPts[(y - 1) * width + x];
+        Pt pty2 = depthPts[(y + 1) * width + x];
+        Pt& outPt = outNrm[y * width + x];
+        if (ptx1.IsValid() && ptx2.IsValid() &&
+            pty1.IsValid() && pty2.IsValid())
+        {
+            Pt dx = ptx1 - ptx2;
+            Pt dy = pty1 - pty2;
+            outPt = Cross(dx, dy);
+            outPt.Normalize();
+        }
+        else
+        {
+            outPt = Pt(0, 0, 0);
+        }
+    }
+}
+
+void FindNormalsRowSimd(const Pt* depthPts, Pt* outNrm, int width, int y, int x0, int x1)
+{
+    using namespace simd;
+    const Pt* row = depthPts + y * width;
+    const Pt* rowUp = row - width;
+    const Pt* rowDown = row + width;
+    int x = x0;
+    for (; x + 8 <= x1; x += 8)
+    {
+        F8 x1x, x1y, x1z, x2x, x2y, x2z;
+        F8 y1x, y1y, y1z, y2x, y2y, y2z;
+        LoadPts(row + x + 1, x1x, x1y, x1z);
+        LoadPts(row + x - 1, x2x, x2y, x2z);
+        LoadPts(rowUp + x, y1x, y1y, y1z);
+        LoadPts(rowDown + x, y2x, y2y, y2z);
+
+        F8 valid = ValidMask(x1x, x1y) & ValidMask(x2x, x2y) &
+            ValidMask(y1x, y1y) & ValidMask(y2x, y2y);
+
+        F8 dxx = x1x - x2x, dxy = x1y - x2y, dxz = x1z - x2z;
+        F8 dyx = y1x - y2x, dyy = y1y - y2y, dyz = y1z - y2z;
+        F8 nx = dxy * dyz - dxz * dyy;
+        F8 ny = dxz * dyx - dxx * dyz;
+        F8 nz = dxx * dyy - dxy * dyx;
+        F8 invLen = RSqrt(nx * nx + ny * ny + nz * nz);
+
+        F8 zero = Set1(0);
+        StorePts(outNrm + y * width + x,
+            Select(valid, nx * invLen, zero),
+            Select(valid, ny * invLen, zero),
+            Select(valid, nz * invLen, zero));
+    }
+    FindNormalsRowScalar(depthPts, outNrm, width, y, x, x1);
+}
+
+const char* SimdBackendName()
+{
+    return simd::BackendName();
+}
@@ -0,0 +1,180 @@
+#include "pch.h"
+#include "Context.h"
+#include "Pipeline.h"
+#include "PlaneStages.h"
+#include "VertexWriter.h"
+#include "ptslib.h"
+
+namespace
+{
+    float Ms(std::chrono::steady_clock::duration d)
+    {
+        return std::chrono::duration<float, std::milli>(d).count();
+    }
+}
+
+DepthPipeline::DepthPipeline(int width, int height, int maxInFlight) :
+    m_slots(maxInFlight),
+    m_submitted(0),
+    m_completed(0),
+    m_exit(false),
+    m_colorSeed(1)
+{
+    // The stages are the parallelism; a slot's kernels run on the stage's
+    // thread unless the caller gives its context more.
+    for (Slot& slot : m_slots)
+    {
+        slot.ctx.reset(new DepthContext(width, height));
+        slot.ctx->threadCount = 1;
+        slot.stagesDone = PipelineStageCount;
+    }
+    for (int stage = 0; stage < PipelineStageCount; ++stage)
+        m_threads.emplace_back(&DepthPipeline::StageLoop, this, stage);
+}
+
+DepthPipeline::~DepthPipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& thread : m_threads)
+        thread.join();
+}
+
+bool DepthPipeline::Submit(long long frameId, float* vals, float* outNormals, const VertexLayout& layout,
+    int maxCount)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_submitted - m_completed >= SlotCount())
+            return false;
+        Slot& slot = m_slots[m_submitted % SlotCount()];
+        slot.frameId = frameId;
+        slot.vals = vals;
+        slot.outNormals = outNormals;
+        slot.layout = layout;
+        slot.maxCount = maxCount;
+        slot.vertexCount = 0;
+        slot.stagesDone = 0;
+        slot.submitted = Clock::now();
+        m_submitted++;
+    }
+    m_wake.notify_all();
+    return true;
+}
+
+bool DepthPipeline::Poll(bool wait, DepthFrameStatus& outStatus)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_completed == m_submitted)
+        return false;
+    Slot& slot = m_slots[m_completed % SlotCount()];
+    if (wait)
+        m_wake.wait(lock, [&] { return slot.stagesDone == PipelineStageCount; });
+    else if (slot.stagesDone != PipelineStageCount)
+        return false;
+
+    outStatus.frameId = slot.frameId;
+    outStatus.vertexCount = slot.vertexCount;
+    for (int stage = 0; stage < PipelineStageCount; ++stage)
+    {
+        Clock::time_point ready = stage == 0 ? slot.submitted : slot.end[stage - 1];
+        outStatus.waitMs[stage] = Ms(slot.start[stage] - ready);
+        outStatus.stageMs[stage] = Ms(slot.end[stage] - slot.start[stage]);
+    }
+    outStatus.latencyMs = Ms(slot.end[PipelineStageCount - 1] - slot.submitted);
+    m_completed++;
+    return true;
+}
+
+void DepthPipeline::StageLoop(int stage)
+{
+    // Frames pass each stage in submission order.
+    for (long long frame = 0;; ++frame)
+    {
+        Slot* slot;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]
+                {
+                    return m_exit ||
+                        (frame < m_submitted && m_slots[frame % SlotCount()].stagesDone == stage);
+                });
+            if (m_exit)
+                return;
+            slot = &m_slots[frame % SlotCount()];
+        }
+        slot->start[stage] = Clock::now();
+        RunStage(stage, *slot);
+        slot->end[stage] = Clock::now();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            slot->stagesDone = stage + 1;
+        }
+        m_wake.notify_all();
+    }
+}
+
+void DepthPipeline::RunStage(int stage, Slot& slot)
+{
+    DepthContext* ctx = slot.ctx.get();
+    switch (stage)
+    {
+    case PipelineNormals:
+        DepthFindNormalsCtx(ctx, slot.vals, slot.outNormals, -1, -1);
+        break;
+    case PipelineQuadtree:
+        slot.unchanged = FitPlaneTiles(ctx, slot.vals);
+        break;
+    case PipelineMerge:
+        GroupPlaneTiles(ctx, slot.unchanged, -1, -1);
+        break;
+    case PipelineOutput:
+        ctx->colorSeed = m_colorSeed;
+        EmitPlaneTriangles(ctx, &slot.layout, slot.maxCount, &slot.vertexCount);
+        m_colorSeed = ctx->colorSeed;
+        break;
+    }
+}
+
+extern "C"
+{
+    DEXPORT DepthPipeline* CreateDepthPipeline(int depthWidth, int depthHeight, int maxInFlight)
+    {
+        if (depthWidth <= 0 || depthHeight <= 0 || maxInFlight <= 0)
+            return nullptr;
+        return new DepthPipeline(depthWidth, depthHeight, maxInFlight);
+    }
+
+    DEXPORT void DestroyDepthPipeline(DepthPipeline* pipeline)
+    {
+        delete pipeline;
+    }
+
+    DEXPORT DepthContext* GetPipelineContext(DepthPipeline* pipeline, int slot)
+    {
+        if (slot < 0 || slot >= pipeline->SlotCount())
+            return nullptr;
+        return pipeline->SlotContext(slot);
+    }
+
+    DEXPORT int SubmitDepthFrame(DepthPipeline* pipeline, long long frameId, float* vals, float* outNormals,
+        Pt* outVertices, Pt* outTexCoords, int maxCount)
+    {
+        return pipeline->Submit(frameId, vals, outNormals, PtLayout(outVertices, outTexCoords, nullptr),
+            maxCount) ? 1 : 0;
+    }
+
+    DEXPORT int SubmitDepthFrameLayout(DepthPipeline* pipeline, long long frameId, float* vals, float* outNormals,
+        const VertexLayout* layout, int maxCount)
+    {
+        return pipeline->Submit(frameId, vals, outNormals, *layout, maxCount) ? 1 : 0;
+    }
+
+    DEXPORT int PollDepthFrame(DepthPipeline* pipeline, int wait, DepthFrameStatus* outStatus)
+    {
+        return pipeline->Poll(wait != 0, *outStatus) ? 1 : 0;
+    }
+}
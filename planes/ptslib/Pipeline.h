@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ptslib.h"
+
+// Runs DepthFindNormalsCtx and DepthMakePlanesCtx as a pipeline: normals,
+// quadtree, adjacency and merge, and output each have a thread, so up to
+// one frame per stage is worked on at once. Every in-flight frame has a
+// slot with a context of its own, which holds all of its intermediate
+// state, so stages never share scratch memory; frames go through every
+// stage in submission order and complete in it.
+class DepthPipeline
+{
+public:
+    DepthPipeline(int width, int height, int maxInFlight);
+    // Frames still in flight are abandoned; returns once no stage is
+    // working on one.
+    ~DepthPipeline();
+
+    int SlotCount() const { return (int)m_slots.size(); }
+    DepthContext* SlotContext(int slot) { return m_slots[slot].ctx.get(); }
+
+    // False, without blocking, when maxInFlight frames are already in
+    // flight.
+    bool Submit(long long frameId, float* vals, float* outNormals, const VertexLayout& layout, int maxCount);
+    // The oldest frame in flight, once it has completed. With wait,
+    // blocks until it has; false if no frame is in flight, or without
+    // wait, if it is not done yet.
+    bool Poll(bool wait, DepthFrameStatus& outStatus);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Slot
+    {
+        std::unique_ptr<DepthContext> ctx;
+        long long frameId;
+        float* vals;
+        float* outNormals;
+        VertexLayout layout;
+        int maxCount;
+        int vertexCount;
+        // FitPlaneTiles replayed the whole tree.
+        bool unchanged;
+        // Stages finished, PipelineStageCount once the frame is done.
+        int stagesDone;
+        Clock::time_point submitted;
+        Clock::time_point start[PipelineStageCount];
+        Clock::time_point end[PipelineStageCount];
+    };
+
+    void StageLoop(int stage);
+    void RunStage(int stage, Slot& slot);
+
+    std::vector<Slot> m_slots;
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    // Frames submitted and handed back by Poll; frame n is in slot
+    // n % SlotCount().
+    long long m_submitted;
+    long long m_completed;
+    bool m_exit;
+    // Colours continue from frame to frame as with one context. Only the
+    // output stage uses it.
+    unsigned int m_colorSeed;
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Pt.h"
+#include "ptslib.h"
+
+struct DepthContext;
+
+// DepthMakePlanesCtx in the stages DepthPipeline runs on threads of their
+// own. All three work on ctx->planeScratch, so a context's frame has to
+// go through them in order before the next frame starts.
+extern "C"
+{
+    // Quadtree: fits the frame's tiles into the scratch's results.
+    // Returns whether the whole tree was replayed from the incremental
+    // history, which GroupPlaneTiles needs to know.
+    bool FitPlaneTiles(DepthContext* ctx, float* vals);
+    // Adjacency and merge: drops degenerate tiles, marks the picked one
+    // and joins the rest into the scratch's groups.
+    void GroupPlaneTiles(DepthContext* ctx, bool unchanged, int pickX, int pickY);
+    // Output: two triangles per tile, coloured per group from
+    // ctx->colorSeed, up to maxCount vertices. Ends the frame.
+    void EmitPlaneTriangles(DepthContext* ctx, const VertexLayout* layout, int maxCount, int* outCount);
+}
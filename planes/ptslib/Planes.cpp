@@ -3,9 +3,17 @@
 #include <cmath>
 #include <vector>
 #include <map>
-#include <memory>
 #include <algorithm>
+#include <tuple>
 #include "Pt.h"
+#include "Context.h"
+#include "Kernels.h"
+#include "Moments.h"
+#include "PlaneStages.h"
+#include "TileHistory.h"
+#include "ValidMask.h"
+#include "VertexWriter.h"
+#include "ptslib.h"
 
 extern "C"
 {
@@ -36,8 +44,13 @@ extern "C"
                 ((unsigned long long)(w) << 10) |
                 ((unsigned long long)(h));
         }
-        int Right() { return x + w; }
-        int Bottom() { return y + h; }
+        static Rect FromUniqueId(unsigned long long id)
+        {
+            return Rect((int)(id >> 30), (int)(id >> 20) & 0x3FF,
+                (int)(id >> 10) & 0x3FF, (int)id & 0x3FF);
+        }
+        int Right() const { return x + w; }
+        int Bottom() const { return y + h; }
     };
 
     struct Buffer
@@ -45,17 +58,44 @@ extern "C"
         Pt* depthPths;
         int width;
         int height;
+        const PlaneConstants* constants;
+        // Set when fitting planes from moments instead of tile corners.
+        const MomentTable* moments;
+        // Set when tile scans use the packed validity mask and SIMD
+        // residual kernel.
+        const ValidMask* validMask;
+        // Set when large tiles are first tested on a sparse grid of their
+        // points, with the validity mask.
+        bool coarseSplit;
+        // Set in incremental mode once the history has been updated for
+        // this frame.
+        const TileHistory* history;
+        // Set when corner searches and residual scans are timed.
+        bool timed;
     };
 
     struct Quad
     {
         Pt pt[4];
+        // Frame pixel each corner was found at; neighbouring tiles that
+        // share a corner pixel share a mesh vertex.
+        int pixel[4];
+    };
+
+    struct Result;
+
+    struct Neighbor
+    {
+        Result* other;
+        Side side;
+        Neighbor* next;
     };
 
     struct Result
     {
-        Result() : visitCnt(0),
-            shouldRemove(false)
+        Result() : index(0),
+            shouldRemove(false),
+            replayed(false)
         {
 
         }
@@ -68,15 +108,62 @@ extern "C"
 
         bool isPicked = false;
 
-        std::vector<std::pair<Result*, Side>> neighbors;
-        int visitCnt;
+        // Arena-allocated list, in the order neighbours were found.
+        Neighbor* neighbors = nullptr;
+        Neighbor* lastNeighbor = nullptr;
+        // Position in the frame's result list once it is final.
+        int index;
         bool shouldRemove;
+        // Incremental mode: taken unchanged from last frame's tile history.
+        bool replayed;
     };
 
-    typedef std::shared_ptr<Result> ResultPtr;
+    // Results live in the frame's arenas, see PlaneScratch.
+    typedef Result* ResultPtr;
+
+    void AddNeighbor(FrameArena& arena, Result* pThis, Result* other, Side side)
+    {
+        Neighbor* link = arena.New<Neighbor>();
+        link->other = other;
+        link->side = side;
+        link->next = nullptr;
+        if (pThis->lastNeighbor != nullptr)
+            pThis->lastNeighbor->next = link;
+        else
+            pThis->neighbors = link;
+        pThis->lastNeighbor = link;
+    }
+
+    // Split halves smaller than this are processed inline instead of being
+    // queued for other workers.
+    const int minTaskPixels = 32 * 32;
+
+    // Points across the shorter side of a tile in the coarse split test;
+    // tiles under twice this are only scanned in full.
+    const int coarseSamples = 16;
 
-    const float mindist = 0.05f;
-    unsigned long long lastPickedId = 0;
+    // Per-worker state while subdividing. Child tiles and accepted results
+    // come from the worker's own arena and go to its own list; queues is
+    // null when the tree is walked on one thread.
+    struct TileWorker
+    {
+        TileWorker(PlaneScratch& scratch, int workerIdx, StealingQueues<TileTask>* tileQueues) :
+            arena(*scratch.arenas[workerIdx]),
+            quads(scratch.workerResults[workerIdx]),
+            records(scratch.workerRecords[workerIdx]),
+            counters(scratch.workerCounters[workerIdx]),
+            queues(tileQueues),
+            index(workerIdx)
+        {
+        }
+
+        FrameArena& arena;
+        std::vector<ResultPtr>& quads;
+        std::vector<TileRecord>& records;
+        TileCounters& counters;
+        StealingQueues<TileTask>* queues;
+        int index;
+    };
 
     struct Tile
     {
@@ -95,22 +182,135 @@ extern "C"
 
         inline Pt& GetPt(int x, int y)
         {          
-            int ry = min(m_buffer.height - 1, y + m_rect.y);
-            int rx = min(m_buffer.width - 1, x + m_rect.x);
+            int ry = std::min(m_buffer.height - 1, y + m_rect.y);
+            int rx = std::min(m_buffer.width - 1, x + m_rect.x);
             return m_buffer.depthPths[ry * m_buffer.width + rx];
         }
 
-        void Process(std::vector<ResultPtr>& quads, int level)
+        // Frame pixels covered by the tile: GetPt clamps x in [0, w] and
+        // y in [0, h] to the frame, so the last column/row can repeat.
+        int ColEnd() { return std::min(m_buffer.width - 1, m_rect.Right()); }
+        int RowEnd() { return std::min(m_buffer.height - 1, m_rect.Bottom()); }
+
+        const Pt* PtAt(int fx, int fy)
+        {
+            return &m_buffer.depthPths[fy * m_buffer.width + fx];
+        }
+
+        // FindCorners from bit scans of the validity mask. Rows past the
+        // frame edge only repeat the last row, so scanning each frame row
+        // once finds the same points.
+        int FindCornersMasked(const Pt*& ptl, const Pt*& ptr, const Pt*& pbl, const Pt*& pbr)
+        {
+            const ValidMask& mask = *m_buffer.validMask;
+            ptl = ptr = pbl = pbr = nullptr;
+            int x0 = m_rect.x, x1 = ColEnd();
+            int y0 = m_rect.y, y1 = RowEnd();
+            int topRow = -1;
+            for (int y = y0; y <= y1; ++y)
+            {
+                int fx = mask.FirstInRow(y, x0, x1);
+                if (fx >= 0)
+                {
+                    ptl = PtAt(fx, y);
+                    ptr = PtAt(mask.LastInRow(y, x0, x1), y);
+                    topRow = y;
+                    break;
+                }
+            }
+            if (topRow < 0)
+                return 0;
+            for (int y = y1; y >= topRow; --y)
+            {
+                int fx = mask.FirstInRow(y, x0, x1);
+                if (fx >= 0)
+                {
+                    pbl = PtAt(fx, y);
+                    pbr = PtAt(mask.LastInRow(y, x0, x1), y);
+                    break;
+                }
+            }
+            return 4;
+        }
+
+        // Max-distance / mean-distance test of Process over the validity
+        // mask's valid spans with the SIMD kernel. Stops at the first point
+        // further than minDist; the repeated last row and column are
+        // weighted as often as GetPt would visit them.
+        bool ResidualMasked(const Pt& planePt, const Pt& nrm, float& sumDist, float& numPts,
+            long long& scanned)
+        {
+            const ValidMask& mask = *m_buffer.validMask;
+            float minDist = m_buffer.constants->minDist;
+            int x0 = m_rect.x, x1 = ColEnd();
+            int y0 = m_rect.y, y1 = RowEnd();
+            int repeatCols = m_rect.Right() - x1;
+            int repeatRows = m_rect.Bottom() - y1;
+            for (int y = y0; y <= y1; ++y)
+            {
+                int sx0 = std::max(x0, mask.RowFirst(y));
+                int sx1 = std::min(x1, mask.RowLast(y));
+                if (sx0 > sx1)
+                    continue;
+                scanned += sx1 - sx0 + 1;
+                float rowSum = 0, rowCnt = 0;
+                bool exceeded = PlaneResidualRowSimd(m_buffer.depthPths, m_buffer.width, y,
+                    sx0, sx1 + 1, planePt, nrm, minDist, rowSum, rowCnt);
+                if (repeatCols > 0 && sx1 == x1 && mask.IsValid(x1, y))
+                {
+                    float dp = fabs(Dot(*PtAt(x1, y) - planePt, nrm));
+                    rowSum += dp * repeatCols;
+                    rowCnt += repeatCols;
+                }
+                float weight = (y == y1) ? 1.0f + repeatRows : 1.0f;
+                sumDist += rowSum * weight;
+                numPts += rowCnt * weight;
+                if (exceeded)
+                    return true;
+            }
+            return false;
+        }
+
+        // Looks for a point further than minDist from the plane on a grid
+        // of about coarseSamples points across the tile. Finding one
+        // proves the full scan would split the tile too, since it visits
+        // the same point and computes the same distance; not finding one
+        // proves nothing, and the full scan decides. Most large tiles
+        // split, and the grid finds why in a few hundred points.
+        bool CoarseSplit(const Pt& planePt, const Pt& nrm, long long& scanned)
         {
-            const Pt* ptl = nullptr, * ptr = nullptr,
-                * pbl = nullptr, * pbr = nullptr;
+            if (!m_buffer.coarseSplit)
+                return false;
+            int x0 = m_rect.x, x1 = ColEnd();
+            int y0 = m_rect.y, y1 = RowEnd();
+            int stride = (std::min(x1 - x0, y1 - y0) + 1) / coarseSamples;
+            if (stride < 2)
+                return false;
+            float minDist = m_buffer.constants->minDist;
+            for (int y = y0 + stride / 2; y <= y1; y += stride)
+            {
+                for (int x = x0 + stride / 2; x <= x1; x += stride)
+                {
+                    scanned++;
+                    Pt pt = *PtAt(x, y);
+                    if (pt.IsValid() && fabs(Dot(pt - planePt, nrm)) > minDist)
+                        return true;
+                }
+            }
+            return false;
+        }
+
+        // First valid point scanning from each corner of the tile inwards.
+        int FindCorners(const Pt*& ptl, const Pt*& ptr, const Pt*& pbl, const Pt*& pbr)
+        {
+            if (m_buffer.validMask != nullptr)
+                return FindCornersMasked(ptl, ptr, pbl, pbr);
+
+            ptl = ptr = pbl = pbr = nullptr;
             int height = m_rect.h;
             int width = m_rect.w;
             int found = 0;
 
-            //if (m_rect.GetUniqueId() == lastPickedId)
-            //    OutputDebugStringA("pick");
-
             for (int y = 0; y <= height && ptl == nullptr; ++y)
             {
                 for (int x = 0; x <= width && ptl == nullptr; ++x)
@@ -161,6 +361,172 @@ extern "C"
                     }
                 }
             }
+            return found;
+        }
+
+        void Split(TileWorker& worker, int level)
+        {
+            worker.counters.splits++;
+            m_tiles = worker.arena.Allocate<Tile>(2);
+            if (m_rect.w > m_rect.h)
+            {
+                new (&m_tiles[0]) Tile(m_buffer, Rect(m_rect.x, m_rect.y, m_rect.w - m_rect.w / 2, m_rect.h));
+                new (&m_tiles[1]) Tile(m_buffer, Rect(m_rect.x + m_rect.w / 2, m_rect.y, m_rect.w / 2, m_rect.h));
+            }
+            else
+            {
+                new (&m_tiles[0]) Tile(m_buffer, Rect(m_rect.x, m_rect.y, m_rect.w, m_rect.h / 2));
+                new (&m_tiles[1]) Tile(m_buffer, Rect(m_rect.x, m_rect.y + m_rect.h / 2, m_rect.w, m_rect.h / 2));
+            }
+
+            // Hand the second half to the scheduler when it is worth
+            // stealing and carry on with the first one here.
+            Tile& second = m_tiles[1];
+            bool queueSecond = worker.queues != nullptr &&
+                second.m_rect.w * second.m_rect.h >= minTaskPixels;
+            if (queueSecond)
+                worker.queues->Push(worker.index, TileTask{ &second, level + 1 });
+            m_tiles[0].Process(worker, level + 1);
+            if (!queueSecond)
+                second.Process(worker, level + 1);
+        }
+
+        // Least-squares fit from the frame's moment table: O(1) per tile
+        // for the split decision, with the corner search only run once a
+        // tile is accepted to place its output quad.
+        void ProcessMoments(TileWorker& worker, int level)
+        {
+            // Same pixels the corner search sees: the rect plus its right
+            // and bottom edge, clamped to the frame.
+            Moments m = m_buffer.moments->Sum(m_rect.x, m_rect.y,
+                m_rect.Right() + 1, m_rect.Bottom() + 1);
+            Pt centroid, nrm;
+            float rmsDist;
+            if (!FitPlane(m, centroid, nrm, rmsDist))
+                return;
+
+            if (rmsDist > m_buffer.constants->splitThreshold)
+            {
+                // A 2x2 pixel tile splits into itself; drop it instead.
+                if (m_rect.w <= 1 && m_rect.h <= 1)
+                    return;
+                Split(worker, level);
+                return;
+            }
+
+            const Pt* ptl, * ptr, * pbl, * pbr;
+            int found;
+            {
+                TileTimer timer(m_buffer.timed, worker.counters.cornerMs);
+                found = FindCorners(ptl, ptr, pbl, pbr);
+            }
+            if (found < 4)
+                return;
+
+            Result r;
+            r.normal = nrm;
+            r.pt0 = centroid;
+            r.r = m_rect;
+            r.maxDistFound = rmsDist;
+            const Pt* corners[4] = { ptl, ptr, pbl, pbr };
+            for (int i = 0; i < 4; ++i)
+            {
+                const Pt& pt = *corners[i];
+                r.q.pt[i] = pt - nrm * Dot(pt - centroid, nrm);
+                r.q.pixel[i] = (int)(corners[i] - m_buffer.depthPths);
+            }
+
+            worker.counters.leaves++;
+            worker.quads.push_back(worker.arena.New<Result>(r));
+        }
+
+        // Incremental mode: replays the tile's outcome from the last frame
+        // when none of its pixels moved, then records what it did this
+        // frame for the next one.
+        void Process(TileWorker& worker, int level)
+        {
+            worker.counters.tilesVisited++;
+            const TileHistory* history = m_buffer.history;
+            if (history == nullptr)
+            {
+                Fit(worker, level);
+                return;
+            }
+
+            unsigned long long id = m_rect.GetUniqueId();
+            const TileRecord* prev = nullptr;
+            if (!history->Moved(m_rect.x, m_rect.y, m_rect.Right(), m_rect.Bottom()))
+                prev = history->Find(id);
+
+            TileRecord rec;
+            rec.id = id;
+            if (prev != nullptr)
+            {
+                rec = *prev;
+                if (prev->outcome == TileOutcome::Leaf)
+                {
+                    worker.counters.leaves++;
+                    Result* r = worker.arena.New<Result>();
+                    r->r = m_rect;
+                    r->normal = prev->normal;
+                    r->pt0 = prev->pt0;
+                    r->maxDistFound = prev->maxDistFound;
+                    for (int i = 0; i < 4; ++i)
+                    {
+                        r->q.pt[i] = prev->quad[i];
+                        r->q.pixel[i] = prev->quadPixel[i];
+                    }
+                    r->replayed = true;
+                    worker.quads.push_back(r);
+                }
+                // Children are looked up again; they did not move either.
+                worker.records.push_back(rec);
+                if (prev->outcome == TileOutcome::Split)
+                    Split(worker, level);
+                return;
+            }
+
+            size_t quadCount = worker.quads.size();
+            Fit(worker, level);
+            if (m_tiles != nullptr)
+                rec.outcome = TileOutcome::Split;
+            else if (worker.quads.size() > quadCount)
+            {
+                const Result& r = *worker.quads.back();
+                rec.outcome = TileOutcome::Leaf;
+                rec.maxDistFound = r.maxDistFound;
+                rec.normal = r.normal;
+                rec.pt0 = r.pt0;
+                for (int i = 0; i < 4; ++i)
+                {
+                    rec.quad[i] = r.q.pt[i];
+                    rec.quadPixel[i] = r.q.pixel[i];
+                }
+            }
+            else
+                rec.outcome = TileOutcome::Dropped;
+            worker.records.push_back(rec);
+        }
+
+        void Fit(TileWorker& worker, int level)
+        {
+            if (m_buffer.moments != nullptr)
+            {
+                ProcessMoments(worker, level);
+                return;
+            }
+
+            const Pt* ptl, * ptr, * pbl, * pbr;
+            int height = m_rect.h;
+            int width = m_rect.w;
+            int found;
+            {
+                TileTimer timer(m_buffer.timed, worker.counters.cornerMs);
+                found = FindCorners(ptl, ptr, pbl, pbr);
+            }
+
+            //if (m_rect.GetUniqueId() == lastPickedId)
+            //    OutputDebugStringA("pick");
 
             if (found < 4)
                 return;
@@ -188,50 +554,51 @@ extern "C"
             nrm1.Normalize();
 
             Pt planePt = *ptl;
+            bool coarse;
             bool split = false;
             float maxDistFound = 0;
             float numPts = 0;
-            for (int y = 0; y <= height && !split; ++y)
+            long long& scanned = worker.counters.pixelsScanned;
             {
-                for (int x = 0; x <= width && !split; ++x)
+                TileTimer timer(m_buffer.timed, worker.counters.residualMs);
+                coarse = CoarseSplit(planePt, nrm1, scanned);
+                if (!coarse && m_buffer.validMask != nullptr)
+                    split = ResidualMasked(planePt, nrm1, maxDistFound, numPts, scanned);
+                else if (!coarse)
                 {
-                    Pt& pt = GetPt(x, y);
-                    if (pt.IsValid())
+                    for (int y = 0; y <= height && !split; ++y)
                     {
-                        float dp = fabs(Dot(pt - planePt, nrm1));
-                        if (dp > mindist)
+                        for (int x = 0; x <= width && !split; ++x)
                         {
-                            split = true;
+                            scanned++;
+                            Pt& pt = GetPt(x, y);
+                            if (pt.IsValid())
+                            {
+                                float dp = fabs(Dot(pt - planePt, nrm1));
+                                if (dp > m_buffer.constants->minDist)
+                                {
+                                    split = true;
+                                }
+                                maxDistFound += dp;
+                                numPts++;
+                            }
                         }
-                        maxDistFound += dp;
-                        numPts++;
                     }
                 }
             }
+            if (coarse)
+            {
+                Split(worker, level);
+                return;
+            }
 
             maxDistFound /= numPts;
-            if (maxDistFound > 0.005)
+            if (maxDistFound > m_buffer.constants->splitThreshold)
                 split = true;
 
             if (split)
             {
-                if (m_rect.w > m_rect.h)
-                {
-                    m_tiles = new Tile[2]{
-                         Tile(m_buffer, Rect(m_rect.x, m_rect.y, m_rect.w - m_rect.w / 2, m_rect.h)),
-                         Tile(m_buffer, Rect(m_rect.x + m_rect.w / 2, m_rect.y, m_rect.w / 2, m_rect.h)) };
-                }
-                else
-                {
-                    m_tiles = new Tile[2]{
-                         Tile(m_buffer, Rect(m_rect.x, m_rect.y, m_rect.w, m_rect.h / 2)),
-                         Tile(m_buffer, Rect(m_rect.x, m_rect.y + m_rect.h / 2, m_rect.w, m_rect.h / 2)) };
-                }
-
-                for (int tIdx = 0; tIdx < 2; ++tIdx)
-                {
-                    m_tiles[tIdx].Process(quads, level + 1);
-                }
+                Split(worker, level);
             }
             else
             {
@@ -240,20 +607,25 @@ extern "C"
                 r.pt0 = planePt;
                 r.r = m_rect;
                 r.maxDistFound = maxDistFound;
-                r.q.pt[0] = *ptl;
-                r.q.pt[1] = *ptr;
-                r.q.pt[2] = *pbl;
-                r.q.pt[3] = *pbr;
+                const Pt* corners[4] = { ptl, ptr, pbl, pbr };
+                for (int i = 0; i < 4; ++i)
+                {
+                    r.q.pt[i] = *corners[i];
+                    r.q.pixel[i] = (int)(corners[i] - m_buffer.depthPths);
+                }
 
-                quads.push_back(std::make_shared<Result>(r));
+                worker.counters.leaves++;
+                worker.quads.push_back(worker.arena.New<Result>(r));
             }
         }
     };
 
+    // Ends sort before starts at the same coordinate, so tiles whose
+    // extents only meet at a point, a corner, are not neighbours.
     enum class BreakType
     {
-        Start,
-        End
+        End,
+        Start
     };
     struct TileBreak
     {
@@ -262,7 +634,7 @@ extern "C"
         Side edge;
         Result* pTile;
 
-        bool operator < (const TileBreak& rhs)
+        bool operator < (const TileBreak& rhs) const
         {
             if (xyVal != rhs.xyVal)
                 return xyVal < rhs.xyVal;
@@ -274,7 +646,7 @@ extern "C"
     };
 
 
-    void PopulateNeighbors(std::vector<ResultPtr>& resultTiles)
+    void PopulateNeighbors(std::vector<ResultPtr>& resultTiles, FrameArena& arena)
     {
         std::map<int, std::vector<ResultPtr>> xTilesLeft;
         std::map<int, std::vector<ResultPtr>> xTilesRight;
@@ -375,11 +747,11 @@ extern "C"
                     TileBreak tb1;
                     tb1.edge = Side::Right;
                     tb1.xyVal = ptr->r.y;
-                    tb1.pTile = ptr.get();
+                    tb1.pTile = ptr;
                     tb1.start = BreakType::Start;
                     tbreaks.push_back(tb1);
                     tb1.xyVal = ptr->r.Bottom();
-                    tb1.pTile = ptr.get();
+                    tb1.pTile = ptr;
                     tb1.start = BreakType::End;
                     tbreaks.push_back(tb1);
                 }
@@ -388,11 +760,11 @@ extern "C"
                     TileBreak tb1;
                     tb1.edge = Side::Left;
                     tb1.xyVal = ptr->r.y;
-                    tb1.pTile = ptr.get();
+                    tb1.pTile = ptr;
                     tb1.start = BreakType::Start;
                     tbreaks.push_back(tb1);
                     tb1.xyVal = ptr->r.Bottom();
-                    tb1.pTile = ptr.get();
+                    tb1.pTile = ptr;
                     tb1.start = BreakType::End;
                     tbreaks.push_back(tb1);
                 }
@@ -407,13 +779,11 @@ extern "C"
                         curresult[edge] = tb.pTile;
                         if (curresult[3 - edge] != nullptr)
                         {
-                            curresult[3 - edge]->neighbors.push_back(
-                                std::make_pair(tb.pTile, (Side)(3 - edge)));
-                            tb.pTile->neighbors.push_back(
-                                std::make_pair(curresult[3 - edge], tb.edge));
+                            AddNeighbor(arena, curresult[3 - edge], tb.pTile, (Side)(3 - edge));
+                            AddNeighbor(arena, tb.pTile, curresult[3 - edge], tb.edge);
                         }
                     }
-                    else
+                    else if (curresult[(int)tb.edge] == tb.pTile)
                         curresult[(int)tb.edge] = nullptr;
                 }
             }
@@ -433,11 +803,11 @@ extern "C"
                     TileBreak tb1;
                     tb1.edge = Side::Bottom;
                     tb1.xyVal = ptr->r.x;
-                    tb1.pTile = ptr.get();
+                    tb1.pTile = ptr;
                     tb1.start = BreakType::Start;
                     tbreaks.push_back(tb1);
                     tb1.xyVal = ptr->r.Right();
-                    tb1.pTile = ptr.get();
+                    tb1.pTile = ptr;
                     tb1.start = BreakType::End;
                     tbreaks.push_back(tb1);
                 }
@@ -446,11 +816,11 @@ extern "C"
                     TileBreak tb1;
                     tb1.edge = Side::Top;
                     tb1.xyVal = ptr->r.x;
-                    tb1.pTile = ptr.get();
+                    tb1.pTile = ptr;
                     tb1.start = BreakType::Start;
                     tbreaks.push_back(tb1);
                     tb1.xyVal = ptr->r.Right();
-                    tb1.pTile = ptr.get();
+                    tb1.pTile = ptr;
                     tb1.start = BreakType::End;
                     tbreaks.push_back(tb1);
                 }
@@ -465,55 +835,537 @@ extern "C"
                         curresult[edge] = tb.pTile;
                         if (curresult[3 - edge] != nullptr)
                         {
-                            curresult[3 - edge]->neighbors.push_back(
-                                std::make_pair(tb.pTile, (Side)(3 - edge)));
-                            tb.pTile->neighbors.push_back(
-                                std::make_pair(curresult[3 - edge], tb.edge));
+                            AddNeighbor(arena, curresult[3 - edge], tb.pTile, (Side)(3 - edge));
+                            AddNeighbor(arena, tb.pTile, curresult[3 - edge], tb.edge);
                         }
                     }
-                    else
+                    else if (curresult[(int)tb.edge] == tb.pTile)
                         curresult[(int)tb.edge] = nullptr;
                 }
             }
         }
     }
 
-    void FindConnected(Result* pThis, int visitIdx, std::vector<Result*>& outTiles)
+    // Same relationships as PopulateNeighbors' sweeps: tiles are
+    // neighbours when one's right (bottom) edge is on the line of the
+    // other's left (top) edge and their extents along it share at least a
+    // pixel; tiles that only meet at a corner are not. Each leaf writes its
+    // id along its left and top edge, then walks its own right and bottom
+    // edge; the owners met there are its neighbours. The grids are cleared
+    // the same way, so a frame costs O(tiles + perimeter).
+    void PopulateNeighborsGrid(std::vector<ResultPtr>& resultTiles, FrameArena& arena,
+        PlaneScratch& scratch, int width, int height)
     {
-        if (pThis->visitCnt == visitIdx)
-            return;
+        int* leftEdges = scratch.leftEdges.data();
+        int* topEdges = scratch.topEdges.data();
+        int tileCnt = (int)resultTiles.size();
+        for (int idx = 0; idx < tileCnt; ++idx)
+        {
+            const Rect& r = resultTiles[idx]->r;
+            int y1 = std::min(height, r.y + r.h);
+            int x1 = std::min(width, r.x + r.w);
+            int* left = leftEdges + (size_t)r.x * height;
+            for (int y = r.y; y < y1; ++y)
+                left[y] = idx;
+            int* top = topEdges + (size_t)r.y * width;
+            for (int x = r.x; x < x1; ++x)
+                top[x] = idx;
+        }
 
-        outTiles.push_back(pThis);
-        pThis->visitCnt = visitIdx;
+        for (int idx = 0; idx < tileCnt; ++idx)
+        {
+            Result* pThis = resultTiles[idx];
+            Rect& r = pThis->r;
+            if (r.Right() <= width)
+            {
+                const int* line = leftEdges + (size_t)r.Right() * height;
+                int y1 = std::min(height, r.Bottom());
+                int prev = -1;
+                for (int y = r.y; y < y1; ++y)
+                {
+                    int other = line[y];
+                    if (other < 0 || other == prev || other == idx)
+                        continue;
+                    prev = other;
+                    AddNeighbor(arena, pThis, resultTiles[other], Side::Left);
+                    AddNeighbor(arena, resultTiles[other], pThis, Side::Right);
+                }
+            }
+            if (r.Bottom() <= height)
+            {
+                const int* line = topEdges + (size_t)r.Bottom() * width;
+                int x1 = std::min(width, r.Right());
+                int prev = -1;
+                for (int x = r.x; x < x1; ++x)
+                {
+                    int other = line[x];
+                    if (other < 0 || other == prev || other == idx)
+                        continue;
+                    prev = other;
+                    AddNeighbor(arena, pThis, resultTiles[other], Side::Top);
+                    AddNeighbor(arena, resultTiles[other], pThis, Side::Bottom);
+                }
+            }
+        }
 
-        for (auto itNeighbors : pThis->neighbors)
+        for (int idx = 0; idx < tileCnt; ++idx)
         {
-            Result* other = itNeighbors.first;
+            const Rect& r = resultTiles[idx]->r;
+            int y1 = std::min(height, r.y + r.h);
+            int x1 = std::min(width, r.x + r.w);
+            std::fill(leftEdges + (size_t)r.x * height + r.y, leftEdges + (size_t)r.x * height + y1, -1);
+            std::fill(topEdges + (size_t)r.y * width + r.x, topEdges + (size_t)r.y * width + x1, -1);
+        }
+    }
+
+    // Neighbours on the same plane: normals within minDPVal of parallel
+    // (either way round), and one tile's point less than minDist in front
+    // of the other's plane. The recursive walk this replaced made the
+    // distance test from whichever tile it crossed the edge from, so
+    // either direction joins them.
+    bool SamePlane(const Result& a, const Result& b, const PlaneConstants& constants)
+    {
+        float dotNrm = Dot(a.normal, b.normal);
+        if (!(dotNrm < -constants.minDPVal || dotNrm > constants.minDPVal))
+            return false;
+        return Dot(a.pt0 - b.pt0, a.normal) < constants.minDist ||
+            Dot(b.pt0 - a.pt0, b.normal) < constants.minDist;
+    }
 
-            float dotNrm = Dot(pThis->normal, other->normal);
-            if ((dotNrm < -0.9 || dotNrm > 0.9) &&
-                Dot((pThis->pt0 - other->pt0), pThis->normal) < mindist)
+    // Numbers the sets in planeSets as groups, by their first tile, and
+    // lists each group's tiles in result order.
+    void GatherGroups(const std::vector<ResultPtr>& resultTiles, PlaneScratch& scratch)
+    {
+        int tileCnt = (int)resultTiles.size();
+        DisjointSet& sets = scratch.planeSets;
+
+        // Count each group's tiles, then turn the counts into offsets and
+        // place the tiles.
+        std::vector<int>& groupOf = scratch.groupOf;
+        std::vector<size_t>& groupStarts = scratch.groupStarts;
+        groupOf.assign(tileCnt, -1);
+        for (int idx = 0; idx < tileCnt; ++idx)
+        {
+            int root = sets.Find(idx);
+            if (groupOf[root] < 0)
             {
-                FindConnected(itNeighbors.first, visitIdx, outTiles);
+                groupOf[root] = (int)groupStarts.size();
+                groupStarts.push_back(0);
             }
+            groupStarts[groupOf[root]]++;
         }
+        size_t offset = 0;
+        for (size_t& start : groupStarts)
+        {
+            size_t count = start;
+            start = offset;
+            offset += count;
+        }
+        groupStarts.push_back(offset);
+
+        std::vector<Result*>& groups = scratch.groups;
+        groups.resize(tileCnt);
+        for (int idx = 0; idx < tileCnt; ++idx)
+        {
+            int group = groupOf[sets.Find(idx)];
+            // groupStarts[group] is advanced as tiles are placed, and put
+            // back below.
+            groups[groupStarts[group]++] = resultTiles[idx];
+        }
+        for (size_t group = groupStarts.size() - 1; group > 0; --group)
+            groupStarts[group] = groupStarts[group - 1];
+        groupStarts[0] = 0;
     }
 
-    __declspec (dllexport) void DepthMakePlanes(float* vals, Pt* outVertices, Pt* outTexCoords, int maxCount, int* outCount, 
-        int pickX, int pickY,
-        int depthWidth, int depthHeight)
+    // Joins neighbours on the same plane into groups. The edge tests run in
+    // parallel over ranges of tiles, each task keeping the pairs it accepts
+    // in its own list, so they share nothing; the pairs are then merged in
+    // a union-find in range order. Groups come out ordered by their first
+    // tile, and tiles within a group in result order.
+    void MergePlanes(std::vector<ResultPtr>& resultTiles, const PlaneConstants& constants,
+        ThreadPool& pool, PlaneScratch& scratch)
     {
+        int tileCnt = (int)resultTiles.size();
+        int taskCount = std::max(1, std::min((int)scratch.workerLinks.size(), tileCnt / 256));
+        int tilesPerTask = (tileCnt + taskCount - 1) / taskCount;
+        pool.Run(taskCount, [&](int task)
+            {
+                std::vector<std::pair<int, int>>& links = scratch.workerLinks[task];
+                int end = std::min(tileCnt, (task + 1) * tilesPerTask);
+                for (int idx = task * tilesPerTask; idx < end; ++idx)
+                {
+                    const Result* pThis = resultTiles[idx];
+                    for (const Neighbor* link = pThis->neighbors; link != nullptr; link = link->next)
+                    {
+                        // Neighbour lists hold both directions; test each pair once.
+                        const Result* other = link->other;
+                        if (other->index > idx && SamePlane(*pThis, *other, constants))
+                            links.push_back(std::make_pair(idx, other->index));
+                    }
+                }
+            });
+
+        DisjointSet& sets = scratch.planeSets;
+        sets.Reset(tileCnt);
+        for (int task = 0; task < taskCount; ++task)
+        {
+            for (const std::pair<int, int>& link : scratch.workerLinks[task])
+                sets.Union(link.first, link.second);
+        }
+        GatherGroups(resultTiles, scratch);
+    }
+
+    void SetEdgeLine(int* cells, int begin, int end, int slot, bool set)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            if (set)
+                cells[i] = slot;
+            else if (cells[i] == slot)
+                cells[i] = -1;
+        }
+    }
+
+    // Writes slot to a leaf's cells in the four edge grids, or clears the
+    // ones that still hold it.
+    void SetEdgeCells(PlaneScratch& scratch, const Rect& r, int width, int height, int slot, bool set)
+    {
+        int y1 = std::min(height, r.Bottom());
+        int x1 = std::min(width, r.Right());
+        SetEdgeLine(scratch.leftEdges.data() + (size_t)r.x * height, r.y, y1, slot, set);
+        SetEdgeLine(scratch.topEdges.data() + (size_t)r.y * width, r.x, x1, slot, set);
+        if (r.Right() <= width)
+            SetEdgeLine(scratch.rightEdges.data() + (size_t)r.Right() * height, r.y, y1, slot, set);
+        if (r.Bottom() <= height)
+            SetEdgeLine(scratch.bottomEdges.data() + (size_t)r.Bottom() * width, r.x, x1, slot, set);
+    }
+
+    // Pairs the leaf in slot with each leaf met along cells [begin, end)
+    // of an edge line. A pair of re-fit tiles is only taken from the
+    // first one's right or bottom edge, so it is found once.
+    void LinkAlong(const int* line, int begin, int end, int slot, bool withRefit,
+        const std::vector<ResultPtr>& resultTiles, const PlaneConstants& constants, PlaneScratch& scratch)
+    {
+        const Result& tile = *resultTiles[scratch.slotTiles[slot]];
+        int prev = -1;
+        for (int i = begin; i < end; ++i)
+        {
+            int other = line[i];
+            if (other < 0 || other == prev || other == slot)
+                continue;
+            prev = other;
+            const Result& otherTile = *resultTiles[scratch.slotTiles[other]];
+            if (!withRefit && !otherTile.replayed)
+                continue;
+            scratch.tileLinks.push_back(TileLink{ slot, other, SamePlane(tile, otherTile, constants) });
+        }
+    }
+
+    // Incremental mode with NeighborSearchGrid: brings last frame's
+    // neighbour pairs up to date. Re-fit tiles and tiles that are gone are
+    // taken out of the edge grids along with their pairs, re-fit tiles go
+    // back in with new slots, and only their edges are walked and their
+    // pairs tested. Replayed tiles keep their slots and pairs. Clears
+    // replayed for tiles that had no pairs kept, so it then marks the
+    // tiles whose pairs and last group carry over.
+    void UpdateTileLinks(std::vector<ResultPtr>& resultTiles, const PlaneConstants& constants,
+        PlaneScratch& scratch, int width, int height)
+    {
+        if (!scratch.linksValid)
+        {
+            if (scratch.rightEdges.size() != scratch.leftEdges.size())
+            {
+                scratch.rightEdges.resize(scratch.leftEdges.size());
+                scratch.bottomEdges.resize(scratch.topEdges.size());
+                scratch.allocations += 2;
+            }
+            std::fill(scratch.leftEdges.begin(), scratch.leftEdges.end(), -1);
+            std::fill(scratch.topEdges.begin(), scratch.topEdges.end(), -1);
+            std::fill(scratch.rightEdges.begin(), scratch.rightEdges.end(), -1);
+            std::fill(scratch.bottomEdges.begin(), scratch.bottomEdges.end(), -1);
+            scratch.tileLinks.clear();
+            scratch.linkTileIds.clear();
+            scratch.linkTileSlots.clear();
+            scratch.slotTiles.clear();
+            scratch.slotGroups.clear();
+            scratch.freeSlots.clear();
+            scratch.linkGroupCount = 0;
+            scratch.linksValid = true;
+        }
+
+        // Both tile lists are in id order; walk them together.
+        int tileCnt = (int)resultTiles.size();
+        std::vector<int>& slotTiles = scratch.slotTiles;
+        std::vector<int>& tileSlots = scratch.tileSlots;
+        tileSlots.assign(tileCnt, -1);
+        scratch.groupDirty.assign(scratch.linkGroupCount, 0);
+        size_t lastCnt = scratch.linkTileIds.size();
+        size_t last = 0;
+        auto removeLast = [&]()
+            {
+                int slot = scratch.linkTileSlots[last];
+                SetEdgeCells(scratch, Rect::FromUniqueId(scratch.linkTileIds[last]), width, height, slot,
+                    false);
+                scratch.groupDirty[scratch.slotGroups[slot]] = 1;
+                slotTiles[slot] = -1;
+                scratch.freeSlots.push_back(slot);
+                last++;
+            };
+        for (int idx = 0; idx < tileCnt; ++idx)
+        {
+            Result& res = *resultTiles[idx];
+            unsigned long long id = res.r.GetUniqueId();
+            while (last < lastCnt && scratch.linkTileIds[last] < id)
+                removeLast();
+            if (res.replayed && last < lastCnt && scratch.linkTileIds[last] == id)
+            {
+                int slot = scratch.linkTileSlots[last++];
+                tileSlots[idx] = slot;
+                slotTiles[slot] = idx;
+            }
+            else
+                res.replayed = false;
+        }
+        while (last < lastCnt)
+            removeLast();
+
+        std::vector<TileLink>& links = scratch.tileLinks;
+        links.erase(std::remove_if(links.begin(), links.end(), [&](const TileLink& link)
+            {
+                return slotTiles[link.a] < 0 || slotTiles[link.b] < 0;
+            }), links.end());
+
+        for (int idx = 0; idx < tileCnt; ++idx)
+        {
+            if (resultTiles[idx]->replayed)
+                continue;
+            int slot;
+            if (!scratch.freeSlots.empty())
+            {
+                slot = scratch.freeSlots.back();
+                scratch.freeSlots.pop_back();
+            }
+            else
+            {
+                slot = (int)slotTiles.size();
+                slotTiles.push_back(-1);
+                scratch.slotGroups.push_back(-1);
+            }
+            slotTiles[slot] = idx;
+            tileSlots[idx] = slot;
+            SetEdgeCells(scratch, resultTiles[idx]->r, width, height, slot, true);
+        }
+
+        for (int idx = 0; idx < tileCnt; ++idx)
+        {
+            if (resultTiles[idx]->replayed)
+                continue;
+            const Rect& r = resultTiles[idx]->r;
+            int slot = tileSlots[idx];
+            int y1 = std::min(height, r.Bottom());
+            int x1 = std::min(width, r.Right());
+            if (r.Right() <= width)
+            {
+                LinkAlong(scratch.leftEdges.data() + (size_t)r.Right() * height, r.y, y1, slot, true,
+                    resultTiles, constants, scratch);
+            }
+            if (r.Bottom() <= height)
+            {
+                LinkAlong(scratch.topEdges.data() + (size_t)r.Bottom() * width, r.x, x1, slot, true,
+                    resultTiles, constants, scratch);
+            }
+            LinkAlong(scratch.rightEdges.data() + (size_t)r.x * height, r.y, y1, slot, false,
+                resultTiles, constants, scratch);
+            LinkAlong(scratch.bottomEdges.data() + (size_t)r.y * width, r.x, x1, slot, false,
+                resultTiles, constants, scratch);
+        }
+
+        scratch.linkTileIds.resize(tileCnt);
+        for (int idx = 0; idx < tileCnt; ++idx)
+            scratch.linkTileIds[idx] = resultTiles[idx]->r.GetUniqueId();
+        scratch.linkTileSlots = tileSlots;
+    }
+
+    // Incremental mode: joins the tiles into groups from UpdateTileLinks'
+    // pairs. Last frame's groups that kept all their tiles are joined as
+    // they were, without going through their pairs again; only pairs with
+    // a re-fit tile, or in a group that lost one, are joined one by one.
+    void MergeTileLinks(const std::vector<ResultPtr>& resultTiles, PlaneScratch& scratch)
+    {
+        int tileCnt = (int)resultTiles.size();
+        const std::vector<int>& slotTiles = scratch.slotTiles;
+        const std::vector<int>& tileSlots = scratch.tileSlots;
+        std::vector<int>& slotGroups = scratch.slotGroups;
+        DisjointSet& sets = scratch.planeSets;
+        sets.Reset(tileCnt);
+        std::vector<int>& seeds = scratch.groupSeeds;
+        seeds.assign(scratch.linkGroupCount, -1);
+        for (int idx = 0; idx < tileCnt; ++idx)
+        {
+            if (!resultTiles[idx]->replayed)
+                continue;
+            int group = slotGroups[tileSlots[idx]];
+            if (scratch.groupDirty[group])
+                continue;
+            if (seeds[group] < 0)
+                seeds[group] = idx;
+            else
+                sets.Union(seeds[group], idx);
+        }
+        for (const TileLink& link : scratch.tileLinks)
+        {
+            if (!link.samePlane)
+                continue;
+            int a = slotTiles[link.a];
+            int b = slotTiles[link.b];
+            // A kept pair on the same plane was in one of last frame's groups.
+            if (resultTiles[a]->replayed && resultTiles[b]->replayed &&
+                !scratch.groupDirty[slotGroups[link.a]])
+                continue;
+            sets.Union(a, b);
+        }
+        GatherGroups(resultTiles, scratch);
+
+        for (int idx = 0; idx < tileCnt; ++idx)
+            slotGroups[tileSlots[idx]] = scratch.groupOf[sets.Find(idx)];
+        scratch.linkGroupCount = (int)scratch.groupStarts.size() - 1;
+    }
+
+    // Runs the quadtree from root on all of the pool's threads and returns
+    // the accepted tiles ordered by Rect::GetUniqueId, so the output does
+    // not depend on the thread count or on how tasks were stolen.
+    void SubdivideTiles(Tile& root, ThreadPool& pool, PlaneScratch& scratch,
+        std::vector<ResultPtr>& resultTiles)
+    {
+        int workerCount = pool.ThreadCount();
+        if (workerCount == 1)
+        {
+            TileWorker worker(scratch, 0, nullptr);
+            root.Process(worker, 0);
+        }
+        else
+        {
+            StealingQueues<TileTask>& queues = scratch.tileQueues;
+            queues.Push(0, TileTask{ &root, 0 });
+            queues.Run(pool, [&](const TileTask& task, int workerIdx)
+                {
+                    TileWorker worker(scratch, workerIdx, &queues);
+                    task.tile->Process(worker, task.level);
+                });
+        }
+
+        for (int idx = 0; idx < workerCount; ++idx)
+        {
+            const std::vector<ResultPtr>& quads = scratch.workerResults[idx];
+            resultTiles.insert(resultTiles.end(), quads.begin(), quads.end());
+        }
+        std::sort(resultTiles.begin(), resultTiles.end(), [](const ResultPtr& a, const ResultPtr& b)
+            {
+                return a->r.GetUniqueId() < b->r.GetUniqueId();
+            });
+    }
+
+    // The leaves of an unchanged tree, in the order SubdivideTiles returns
+    // them, without walking it.
+    void ReplayLeaves(const TileHistory& history, PlaneScratch& scratch,
+        std::vector<ResultPtr>& resultTiles)
+    {
+        FrameArena& arena = *scratch.arenas[0];
+        for (const TileRecord& rec : history.Records())
+        {
+            if (rec.outcome != TileOutcome::Leaf)
+                continue;
+            Result* r = arena.New<Result>();
+            r->r = Rect::FromUniqueId(rec.id);
+            r->normal = rec.normal;
+            r->pt0 = rec.pt0;
+            r->maxDistFound = rec.maxDistFound;
+            for (int i = 0; i < 4; ++i)
+            {
+                r->q.pt[i] = rec.quad[i];
+                r->q.pixel[i] = rec.quadPixel[i];
+            }
+            r->replayed = true;
+            resultTiles.push_back(r);
+        }
+    }
+
+    bool FitPlaneTiles(DepthContext* ctx, float* vals)
+    {
+        int depthWidth = ctx->width;
+        int depthHeight = ctx->height;
         Buffer b;
         b.depthPths = (Pt*)vals;
         b.width = depthWidth;
         b.height = depthHeight;
+        b.constants = &ctx->constants;
+        b.moments = nullptr;
+        b.validMask = nullptr;
+        b.coarseSplit = false;
+        b.history = nullptr;
+        b.timed = ctx->instrument.Enabled();
+        if (ctx->moveThreshold > 0)
+        {
+            StageScope stage(ctx->instrument, InstrumentTileHistory);
+            ctx->tileHistory.Update(b.depthPths, depthWidth, depthHeight, ctx->moveThreshold,
+                ctx->Pool());
+            b.history = &ctx->tileHistory;
+        }
+        // Nothing is scanned when the whole tree is replayed.
+        bool unchanged = b.history != nullptr && b.history->Unchanged();
+        {
+            StageScope stage(ctx->instrument, InstrumentTileMasks);
+            if (ctx->simdEnabled)
+            {
+                if (!unchanged)
+                    ctx->validMask.Build(b.depthPths, depthWidth, depthHeight, ctx->Pool(), b.history);
+                b.validMask = &ctx->validMask;
+                b.coarseSplit = ctx->coarseSplit;
+            }
+            if (ctx->planeFit == PlaneFitMoments)
+            {
+                if (!unchanged)
+                    ctx->moments.Build(b.depthPths, depthWidth, depthHeight, ctx->Pool());
+                b.moments = &ctx->moments;
+            }
+        }
 
         Rect top(0, 0, b.width, b.height);
 
+        PlaneScratch& scratch = ctx->planeScratch;
+        scratch.BeginFrame(ctx->Pool().ThreadCount(), depthWidth, depthHeight);
         Tile t(b, top);
-        std::vector<ResultPtr> resultTiles;
-        t.Process(resultTiles, 0);
+        std::vector<ResultPtr>& resultTiles = scratch.results;
+        {
+            StageScope stage(ctx->instrument, InstrumentQuadtree);
+            if (unchanged)
+                ReplayLeaves(ctx->tileHistory, scratch, resultTiles);
+            else
+            {
+                SubdivideTiles(t, ctx->Pool(), scratch, resultTiles);
+                if (b.history != nullptr)
+                    ctx->tileHistory.Commit(scratch.workerRecords);
+            }
+        }
+        if (ctx->instrument.Enabled())
+        {
+            for (const TileCounters& counters : scratch.workerCounters)
+                ctx->instrument.AddTileCounters(counters);
+            if (unchanged)
+                ctx->instrument.Frame().leaves += resultTiles.size();
+        }
+        return unchanged;
+    }
 
+    void GroupPlaneTiles(DepthContext* ctx, bool unchanged, int pickX, int pickY)
+    {
+        int depthWidth = ctx->width;
+        int depthHeight = ctx->height;
+        PlaneScratch& scratch = ctx->planeScratch;
+        std::vector<ResultPtr>& resultTiles = scratch.results;
+        Instrument& instrument = ctx->instrument;
+        StageScope coverageStage(instrument, InstrumentCoverageFilter);
+        size_t leafCount = resultTiles.size();
         float fullDiagonal = sqrt(depthWidth * depthWidth + depthHeight * depthHeight);
         for (auto itRes = resultTiles.begin(); itRes !=
             resultTiles.end();)
@@ -525,7 +1377,10 @@ extern "C"
                     pickX < res->r.Right() &&
                     pickY >= res->r.y &&
                     pickY <= res->r.Bottom())
+                {
                     res->isPicked = true;
+                    ctx->lastPickedId = res->r.GetUniqueId();
+                }
             }
             bool yorz = res->normal.y > res->normal.z;
             Pt xdir = Cross(res->normal, yorz ? Pt(0, 0, 1) : Pt(0, 1, 0));
@@ -544,7 +1399,7 @@ extern "C"
                 for (int j = i + 1; j < 4; ++j)
                 {
                     longestDiag = 
-                        max(longestDiag, (pts[i] - pts[j]).LengthSq());
+                        std::max(longestDiag, (pts[i] - pts[j]).LengthSq());
                 }
             }
 
@@ -564,38 +1419,272 @@ extern "C"
                 ++itRes;
 
         }
-        PopulateNeighbors(resultTiles);
+        for (int idx = 0; idx < (int)resultTiles.size(); ++idx)
+            resultTiles[idx]->index = idx;
+        if (instrument.Enabled())
+            instrument.Frame().coverageRejected += leafCount - resultTiles.size();
+        coverageStage.End();
+        std::vector<Result*>& groups = scratch.groups;
+        std::vector<size_t>& groupStarts = scratch.groupStarts;
+        if (unchanged)
+        {
+            // Same leaves, so the same neighbours and groups as last frame.
+            groupStarts = scratch.lastGroupStarts;
+            groups.resize(scratch.lastGroupTiles.size());
+            for (size_t idx = 0; idx < groups.size(); ++idx)
+                groups[idx] = resultTiles[scratch.lastGroupTiles[idx]];
+        }
+        else if (ctx->moveThreshold > 0 && ctx->neighborSearch == NeighborSearchGrid)
+        {
+            {
+                StageScope stage(instrument, InstrumentNeighbors);
+                UpdateTileLinks(resultTiles, ctx->constants, scratch, depthWidth, depthHeight);
+            }
+            {
+                StageScope stage(instrument, InstrumentMerge);
+                MergeTileLinks(resultTiles, scratch);
+            }
+            if (instrument.Enabled())
+            {
+                DepthInstrumentStats& stats = instrument.Frame();
+                stats.neighborEdges += scratch.tileLinks.size();
+                for (const TileLink& link : scratch.tileLinks)
+                    stats.samePlaneEdges += link.samePlane ? 1 : 0;
+            }
+        }
+        else
+        {
+            if (scratch.linksValid)
+            {
+                // The full search needs the edge grids empty.
+                std::fill(scratch.leftEdges.begin(), scratch.leftEdges.end(), -1);
+                std::fill(scratch.topEdges.begin(), scratch.topEdges.end(), -1);
+                scratch.linksValid = false;
+            }
+            FrameArena& arena = *scratch.arenas[0];
+            {
+                StageScope stage(instrument, InstrumentNeighbors);
+                if (ctx->neighborSearch == NeighborSearchSweep)
+                    PopulateNeighbors(resultTiles, arena);
+                else
+                    PopulateNeighborsGrid(resultTiles, arena, scratch, depthWidth, depthHeight);
+            }
+            {
+                StageScope stage(instrument, InstrumentMerge);
+                MergePlanes(resultTiles, ctx->constants, ctx->Pool(), scratch);
+            }
+            if (instrument.Enabled())
+            {
+                // Each edge is in both of its tiles' lists.
+                long long links = 0;
+                for (const ResultPtr& res : resultTiles)
+                {
+                    for (const Neighbor* link = res->neighbors; link != nullptr; link = link->next)
+                        links++;
+                }
+                DepthInstrumentStats& stats = instrument.Frame();
+                stats.neighborEdges += links / 2;
+                for (const std::vector<std::pair<int, int>>& sameLinks : scratch.workerLinks)
+                    stats.samePlaneEdges += sameLinks.size();
+            }
+        }
+        if (!unchanged && ctx->moveThreshold > 0)
+        {
+            scratch.lastGroupStarts = groupStarts;
+            scratch.lastGroupTiles.resize(groups.size());
+            for (size_t idx = 0; idx < groups.size(); ++idx)
+                scratch.lastGroupTiles[idx] = groups[idx]->index;
+        }
+        if (instrument.Enabled() && !groupStarts.empty())
+            instrument.Frame().mergedGroups += groupStarts.size() - 1;
+    }
+
+    // Fits and merges the frame's planes, leaving the merged groups in
+    // the context's scratch.groups and groupStarts. The caller emits them
+    // and ends the frame.
+    void BuildPlaneGroups(DepthContext* ctx, float* vals, int pickX, int pickY)
+    {
+        bool unchanged = FitPlaneTiles(ctx, vals);
+        GroupPlaneTiles(ctx, unchanged, pickX, pickY);
+    }
 
-        const int visitIdx = 1;
-        std::vector<std::vector<Result*>> outTiles;
-        for (ResultPtr& res : resultTiles)
+    // A tile, or a rectangle of tiles from one group, in the indexed mesh.
+    struct MeshQuad
+    {
+        Rect r;
+        Quad q;
+        Pt normal;
+    };
+
+    // Next to each other along x: the same rows, and b starts on a's last
+    // column or, where an odd width was split, one before it.
+    inline bool RowNeighbors(const MeshQuad& a, const MeshQuad& b)
+    {
+        return a.r.y == b.r.y && a.r.h == b.r.h &&
+            (b.r.x == a.r.Right() || b.r.x == a.r.Right() - 1);
+    }
+
+    inline bool ColumnNeighbors(const MeshQuad& a, const MeshQuad& b)
+    {
+        return a.r.x == b.r.x && a.r.w == b.r.w &&
+            (b.r.y == a.r.Bottom() || b.r.y == a.r.Bottom() - 1);
+    }
+
+    // Replaces runs of same-height tiles in a row, then runs of same-width
+    // tiles in a column, by one quad from the run's outer corners, until
+    // nothing merges. The union of a run is exactly its bounding
+    // rectangle, but the merged quad only keeps the end tiles' corners:
+    // corners inside the run, and the small plane differences between its
+    // separately fitted tiles, are dropped. So it covers the same pixels
+    // as the tiles, on a close approximation of their surface.
+    // Returns the new count.
+    size_t MergeMeshQuads(MeshQuad* quads, size_t count)
+    {
+        for (;;)
         {
-            if (res->visitCnt == visitIdx)
-                continue;
-            outTiles.push_back(std::vector<Result*>());
-            FindConnected(res.get(), 1, outTiles.back());
+            size_t before = count;
+            std::sort(quads, quads + count, [](const MeshQuad& a, const MeshQuad& b)
+                {
+                    return std::tie(a.r.y, a.r.h, a.r.x) < std::tie(b.r.y, b.r.h, b.r.x);
+                });
+            size_t out = 0;
+            for (size_t idx = 0; idx < count; ++idx)
+            {
+                if (out > 0 && RowNeighbors(quads[out - 1], quads[idx]))
+                {
+                    MeshQuad& run = quads[out - 1];
+                    run.r.w = quads[idx].r.Right() - run.r.x;
+                    for (int corner : { 1, 3 })
+                    {
+                        run.q.pt[corner] = quads[idx].q.pt[corner];
+                        run.q.pixel[corner] = quads[idx].q.pixel[corner];
+                    }
+                }
+                else
+                    quads[out++] = quads[idx];
+            }
+            count = out;
+
+            std::sort(quads, quads + count, [](const MeshQuad& a, const MeshQuad& b)
+                {
+                    return std::tie(a.r.x, a.r.w, a.r.y) < std::tie(b.r.x, b.r.w, b.r.y);
+                });
+            out = 0;
+            for (size_t idx = 0; idx < count; ++idx)
+            {
+                if (out > 0 && ColumnNeighbors(quads[out - 1], quads[idx]))
+                {
+                    MeshQuad& run = quads[out - 1];
+                    run.r.h = quads[idx].r.Bottom() - run.r.y;
+                    for (int corner : { 2, 3 })
+                    {
+                        run.q.pt[corner] = quads[idx].q.pt[corner];
+                        run.q.pixel[corner] = quads[idx].q.pixel[corner];
+                    }
+                }
+                else
+                    quads[out++] = quads[idx];
+            }
+            count = out;
+            if (count == before)
+                return count;
         }
+    }
 
+    // A tile's plane normal, facing the camera as PlaneDescriptor's do.
+    inline Pt FacingNormal(const Result* r)
+    {
+        return Dot(r->normal, r->pt0) > 0 ? r->normal * -1.0f : r->normal;
+    }
+
+    // Vertex for a quad corner of the current group: the one already made
+    // for its frame pixel, or a new one.
+    inline unsigned int WeldCorner(PlaneScratch& scratch, const MeshQuad& quad, int corner,
+        const VertexLayout& layout, const Pt& rgb, int& vertexCount)
+    {
+        int pixel = quad.q.pixel[corner];
+        if (scratch.weldStamps[pixel] != scratch.weldGeneration)
+        {
+            scratch.weldStamps[pixel] = scratch.weldGeneration;
+            scratch.weldVertices[pixel] = vertexCount;
+            WriteVertex(layout.position, vertexCount, 1, quad.q.pt[corner]);
+            WriteVertex(layout.color, vertexCount, 1, rgb);
+            WriteVertex(layout.normal, vertexCount, 0, quad.normal);
+            vertexCount++;
+        }
+        return (unsigned int)scratch.weldVertices[pixel];
+    }
+
+    // Appends a group's tiles, merged into rectangles, as two triangles
+    // each, welding corners within the group. A vertex gets the group's
+    // colour and the normal of a tile it is a corner of. Returns false,
+    // adding nothing, if they might not fit.
+    bool AddMeshGroup(PlaneScratch& scratch, Result* const* tiles, size_t tileCount,
+        const VertexLayout& layout, const Pt& rgb, int maxVertices, int& vertexCount,
+        unsigned int* outIndices, int maxIndices, int& indexCount)
+    {
+        MeshQuad* quads = scratch.arenas[0]->Allocate<MeshQuad>(tileCount);
+        for (size_t idx = 0; idx < tileCount; ++idx)
+        {
+            quads[idx].r = tiles[idx]->r;
+            quads[idx].q = tiles[idx]->q;
+            quads[idx].normal = FacingNormal(tiles[idx]);
+        }
+        size_t quadCount = MergeMeshQuads(quads, tileCount);
+        if (vertexCount + (long long)quadCount * 4 > maxVertices ||
+            indexCount + (long long)quadCount * 6 > maxIndices)
+            return false;
+        if (++scratch.weldGeneration == 0)
+        {
+            std::fill(scratch.weldStamps.begin(), scratch.weldStamps.end(), 0);
+            scratch.weldGeneration = 1;
+        }
+        for (size_t idx = 0; idx < quadCount; ++idx)
+        {
+            unsigned int v[4];
+            for (int corner = 0; corner < 4; ++corner)
+                v[corner] = WeldCorner(scratch, quads[idx], corner, layout, rgb, vertexCount);
+            unsigned int* tri = outIndices + indexCount;
+            tri[0] = v[0];
+            tri[1] = v[1];
+            tri[2] = v[2];
+            tri[3] = v[1];
+            tri[4] = v[3];
+            tri[5] = v[2];
+            indexCount += 6;
+        }
+        return true;
+    }
+
+    void EmitPlaneTriangles(DepthContext* ctx, const VertexLayout* layout, int maxCount, int* outCount)
+    {
+        StageScope stage(ctx->instrument, InstrumentOutput);
+        PlaneScratch& scratch = ctx->planeScratch;
+        std::vector<Result*>& groups = scratch.groups;
+        std::vector<size_t>& groupStarts = scratch.groupStarts;
         size_t vIdx = 0;
-        for (auto& itVec : outTiles)
+        scratch.groupColors.clear();
+        for (size_t group = 0; group + 1 < groupStarts.size(); ++group)
         {
-            Pt rgb((float)std::rand() / RAND_MAX,
-                (float)std::rand() / RAND_MAX,
-                (float)std::rand() / RAND_MAX);
+            Pt rgb(NextColor(ctx->colorSeed),
+                NextColor(ctx->colorSeed),
+                NextColor(ctx->colorSeed));
+            scratch.groupColors.push_back(rgb);
 
-            for (auto result : itVec)
+            for (size_t idx = groupStarts[group]; idx < groupStarts[group + 1]; ++idx)
             {
-                Quad& q = result->q;
-                outVertices[vIdx] = q.pt[0];
-                outVertices[vIdx + 1] = q.pt[1];
-                outVertices[vIdx + 2] = q.pt[2];
-                outVertices[vIdx + 3] = q.pt[1];
-                outVertices[vIdx + 4] = q.pt[3];
-                outVertices[vIdx + 5] = q.pt[2];
-                for (size_t idx = 0; idx < 6; ++idx)
+                if (vIdx + 6 > (size_t)maxCount)
+                    break;
+                Result* result = groups[idx];
+                const Quad& q = result->q;
+                static const int corners[6] = { 0, 1, 2, 1, 3, 2 };
+                WriteVertices(layout->position, vIdx, 6, 1, [&](int i) { return q.pt[corners[i]]; });
+                Pt color = result->isPicked ? Pt(1, 1, 1) : rgb;
+                WriteVertices(layout->color, vIdx, 6, 1, [&](int) { return color; });
+                if (layout->normal.data != nullptr)
                 {
-                    outTexCoords[vIdx + idx] = result->isPicked ? Pt(1, 1, 1) :
-                        rgb;
+                    Pt normal = FacingNormal(result);
+                    WriteVertices(layout->normal, vIdx, 6, 0, [&](int) { return normal; });
                 }
 
                 vIdx += 6;
@@ -603,5 +1692,295 @@ extern "C"
             }
         }
         *outCount = vIdx;
+        scratch.EndFrame();
+        stage.End();
+        ctx->instrument.EndFrame();
+    }
+
+    DEXPORT void DepthMakePlanesLayoutCtx(DepthContext* ctx, float* vals, const VertexLayout* layout, int maxCount,
+        int* outCount, int pickX, int pickY)
+    {
+        BuildPlaneGroups(ctx, vals, pickX, pickY);
+        EmitPlaneTriangles(ctx, layout, maxCount, outCount);
+    }
+
+    DEXPORT void DepthMakePlanesCtx(DepthContext* ctx, float* vals, Pt* outVertices, Pt* outTexCoords, int maxCount, int* outCount,
+        int pickX, int pickY)
+    {
+        VertexLayout layout = PtLayout(outVertices, outTexCoords, nullptr);
+        DepthMakePlanesLayoutCtx(ctx, vals, &layout, maxCount, outCount, pickX, pickY);
+    }
+
+    DEXPORT void DepthMakePlaneMeshLayoutCtx(DepthContext* ctx, float* vals,
+        const VertexLayout* layout, int maxVertices, int* outVertexCount,
+        unsigned int* outIndices, int maxIndices, int* outIndexCount,
+        Pt* outGroupColors, int* outGroupIndexStarts, int maxGroups, int* outGroupCount,
+        int pickX, int pickY)
+    {
+        BuildPlaneGroups(ctx, vals, pickX, pickY);
+        StageScope stage(ctx->instrument, InstrumentOutput);
+        PlaneScratch& scratch = ctx->planeScratch;
+        std::vector<Result*>& groups = scratch.groups;
+        std::vector<size_t>& groupStarts = scratch.groupStarts;
+        size_t numPts = (size_t)ctx->width * ctx->height;
+        if (scratch.weldStamps.size() != numPts)
+        {
+            scratch.weldStamps.assign(numPts, 0);
+            scratch.weldVertices.resize(numPts);
+            scratch.allocations += 2;
+        }
+
+        int vertexCount = 0;
+        int indexCount = 0;
+        int groupCount = 0;
+        Result* picked = nullptr;
+        outGroupIndexStarts[0] = 0;
+        scratch.groupColors.clear();
+        for (size_t group = 0; group + 1 < groupStarts.size(); ++group)
+        {
+            // Drawn in the same colours as DepthMakePlanesCtx.
+            Pt rgb(NextColor(ctx->colorSeed),
+                NextColor(ctx->colorSeed),
+                NextColor(ctx->colorSeed));
+            scratch.groupColors.push_back(rgb);
+            Result** tiles = groups.data() + groupStarts[group];
+            size_t tileCount = groupStarts[group + 1] - groupStarts[group];
+            // The picked tile is left out and drawn on its own in white.
+            for (size_t idx = 0; idx < tileCount; ++idx)
+            {
+                if (tiles[idx]->isPicked)
+                {
+                    picked = tiles[idx];
+                    std::swap(tiles[idx], tiles[--tileCount]);
+                    break;
+                }
+            }
+            // Groups after one that does not fit may still, and the rest
+            // still need searching for the picked tile.
+            if (tileCount == 0 || groupCount == maxGroups ||
+                !AddMeshGroup(scratch, tiles, tileCount, *layout, rgb, maxVertices, vertexCount,
+                    outIndices, maxIndices, indexCount))
+                continue;
+            outGroupColors[groupCount] = rgb;
+            outGroupIndexStarts[++groupCount] = indexCount;
+        }
+        if (picked != nullptr && groupCount < maxGroups &&
+            AddMeshGroup(scratch, &picked, 1, *layout, Pt(1, 1, 1), maxVertices, vertexCount,
+                outIndices, maxIndices, indexCount))
+        {
+            outGroupColors[groupCount] = Pt(1, 1, 1);
+            outGroupIndexStarts[++groupCount] = indexCount;
+        }
+        *outVertexCount = vertexCount;
+        *outIndexCount = indexCount;
+        *outGroupCount = groupCount;
+        scratch.EndFrame();
+        stage.End();
+        ctx->instrument.EndFrame();
+    }
+
+    DEXPORT void DepthMakePlaneMeshCtx(DepthContext* ctx, float* vals,
+        Pt* outVertices, int maxVertices, int* outVertexCount,
+        unsigned int* outIndices, int maxIndices, int* outIndexCount,
+        Pt* outGroupColors, int* outGroupIndexStarts, int maxGroups, int* outGroupCount,
+        int pickX, int pickY)
+    {
+        VertexLayout layout = PtLayout(outVertices, nullptr, nullptr);
+        DepthMakePlaneMeshLayoutCtx(ctx, vals, &layout, maxVertices, outVertexCount, outIndices, maxIndices,
+            outIndexCount, outGroupColors, outGroupIndexStarts, maxGroups, outGroupCount, pickX, pickY);
+    }
+
+    // Area of a tile's quad, drawn as triangles (0, 1, 2) and (1, 3, 2).
+    float QuadArea(const Quad& q)
+    {
+        Pt a = Cross(q.pt[1] - q.pt[0], q.pt[2] - q.pt[0]);
+        Pt b = Cross(q.pt[3] - q.pt[1], q.pt[2] - q.pt[1]);
+        return 0.5f * (a.Length() + b.Length());
+    }
+
+    DEXPORT void DepthDescribePlanesCtx(DepthContext* ctx, float* vals, PlaneDescriptor* outPlanes,
+        int maxPlanes, int* outPlaneCount, PlaneTile* outTiles, int maxTiles, int* outTileCount)
+    {
+        PlaneScratch& scratch = ctx->planeScratch;
+        const std::vector<Result*>& groups = scratch.groups;
+        const std::vector<size_t>& groupStarts = scratch.groupStarts;
+        const Pt* pts = (const Pt*)vals;
+        int width = ctx->width;
+        int height = ctx->height;
+
+        // Point moments of every tile. Tiles share their last row and
+        // column with their right and bottom neighbours, so leave it out.
+        // Moments fitting has a table for these points already; otherwise
+        // the tiles are summed directly, which only reads the pixels they
+        // cover.
+        Moments* tileMoments = scratch.arenas[0]->Allocate<Moments>(groups.size());
+        if (ctx->planeFit == PlaneFitMoments)
+        {
+            for (size_t idx = 0; idx < groups.size(); ++idx)
+            {
+                const Rect& r = groups[idx]->r;
+                tileMoments[idx] = ctx->moments.Sum(r.x, r.y, r.Right(), r.Bottom());
+            }
+        }
+        else
+        {
+            ThreadPool& pool = ctx->Pool();
+            int workerCount = pool.ThreadCount();
+            pool.Run(workerCount, [&](int worker)
+                {
+                    for (size_t idx = worker; idx < groups.size(); idx += workerCount)
+                    {
+                        const Rect& r = groups[idx]->r;
+                        tileMoments[idx] = SumMoments(pts, width, r.x, r.y,
+                            std::min(width, r.Right()), std::min(height, r.Bottom()));
+                    }
+                });
+        }
+
+        int planeCount = 0;
+        int tileCount = 0;
+        for (size_t group = 0; group + 1 < groupStarts.size(); ++group)
+        {
+            size_t first = groupStarts[group];
+            int groupTiles = (int)(groupStarts[group + 1] - first);
+            if (planeCount == maxPlanes || tileCount + groupTiles > maxTiles)
+                break;
+
+            Moments m = Moments();
+            float area = 0;
+            for (int idx = 0; idx < groupTiles; ++idx)
+            {
+                Result* tile = groups[first + idx];
+                m += tileMoments[first + idx];
+                area += QuadArea(tile->q);
+                outTiles[tileCount + idx] = PlaneTile{ tile->r.x, tile->r.y, tile->r.w, tile->r.h };
+            }
+            Pt centroid, normal;
+            float rmsDist;
+            if (!FitPlane(m, centroid, normal, rmsDist))
+            {
+                centroid = groups[first]->pt0;
+                normal = groups[first]->normal;
+                rmsDist = groups[first]->maxDistFound;
+            }
+            if (Dot(normal, centroid) > 0)
+                normal *= -1.0f;
+
+            Pt axisU, axisV;
+            PlaneAxes(normal, axisU, axisV);
+            float extentMin[2] = { INFINITY, INFINITY };
+            float extentMax[2] = { -INFINITY, -INFINITY };
+            for (int idx = 0; idx < groupTiles; ++idx)
+            {
+                const Quad& q = groups[first + idx]->q;
+                for (int corner = 0; corner < 4; ++corner)
+                {
+                    Pt rel = q.pt[corner] - centroid;
+                    float u = Dot(rel, axisU), v = Dot(rel, axisV);
+                    extentMin[0] = std::min(extentMin[0], u);
+                    extentMax[0] = std::max(extentMax[0], u);
+                    extentMin[1] = std::min(extentMin[1], v);
+                    extentMax[1] = std::max(extentMax[1], v);
+                }
+            }
+
+            PlaneDescriptor& plane = outPlanes[planeCount++];
+            StorePt(normal, plane.normal);
+            plane.offset = -Dot(normal, centroid);
+            StorePt(centroid, plane.centroid);
+            plane.rmsDist = rmsDist;
+            plane.area = area;
+            plane.inlierCount = (int)m.n;
+            StorePt(axisU, plane.axisU);
+            StorePt(axisV, plane.axisV);
+            for (int axis = 0; axis < 2; ++axis)
+            {
+                plane.extentMin[axis] = extentMin[axis];
+                plane.extentMax[axis] = extentMax[axis];
+            }
+            plane.firstTile = tileCount;
+            plane.tileCount = groupTiles;
+            StorePt(group < scratch.groupColors.size() ? scratch.groupColors[group] : Pt(1, 1, 1),
+                plane.color);
+            tileCount += groupTiles;
+        }
+        *outPlaneCount = planeCount;
+        *outTileCount = tileCount;
+    }
+
+    DEXPORT void DepthPlaneNeighborsCtx(DepthContext* ctx, float* vals, int* outPairs, int maxPairs,
+        int* outPairCount)
+    {
+        // Searched even when an unchanged tree could reuse last frame's groups.
+        FitPlaneTiles(ctx, vals);
+        GroupPlaneTiles(ctx, false, -1, -1);
+        PlaneScratch& scratch = ctx->planeScratch;
+        int pairCount = 0;
+        auto addPair = [&](const Result& first, const Result& second)
+            {
+                if (pairCount < maxPairs)
+                {
+                    int a = first.r.y * ctx->width + first.r.x;
+                    int b = second.r.y * ctx->width + second.r.x;
+                    outPairs[pairCount * 2] = std::min(a, b);
+                    outPairs[pairCount * 2 + 1] = std::max(a, b);
+                }
+                pairCount++;
+            };
+        // The incremental search keeps pairs instead of neighbour lists.
+        if (scratch.linksValid)
+        {
+            for (const TileLink& link : scratch.tileLinks)
+            {
+                addPair(*scratch.results[scratch.slotTiles[link.a]],
+                    *scratch.results[scratch.slotTiles[link.b]]);
+            }
+        }
+        for (const ResultPtr& res : scratch.results)
+        {
+            for (const Neighbor* link = res->neighbors; link != nullptr; link = link->next)
+            {
+                if (link->other->index >= res->index)
+                    addPair(*res, *link->other);
+            }
+        }
+        *outPairCount = pairCount;
+        scratch.EndFrame();
+        ctx->instrument.EndFrame();
+    }
+
+    DEXPORT void DepthMakePlanes(float* vals, Pt* outVertices, Pt* outTexCoords, int maxCount, int* outCount,
+        int pickX, int pickY,
+        int depthWidth, int depthHeight)
+    {
+        DepthMakePlanesCtx(GetDefaultContext(depthWidth, depthHeight), vals, outVertices, outTexCoords,
+            maxCount, outCount, pickX, pickY);
+    }
+
+    DEXPORT void DepthMakePlaneMesh(float* vals, Pt* outVertices, int maxVertices, int* outVertexCount,
+        unsigned int* outIndices, int maxIndices, int* outIndexCount,
+        Pt* outGroupColors, int* outGroupIndexStarts, int maxGroups, int* outGroupCount,
+        int pickX, int pickY, int depthWidth, int depthHeight)
+    {
+        DepthMakePlaneMeshCtx(GetDefaultContext(depthWidth, depthHeight), vals, outVertices, maxVertices,
+            outVertexCount, outIndices, maxIndices, outIndexCount, outGroupColors, outGroupIndexStarts,
+            maxGroups, outGroupCount, pickX, pickY);
+    }
+
+    DEXPORT void DepthMakePlanesLayout(float* vals, const VertexLayout* layout, int maxCount, int* outCount,
+        int pickX, int pickY, int depthWidth, int depthHeight)
+    {
+        DepthMakePlanesLayoutCtx(GetDefaultContext(depthWidth, depthHeight), vals, layout, maxCount, outCount,
+            pickX, pickY);
+    }
+
+    DEXPORT void DepthMakePlaneMeshLayout(float* vals, const VertexLayout* layout, int maxVertices,
+        int* outVertexCount, unsigned int* outIndices, int maxIndices, int* outIndexCount,
+        Pt* outGroupColors, int* outGroupIndexStarts, int maxGroups, int* outGroupCount,
+        int pickX, int pickY, int depthWidth, int depthHeight)
+    {
+        DepthMakePlaneMeshLayoutCtx(GetDefaultContext(depthWidth, depthHeight), vals, layout, maxVertices,
+            outVertexCount, outIndices, maxIndices, outIndexCount, outGroupColors, outGroupIndexStarts,
+            maxGroups, outGroupCount, pickX, pickY);
     }
 }
\ No newline at end of file
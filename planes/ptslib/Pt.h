@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cmath>
+
 const int badval = -0xFFFF;
 
 struct DXY
@@ -10,12 +12,12 @@ struct DXY
     DXY() : dx(0), dy(0) {}
     DXY(int _dx, int _dy) : dx(_dx), dy(_dy) {}
 
-    bool IsValid()
+    bool IsValid() const
     {
         return dx != badval && dy != badval;
     }
 
-    int LengthSq() { return dx * dx + dy * dy; }
+    int LengthSq() const { return dx * dx + dy * dy; }
 };
 
 inline DXY operator - (const DXY& lhs, const DXY& rhs)
@@ -59,7 +61,7 @@ struct Pt
 
     inline bool IsValid()
     {
-        return !isinf(x) && (x != 0 && y != 0 && x != 0);
+        return !std::isinf(x) && (x != 0 && y != 0 && x != 0);
     }
 
     float Length()
@@ -109,3 +111,10 @@ inline float Dot(const Pt& lhs, const Pt& rhs)
         lhs.z * rhs.z;
 }
 
+inline void StorePt(const Pt& pt, float* out)
+{
+    out[0] = pt.x;
+    out[1] = pt.y;
+    out[2] = pt.z;
+}
+
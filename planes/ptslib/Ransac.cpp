@@ -0,0 +1,413 @@
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "Context.h"
+#include "Ransac.h"
+#include "Simd.h"
+#include "ptslib.h"
+
+namespace
+{
+    // Hypotheses drawn and scored together; the adaptive iteration count
+    // is checked between batches.
+    const int hypothesesPerBatch = 32;
+    // Points each hypothesis is scored on.
+    const int scoreSampleCount = 1024;
+    // The second and third points of a sample are drawn from this many
+    // pixels around the first.
+    const int sampleRadius = 12;
+    // Fixed split of the rows while gathering and of the points while
+    // refitting, so moments are summed in the same order whatever the
+    // thread count.
+    const int bandCount = 16;
+
+    // xorshift32; state must not be 0.
+    unsigned int NextRand(unsigned int& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    bool HasNormal(const Pt& nrm)
+    {
+        // FindNormalsRow writes 0 where a neighbour is invalid; NaN fails too.
+        return Dot(nrm, nrm) > 0.5f;
+    }
+
+    // Every valid point with a normal, in pixel order. Each band of rows
+    // is counted, then copied to where the bands before it end.
+    void GatherPoints(const Pt* pts, const Pt* normals, int width, int height, ThreadPool& pool,
+        RansacScratch& s)
+    {
+        auto bandRow = [&](int band) { return 1 + (height - 2) * band / bandCount; };
+        s.bandStarts.assign(bandCount + 1, 0);
+        pool.Run(bandCount, [&](int band)
+            {
+                size_t count = 0;
+                for (int y = bandRow(band); y < bandRow(band + 1); ++y)
+                {
+                    for (int idx = y * width + 1; idx < (y + 1) * width - 1; ++idx)
+                    {
+                        Pt pt = pts[idx];
+                        count += pt.IsValid() && HasNormal(normals[idx]);
+                    }
+                }
+                s.bandStarts[band + 1] = count;
+            });
+        for (int band = 0; band < bandCount; ++band)
+            s.bandStarts[band + 1] += s.bandStarts[band];
+
+        size_t count = s.bandStarts[bandCount];
+        std::vector<float>* lists[] = { &s.x, &s.y, &s.z, &s.nx, &s.ny, &s.nz, &s.area };
+        for (std::vector<float>* list : lists)
+            list->resize(count);
+        s.pixel.resize(count);
+        pool.Run(bandCount, [&](int band)
+            {
+                size_t out = s.bandStarts[band];
+                for (int y = bandRow(band); y < bandRow(band + 1); ++y)
+                {
+                    for (int idx = y * width + 1; idx < (y + 1) * width - 1; ++idx)
+                    {
+                        Pt pt = pts[idx];
+                        const Pt& nrm = normals[idx];
+                        if (!pt.IsValid() || !HasNormal(nrm))
+                            continue;
+                        // The normal needed all four neighbours, so these are valid.
+                        Pt footprint = Cross(pts[idx + 1] - pt, pts[idx + width] - pt);
+                        s.x[out] = pt.x;
+                        s.y[out] = pt.y;
+                        s.z[out] = pt.z;
+                        s.nx[out] = nrm.x;
+                        s.ny[out] = nrm.y;
+                        s.nz[out] = nrm.z;
+                        s.pixel[out] = idx;
+                        s.area[out] = footprint.Length();
+                        out++;
+                    }
+                }
+            });
+    }
+
+    // Drops the points taken by a plane, whose x was set to NaN.
+    void CompactPoints(RansacScratch& s)
+    {
+        size_t kept = 0;
+        for (size_t idx = 0; idx < s.x.size(); ++idx)
+        {
+            if (std::isnan(s.x[idx]))
+                continue;
+            s.x[kept] = s.x[idx];
+            s.y[kept] = s.y[idx];
+            s.z[kept] = s.z[idx];
+            s.nx[kept] = s.nx[idx];
+            s.ny[kept] = s.ny[idx];
+            s.nz[kept] = s.nz[idx];
+            s.pixel[kept] = s.pixel[idx];
+            s.area[kept] = s.area[idx];
+            kept++;
+        }
+        std::vector<float>* lists[] = { &s.x, &s.y, &s.z, &s.nx, &s.ny, &s.nz, &s.area };
+        for (std::vector<float>* list : lists)
+            list->resize(kept);
+        s.pixel.resize(kept);
+    }
+
+    // Copies up to scoreSampleCount of the remaining points, evenly
+    // spaced, to the scoring lists and returns how many.
+    int GatherScoreSample(RansacScratch& s, size_t remaining)
+    {
+        size_t count = s.x.size();
+        size_t picks = std::min(count, (size_t)scoreSampleCount * count / remaining);
+        std::vector<float>* lists[] = { &s.sx, &s.sy, &s.sz, &s.snx, &s.sny, &s.snz };
+        for (std::vector<float>* list : lists)
+            list->assign(((size_t)scoreSampleCount + 7) & ~(size_t)7, NAN);
+        int sampleCount = 0;
+        for (size_t pick = 0; pick < picks && sampleCount < scoreSampleCount; ++pick)
+        {
+            size_t src = pick * count / picks;
+            if (std::isnan(s.x[src]))
+                continue;
+            s.sx[sampleCount] = s.x[src];
+            s.sy[sampleCount] = s.y[src];
+            s.sz[sampleCount] = s.z[src];
+            s.snx[sampleCount] = s.nx[src];
+            s.sny[sampleCount] = s.ny[src];
+            s.snz[sampleCount] = s.nz[src];
+            sampleCount++;
+        }
+        for (std::vector<float>* list : lists)
+            list->resize(((size_t)sampleCount + 7) & ~(size_t)7);
+        return sampleCount;
+    }
+
+    // Plane through a random unassigned point and two more drawn from the
+    // pixels around it, which are likely on the same surface. False if
+    // those are assigned or invalid, the three are nearly collinear, or
+    // any of their normals is more than minDot away from the plane's.
+    bool DrawHypothesis(const RansacScratch& s, const Pt* pts, const Pt* normals, int width, int height,
+        unsigned int seed, float minDot, RansacHypothesis& hyp)
+    {
+        unsigned int rnd = seed != 0 ? seed : 1;
+        NextRand(rnd);
+        int pixel[3];
+        pixel[0] = s.pixel[NextRand(rnd) % s.pixel.size()];
+        if (s.labels[pixel[0]] >= 0)
+            return false;
+        int x0 = pixel[0] % width, y0 = pixel[0] / width;
+        for (int idx = 1; idx < 3; ++idx)
+        {
+            int x = x0 + (int)(NextRand(rnd) % (2 * sampleRadius + 1)) - sampleRadius;
+            int y = y0 + (int)(NextRand(rnd) % (2 * sampleRadius + 1)) - sampleRadius;
+            if (x < 0 || x >= width || y < 0 || y >= height)
+                return false;
+            pixel[idx] = y * width + x;
+            Pt pt = pts[pixel[idx]];
+            if (s.labels[pixel[idx]] >= 0 || !pt.IsValid() || !HasNormal(normals[pixel[idx]]))
+                return false;
+        }
+
+        Pt e1 = pts[pixel[1]] - pts[pixel[0]];
+        Pt e2 = pts[pixel[2]] - pts[pixel[0]];
+        Pt normal = Cross(e1, e2);
+        float lenSq = normal.LengthSq();
+        if (!(lenSq > 1e-6f * e1.LengthSq() * e2.LengthSq()))
+            return false;
+        normal *= 1.0f / sqrtf(lenSq);
+        for (int idx = 0; idx < 3; ++idx)
+        {
+            if (!(fabsf(Dot(normal, normals[pixel[idx]])) > minDot))
+                return false;
+        }
+        hyp.normal = normal;
+        hyp.offset = -Dot(normal, pts[pixel[0]]);
+        return true;
+    }
+
+    // Lanes closer than maxDist to the plane whose normal is within minDot
+    // of its normal.
+    inline simd::F8 InlierMask(const float* x, const float* y, const float* z,
+        const float* nx, const float* ny, const float* nz,
+        simd::F8 a, simd::F8 b, simd::F8 c, simd::F8 d, simd::F8 maxDist, simd::F8 minDot)
+    {
+        using namespace simd;
+        F8 dist = Abs(Load(x) * a + Load(y) * b + Load(z) * c + d);
+        F8 dot = Abs(Load(nx) * a + Load(ny) * b + Load(nz) * c);
+        return CmpGt(maxDist, dist) & CmpGt(dot, minDot);
+    }
+
+    // Inliers of a hypothesis among the scoring points.
+    int ScoreHypothesis(const RansacScratch& s, const RansacHypothesis& hyp, float maxDist, float minDot)
+    {
+        using namespace simd;
+        F8 a = Set1(hyp.normal.x), b = Set1(hyp.normal.y), c = Set1(hyp.normal.z);
+        F8 d = Set1(hyp.offset);
+        F8 vMaxDist = Set1(maxDist), vMinDot = Set1(minDot);
+        F8 zero = Set1(0), one = Set1(1);
+        F8 vCount = zero;
+        for (size_t idx = 0; idx < s.sx.size(); idx += 8)
+        {
+            F8 inlier = InlierMask(&s.sx[idx], &s.sy[idx], &s.sz[idx], &s.snx[idx], &s.sny[idx], &s.snz[idx],
+                a, b, c, d, vMaxDist, vMinDot);
+            vCount = vCount + Select(inlier, one, zero);
+        }
+        return (int)HSum(vCount);
+    }
+
+    // Moments of the inliers of the plane among points [first, last) of
+    // the lists, and if inliers is not null, a flag per point there.
+    Moments AddInliers(const float* x, const float* y, const float* z,
+        const float* nx, const float* ny, const float* nz, size_t first, size_t last,
+        const Pt& normal, float offset, float maxDist, float minDot, unsigned char* inliers)
+    {
+        using namespace simd;
+        F8 a = Set1(normal.x), b = Set1(normal.y), c = Set1(normal.z);
+        F8 d = Set1(offset);
+        F8 vMaxDist = Set1(maxDist), vMinDot = Set1(minDot);
+        Moments m = Moments();
+        size_t idx = first;
+        for (; idx + 8 <= last; idx += 8)
+        {
+            int bits = MoveMask(InlierMask(x + idx, y + idx, z + idx, nx + idx, ny + idx, nz + idx,
+                a, b, c, d, vMaxDist, vMinDot));
+            if (inliers != nullptr)
+            {
+                for (int lane = 0; lane < 8; ++lane)
+                    inliers[idx + lane] = (bits >> lane) & 1;
+            }
+            for (int lane = 0; bits != 0; ++lane, bits >>= 1)
+            {
+                if (bits & 1)
+                    m.Add(Pt(x[idx + lane], y[idx + lane], z[idx + lane]));
+            }
+        }
+        for (; idx < last; ++idx)
+        {
+            float dist = fabsf(x[idx] * normal.x + y[idx] * normal.y + z[idx] * normal.z + offset);
+            float dot = fabsf(nx[idx] * normal.x + ny[idx] * normal.y + nz[idx] * normal.z);
+            bool inlier = maxDist > dist && dot > minDot;
+            if (inliers != nullptr)
+                inliers[idx] = inlier;
+            if (inlier)
+                m.Add(Pt(x[idx], y[idx], z[idx]));
+        }
+        return m;
+    }
+
+    // Moments of every remaining inlier of the plane, flagged in s.inliers.
+    Moments MarkInliers(RansacScratch& s, ThreadPool& pool, const Pt& normal, float offset,
+        float maxDist, float minDot)
+    {
+        size_t count = s.x.size();
+        s.inliers.resize(count);
+        pool.Run(bandCount, [&](int band)
+            {
+                s.bandMoments[band] = AddInliers(s.x.data(), s.y.data(), s.z.data(),
+                    s.nx.data(), s.ny.data(), s.nz.data(), count * band / bandCount,
+                    count * (band + 1) / bandCount, normal, offset, maxDist, minDot, s.inliers.data());
+            });
+        Moments sum = Moments();
+        for (const Moments& m : s.bandMoments)
+            sum += m;
+        return sum;
+    }
+}
+
+extern "C"
+{
+    DEXPORT void DepthRansacPlanesCtx(DepthContext* ctx, float* vals, PlaneDescriptor* outPlanes,
+        int maxPlanes, int* outPlaneCount, int* outLabels)
+    {
+        RansacScratch& s = ctx->ransacScratch;
+        const RansacParams& params = ctx->ransac;
+        const Pt* pts = (const Pt*)vals;
+        const Pt* normals = ctx->normals.data();
+        int width = ctx->width;
+        int height = ctx->height;
+        float maxDist = params.inlierDist;
+        float sampleMinDot = ctx->constants.minDPVal;
+        float minDot = params.inlierMinDot;
+        ThreadPool& pool = ctx->Pool();
+        int workerCount = pool.ThreadCount();
+
+        s.labels.assign((size_t)width * height, -1);
+        s.hypotheses.resize(hypothesesPerBatch);
+        s.bandMoments.resize(bandCount);
+        GatherPoints(pts, normals, width, height, pool, s);
+
+        // Points a plane takes are set to NaN, which is never an inlier,
+        // and only dropped from the lists once they are half of them.
+        size_t remaining = s.x.size();
+        // Colours depend only on the plane's index.
+        unsigned int colorSeed = 1;
+        int planeCount = 0;
+        while (planeCount < maxPlanes && remaining >= (size_t)std::max(3, params.minInliers))
+        {
+            int sampleCount = GatherScoreSample(s, remaining);
+
+            // Batches of hypotheses until, at the best inlier ratio found,
+            // an all-inlier sample has been drawn with the requested
+            // confidence. Each hypothesis is seeded by its plane and index,
+            // so the result does not depend on the thread count.
+            RansacHypothesis best = RansacHypothesis();
+            int iterations = 0;
+            double needed = params.maxIterations;
+            while (iterations < std::min(needed, (double)params.maxIterations))
+            {
+                int batchStart = iterations;
+                pool.Run(workerCount, [&](int worker)
+                    {
+                        for (int idx = worker; idx < hypothesesPerBatch; idx += workerCount)
+                        {
+                            RansacHypothesis& hyp = s.hypotheses[idx];
+                            unsigned int seed = (unsigned int)(planeCount + 1) * 0x9E3779B9u ^
+                                (unsigned int)(batchStart + idx + 1) * 0x85EBCA6Bu;
+                            hyp.score = 0;
+                            if (DrawHypothesis(s, pts, normals, width, height, seed, sampleMinDot, hyp))
+                                hyp.score = ScoreHypothesis(s, hyp, maxDist, minDot);
+                        }
+                    });
+                for (const RansacHypothesis& hyp : s.hypotheses)
+                {
+                    if (hyp.score > best.score)
+                        best = hyp;
+                }
+                iterations += hypothesesPerBatch;
+
+                double ratio = (double)best.score / sampleCount;
+                double allInliers = ratio * ratio * ratio;
+                if (allInliers >= 1)
+                    needed = 0;
+                else if (allInliers > 0)
+                    needed = log(1.0 - params.confidence) / log(1.0 - allInliers);
+            }
+            // Nothing left that could make a big enough plane.
+            if (best.score == 0 || (double)best.score * remaining / sampleCount < params.minInliers)
+                break;
+
+            // Refit to the hypothesis' inliers among the scoring points,
+            // then take every inlier of that least-squares plane and fit
+            // them again.
+            Pt centroid, normal;
+            float rmsDist;
+            Moments m = AddInliers(s.sx.data(), s.sy.data(), s.sz.data(), s.snx.data(), s.sny.data(),
+                s.snz.data(), 0, s.sx.size(), best.normal, best.offset, maxDist, minDot, nullptr);
+            if (!FitPlane(m, centroid, normal, rmsDist))
+                break;
+            m = MarkInliers(s, pool, normal, -Dot(normal, centroid), maxDist, minDot);
+            if (m.n < params.minInliers || !FitPlane(m, centroid, normal, rmsDist))
+                break;
+            if (Dot(normal, centroid) > 0)
+                normal *= -1.0f;
+
+            // Label the inliers and take them out of the remaining points.
+            Pt axisU, axisV;
+            PlaneAxes(normal, axisU, axisV);
+            float extentMin[2] = { INFINITY, INFINITY };
+            float extentMax[2] = { -INFINITY, -INFINITY };
+            float area = 0;
+            for (size_t idx = 0; idx < s.x.size(); ++idx)
+            {
+                if (!s.inliers[idx])
+                    continue;
+                Pt rel = Pt(s.x[idx], s.y[idx], s.z[idx]) - centroid;
+                float u = Dot(rel, axisU), v = Dot(rel, axisV);
+                extentMin[0] = std::min(extentMin[0], u);
+                extentMax[0] = std::max(extentMax[0], u);
+                extentMin[1] = std::min(extentMin[1], v);
+                extentMax[1] = std::max(extentMax[1], v);
+                area += s.area[idx];
+                s.labels[s.pixel[idx]] = planeCount;
+                s.x[idx] = NAN;
+            }
+            remaining -= (size_t)m.n;
+            if (remaining * 2 < s.x.size())
+                CompactPoints(s);
+
+            PlaneDescriptor& plane = outPlanes[planeCount++];
+            StorePt(normal, plane.normal);
+            plane.offset = -Dot(normal, centroid);
+            StorePt(centroid, plane.centroid);
+            plane.rmsDist = rmsDist;
+            plane.area = area;
+            plane.inlierCount = (int)m.n;
+            StorePt(axisU, plane.axisU);
+            StorePt(axisV, plane.axisV);
+            for (int axis = 0; axis < 2; ++axis)
+            {
+                plane.extentMin[axis] = extentMin[axis];
+                plane.extentMax[axis] = extentMax[axis];
+            }
+            plane.firstTile = 0;
+            plane.tileCount = 0;
+            Pt rgb(NextColor(colorSeed), NextColor(colorSeed), NextColor(colorSeed));
+            StorePt(rgb, plane.color);
+        }
+        *outPlaneCount = planeCount;
+        if (outLabels != nullptr)
+            memcpy(outLabels, s.labels.data(), s.labels.size() * sizeof(int));
+    }
+}
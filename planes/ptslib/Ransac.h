@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include "Moments.h"
+#include "Pt.h"
+
+struct RansacParams
+{
+    RansacParams() :
+        inlierDist(0.02f),
+        inlierMinDot(0.7f),
+        minInliers(2000),
+        maxIterations(1000),
+        confidence(0.99f)
+    {
+    }
+
+    // Max point-to-plane distance of an inlier, in metres.
+    float inlierDist;
+    // Min |dot| between an inlier's normal and the plane's. Looser than
+    // the minDPVal the sample points are held to, since single-pixel
+    // normals are much noisier than their points.
+    float inlierMinDot;
+    // Planes with fewer inliers end the extraction.
+    int minInliers;
+    // Hypotheses drawn per plane at most, however few inliers the best
+    // one has.
+    int maxIterations;
+    // Probability of having drawn at least one all-inlier sample that the
+    // adaptive iteration count aims for.
+    float confidence;
+};
+
+// A candidate plane, dot(normal, p) + offset = 0, and the scoring points
+// it explains.
+struct RansacHypothesis
+{
+    Pt normal;
+    float offset;
+    int score;
+};
+
+// DepthRansacPlanesCtx storage kept from frame to frame.
+struct RansacScratch
+{
+    // Points with a normal not yet assigned to a plane, in pixel order,
+    // one list per coordinate for the vector loads: position, unit
+    // normal, frame pixel and the area of the pixel's footprint.
+    std::vector<float> x, y, z;
+    std::vector<float> nx, ny, nz;
+    std::vector<int> pixel;
+    std::vector<float> area;
+    // The points hypotheses are scored on, spread evenly over those left
+    // and padded to a multiple of 8 with NaN, which never scores.
+    std::vector<float> sx, sy, sz;
+    std::vector<float> snx, sny, snz;
+    std::vector<RansacHypothesis> hypotheses;
+    // Plane each frame pixel was assigned to, -1 for none.
+    std::vector<int> labels;
+    // Per point, whether it is an inlier of the plane being extracted.
+    std::vector<unsigned char> inliers;
+    // Per band of the split: its first point, and the moments of its
+    // inliers.
+    std::vector<size_t> bandStarts;
+    std::vector<Moments> bandMoments;
+};
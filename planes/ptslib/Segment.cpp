@@ -0,0 +1,226 @@
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include "Context.h"
+#include "Segment.h"
+#include "ptslib.h"
+
+namespace
+{
+    // A region starts from its seed's point and normal, and its plane is
+    // refit from its moments each time it doubles.
+    const int firstRefitPoints = 32;
+
+    // Pixel tests against the plane of the region being grown.
+    struct RegionTest
+    {
+        const Pt* pts;
+        const Pt* normals;
+        const uint64_t* visited;
+        int wordsPerRow;
+        Pt normal;
+        float offset;
+        float minNormalDot;
+        float maxPlaneDist;
+
+        bool Visited(int x, int y) const
+        {
+            return (visited[(size_t)y * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+        }
+
+        // Not yet in a region, with a normal close to the plane's and a
+        // point close to the plane. Pixels without a normal, including
+        // invalid ones, have a zero normal and fail.
+        bool Accept(int x, int y, int width) const
+        {
+            if (Visited(x, y))
+                return false;
+            int idx = y * width + x;
+            const Pt& nrm = normals[idx];
+            const Pt& pt = pts[idx];
+            return fabsf(Dot(nrm, normal)) > minNormalDot &&
+                fabsf(Dot(pt, normal) + offset) < maxPlaneDist;
+        }
+    };
+
+    void MarkVisited(uint64_t* visited, int wordsPerRow, int y, int x0, int x1)
+    {
+        uint64_t* row = visited + (size_t)y * wordsPerRow;
+        for (int w = x0 >> 6; w <= (x1 >> 6); ++w)
+        {
+            int lo = w == (x0 >> 6) ? (x0 & 63) : 0;
+            int hi = w == (x1 >> 6) ? (x1 & 63) : 63;
+            uint64_t upper = hi == 63 ? ~0ull : ((1ull << (hi + 1)) - 1);
+            row[w] |= upper & (~0ull << lo);
+        }
+    }
+
+    // What a region has taken so far.
+    struct Region
+    {
+        Moments m;
+        // Sum of the pixels' footprints, Cross(right - pt, down - pt). On
+        // a plane they all point the same way, so its component along the
+        // normal is the area.
+        Pt footprint;
+    };
+
+    // Widens accepted pixel (x, y) to the longest accepted run of its row,
+    // adds the run to the region and queues it to be scanned around.
+    void TakeSpan(const RegionTest& test, SegmentScratch& s, Region& region, int width, int x, int y)
+    {
+        int x0 = x, x1 = x;
+        while (x0 > 0 && test.Accept(x0 - 1, y, width))
+            x0--;
+        while (x1 < width - 1 && test.Accept(x1 + 1, y, width))
+            x1++;
+        MarkVisited(s.visited.data(), test.wordsPerRow, y, x0, x1);
+        const Pt* row = test.pts + y * width;
+        for (int px = x0; px <= x1; ++px)
+        {
+            // Pixels with a normal have valid neighbours.
+            Pt pt = row[px];
+            region.m.Add(pt);
+            region.footprint += Cross(row[px + 1] - pt, row[px + width] - pt);
+        }
+        s.spans.push_back(SegmentSpan{ y, x0, x1 });
+        s.stack.push_back(SegmentSpan{ y, x0, x1 });
+    }
+}
+
+extern "C"
+{
+    DEXPORT void DepthSegmentPlanesCtx(DepthContext* ctx, float* vals, PlaneDescriptor* outPlanes,
+        int maxPlanes, int* outPlaneCount, int* outLabels)
+    {
+        SegmentScratch& s = ctx->segmentScratch;
+        const SegmentParams& params = ctx->segment;
+        const Pt* pts = (const Pt*)vals;
+        const Pt* normals = ctx->normals.data();
+        int width = ctx->width;
+        int height = ctx->height;
+        int wordsPerRow = (width + 63) / 64;
+        s.visited.assign((size_t)wordsPerRow * height, 0);
+        if (outLabels != nullptr)
+            std::fill(outLabels, outLabels + (size_t)width * height, -1);
+
+        RegionTest test;
+        test.pts = pts;
+        test.normals = normals;
+        test.visited = s.visited.data();
+        test.wordsPerRow = wordsPerRow;
+        test.minNormalDot = params.minNormalDot;
+        test.maxPlaneDist = params.maxPlaneDist;
+
+        // Colours depend only on the plane's index.
+        unsigned int colorSeed = 1;
+        int planeCount = 0;
+        // Seeds are taken in raster order, so regions are found top to
+        // bottom and each pixel is tested as a seed once.
+        for (int seedY = 1; seedY < height - 1 && planeCount < maxPlanes; ++seedY)
+        {
+            for (int seedX = 1; seedX < width - 1 && planeCount < maxPlanes; ++seedX)
+            {
+                int seedIdx = seedY * width + seedX;
+                Pt seedNormal = normals[seedIdx];
+                if (test.Visited(seedX, seedY) || !(Dot(seedNormal, seedNormal) > 0.5f))
+                    continue;
+
+                // Scanline flood fill: a span is the longest accepted run
+                // of a row, taken as soon as it is found, and the rows
+                // above and below it are scanned along it for more, so
+                // every pixel the region takes is tested once.
+                Pt centroid, normal;
+                float rmsDist;
+                test.normal = seedNormal;
+                test.offset = -Dot(seedNormal, pts[seedIdx]);
+                Region region = Region();
+                int nextRefit = firstRefitPoints;
+                s.spans.clear();
+                s.stack.clear();
+                TakeSpan(test, s, region, width, seedX, seedY);
+                while (!s.stack.empty())
+                {
+                    SegmentSpan span = s.stack.back();
+                    s.stack.pop_back();
+                    for (int y = span.y - 1; y <= span.y + 1; y += 2)
+                    {
+                        if (y < 0 || y >= height)
+                            continue;
+                        for (int x = span.x0; x <= span.x1; ++x)
+                        {
+                            // The run taken ends at a rejected pixel, so
+                            // skip that too.
+                            if (test.Accept(x, y, width))
+                            {
+                                TakeSpan(test, s, region, width, x, y);
+                                x = s.spans.back().x1 + 1;
+                            }
+                        }
+                    }
+
+                    if (region.m.n >= nextRefit)
+                    {
+                        if (FitPlane(region.m, centroid, normal, rmsDist))
+                        {
+                            test.normal = normal;
+                            test.offset = -Dot(normal, centroid);
+                        }
+                        nextRefit *= 2;
+                    }
+                }
+
+                // Small regions stay visited, so none of their pixels
+                // seeds another region, but are not labelled.
+                if (region.m.n < params.minPoints || !FitPlane(region.m, centroid, normal, rmsDist))
+                    continue;
+                if (Dot(normal, centroid) > 0)
+                    normal *= -1.0f;
+
+                // A row of the plane is a line on it, so the extents are
+                // reached at span ends.
+                Pt axisU, axisV;
+                PlaneAxes(normal, axisU, axisV);
+                float extentMin[2] = { INFINITY, INFINITY };
+                float extentMax[2] = { -INFINITY, -INFINITY };
+                for (const SegmentSpan& span : s.spans)
+                {
+                    const Pt* row = pts + span.y * width;
+                    for (int x : { span.x0, span.x1 })
+                    {
+                        Pt rel = row[x] - centroid;
+                        float u = Dot(rel, axisU), v = Dot(rel, axisV);
+                        extentMin[0] = std::min(extentMin[0], u);
+                        extentMax[0] = std::max(extentMax[0], u);
+                        extentMin[1] = std::min(extentMin[1], v);
+                        extentMax[1] = std::max(extentMax[1], v);
+                    }
+                    if (outLabels != nullptr)
+                        std::fill(outLabels + span.y * width + span.x0, outLabels + span.y * width + span.x1 + 1,
+                            planeCount);
+                }
+                float area = fabsf(Dot(region.footprint, normal));
+
+                PlaneDescriptor& plane = outPlanes[planeCount++];
+                StorePt(normal, plane.normal);
+                plane.offset = -Dot(normal, centroid);
+                StorePt(centroid, plane.centroid);
+                plane.rmsDist = rmsDist;
+                plane.area = area;
+                plane.inlierCount = (int)region.m.n;
+                StorePt(axisU, plane.axisU);
+                StorePt(axisV, plane.axisV);
+                for (int axis = 0; axis < 2; ++axis)
+                {
+                    plane.extentMin[axis] = extentMin[axis];
+                    plane.extentMax[axis] = extentMax[axis];
+                }
+                plane.firstTile = 0;
+                plane.tileCount = 0;
+                Pt rgb(NextColor(colorSeed), NextColor(colorSeed), NextColor(colorSeed));
+                StorePt(rgb, plane.color);
+            }
+        }
+        *outPlaneCount = planeCount;
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+struct SegmentParams
+{
+    SegmentParams() :
+        minNormalDot(0.8f),
+        maxPlaneDist(0.02f),
+        minPoints(500)
+    {
+    }
+
+    // Min |dot| between a pixel's normal and its region's plane.
+    float minNormalDot;
+    // Max distance in metres of a pixel's point from its region's plane.
+    float maxPlaneDist;
+    // Regions with fewer pixels are left unlabelled.
+    int minPoints;
+};
+
+// A run of pixels [x0, x1] of row y in one region.
+struct SegmentSpan
+{
+    int y;
+    int x0;
+    int x1;
+};
+
+// DepthSegmentPlanesCtx storage kept from frame to frame.
+struct SegmentScratch
+{
+    // A bit per pixel, set once a region has taken it; rows are
+    // (width + 63) / 64 words.
+    std::vector<uint64_t> visited;
+    // Spans of the region being grown whose rows above and below have
+    // not been scanned yet, and every span of the region.
+    std::vector<SegmentSpan> stack;
+    std::vector<SegmentSpan> spans;
+};
@@ -0,0 +1,346 @@
+#pragma once
+
+// Minimal 8-lane float vector used by the vectorized kernels. The backend
+// is picked at compile time: AVX2 when the compiler targets it, otherwise
+// two SSE2 or NEON registers, otherwise plain arrays. Masks are vectors
+// whose lanes are all ones or all zeros.
+
+#if defined(__AVX2__)
+#define PTS_SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#define PTS_SIMD_SSE 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PTS_SIMD_NEON 1
+#include <arm_neon.h>
+#else
+#define PTS_SIMD_SCALAR 1
+#include <cmath>
+#include <cstring>
+#endif
+
+#include "Pt.h"
+
+namespace simd
+{
+#if defined(PTS_SIMD_AVX2) || defined(PTS_SIMD_SSE)
+
+    // 4 xyz points (12 floats) to x, y, z lanes.
+    inline void Deinterleave4(const float* p, __m128& x, __m128& y, __m128& z)
+    {
+        __m128 a = _mm_loadu_ps(p);
+        __m128 b = _mm_loadu_ps(p + 4);
+        __m128 c = _mm_loadu_ps(p + 8);
+        __m128 u = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 2, 3, 0));
+        __m128 w = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2));
+        x = _mm_shuffle_ps(u, w, _MM_SHUFFLE(2, 0, 1, 0));
+        u = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1));
+        w = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3));
+        y = _mm_shuffle_ps(u, w, _MM_SHUFFLE(2, 0, 2, 0));
+        u = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2));
+        w = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0));
+        z = _mm_shuffle_ps(u, w, _MM_SHUFFLE(2, 0, 2, 0));
+    }
+
+    inline void Interleave4(float* p, __m128 x, __m128 y, __m128 z)
+    {
+        __m128 xyLo = _mm_unpacklo_ps(x, y);
+        __m128 xyHi = _mm_unpackhi_ps(x, y);
+        __m128 t0 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));
+        __m128 t1 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128 t2 = _mm_shuffle_ps(z, x, _MM_SHUFFLE(3, 3, 2, 2));
+        __m128 t3 = _mm_shuffle_ps(y, z, _MM_SHUFFLE(3, 3, 3, 3));
+        _mm_storeu_ps(p, _mm_shuffle_ps(xyLo, t0, _MM_SHUFFLE(2, 0, 1, 0)));
+        _mm_storeu_ps(p + 4, _mm_shuffle_ps(t1, xyHi, _MM_SHUFFLE(1, 0, 2, 0)));
+        _mm_storeu_ps(p + 8, _mm_shuffle_ps(t2, t3, _MM_SHUFFLE(2, 0, 2, 0)));
+    }
+
+#endif
+
+#if defined(PTS_SIMD_AVX2)
+
+    inline const char* BackendName() { return "avx2"; }
+
+    struct F8
+    {
+        __m256 v;
+    };
+
+    inline F8 Set1(float f) { return F8{ _mm256_set1_ps(f) }; }
+    inline F8 Load(const float* p) { return F8{ _mm256_loadu_ps(p) }; }
+    inline void Store(float* p, F8 a) { _mm256_storeu_ps(p, a.v); }
+    inline F8 LoadU16(const unsigned short* p)
+    {
+        __m128i u = _mm_loadu_si128((const __m128i*)p);
+        return F8{ _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(u)) };
+    }
+    inline F8 operator + (F8 a, F8 b) { return F8{ _mm256_add_ps(a.v, b.v) }; }
+    inline F8 operator - (F8 a, F8 b) { return F8{ _mm256_sub_ps(a.v, b.v) }; }
+    inline F8 operator * (F8 a, F8 b) { return F8{ _mm256_mul_ps(a.v, b.v) }; }
+    inline F8 operator / (F8 a, F8 b) { return F8{ _mm256_div_ps(a.v, b.v) }; }
+    inline F8 operator & (F8 a, F8 b) { return F8{ _mm256_and_ps(a.v, b.v) }; }
+    inline F8 operator | (F8 a, F8 b) { return F8{ _mm256_or_ps(a.v, b.v) }; }
+    inline F8 Abs(F8 a) { return F8{ _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+    // Unordered compare so NaN lanes count as "not equal", like the scalar !=.
+    inline F8 CmpNeq(F8 a, F8 b) { return F8{ _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_UQ) }; }
+    inline F8 Select(F8 mask, F8 a, F8 b) { return F8{ _mm256_blendv_ps(b.v, a.v, mask.v) }; }
+    inline F8 CmpGt(F8 a, F8 b) { return F8{ _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+    inline F8 RSqrtEst(F8 a) { return F8{ _mm256_rsqrt_ps(a.v) }; }
+    inline bool Any(F8 mask) { return _mm256_movemask_ps(mask.v) != 0; }
+    inline int MoveMask(F8 mask) { return _mm256_movemask_ps(mask.v); }
+    inline float HSum(F8 a)
+    {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    inline void LoadPts(const Pt* pts, F8& x, F8& y, F8& z)
+    {
+        __m128 x0, y0, z0, x1, y1, z1;
+        Deinterleave4((const float*)pts, x0, y0, z0);
+        Deinterleave4((const float*)(pts + 4), x1, y1, z1);
+        x.v = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+        y.v = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+        z.v = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+    }
+
+    inline void StorePts(Pt* pts, F8 x, F8 y, F8 z)
+    {
+        Interleave4((float*)pts, _mm256_castps256_ps128(x.v),
+            _mm256_castps256_ps128(y.v), _mm256_castps256_ps128(z.v));
+        Interleave4((float*)(pts + 4), _mm256_extractf128_ps(x.v, 1),
+            _mm256_extractf128_ps(y.v, 1), _mm256_extractf128_ps(z.v, 1));
+    }
+
+#elif defined(PTS_SIMD_SSE)
+
+    inline const char* BackendName() { return "sse"; }
+
+    struct F8
+    {
+        __m128 lo;
+        __m128 hi;
+    };
+
+    inline F8 Set1(float f) { return F8{ _mm_set1_ps(f), _mm_set1_ps(f) }; }
+    inline F8 Load(const float* p) { return F8{ _mm_loadu_ps(p), _mm_loadu_ps(p + 4) }; }
+    inline void Store(float* p, F8 a) { _mm_storeu_ps(p, a.lo); _mm_storeu_ps(p + 4, a.hi); }
+    inline F8 LoadU16(const unsigned short* p)
+    {
+        __m128i u = _mm_loadu_si128((const __m128i*)p);
+        __m128i zero = _mm_setzero_si128();
+        return F8{ _mm_cvtepi32_ps(_mm_unpacklo_epi16(u, zero)), _mm_cvtepi32_ps(_mm_unpackhi_epi16(u, zero)) };
+    }
+    inline F8 operator + (F8 a, F8 b) { return F8{ _mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi) }; }
+    inline F8 operator - (F8 a, F8 b) { return F8{ _mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi) }; }
+    inline F8 operator * (F8 a, F8 b) { return F8{ _mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi) }; }
+    inline F8 operator / (F8 a, F8 b) { return F8{ _mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi) }; }
+    inline F8 operator & (F8 a, F8 b) { return F8{ _mm_and_ps(a.lo, b.lo), _mm_and_ps(a.hi, b.hi) }; }
+    inline F8 operator | (F8 a, F8 b) { return F8{ _mm_or_ps(a.lo, b.lo), _mm_or_ps(a.hi, b.hi) }; }
+    inline F8 Abs(F8 a)
+    {
+        __m128 sign = _mm_set1_ps(-0.0f);
+        return F8{ _mm_andnot_ps(sign, a.lo), _mm_andnot_ps(sign, a.hi) };
+    }
+    inline F8 CmpNeq(F8 a, F8 b) { return F8{ _mm_cmpneq_ps(a.lo, b.lo), _mm_cmpneq_ps(a.hi, b.hi) }; }
+    inline F8 Select(F8 mask, F8 a, F8 b)
+    {
+        return F8{ _mm_or_ps(_mm_and_ps(mask.lo, a.lo), _mm_andnot_ps(mask.lo, b.lo)),
+            _mm_or_ps(_mm_and_ps(mask.hi, a.hi), _mm_andnot_ps(mask.hi, b.hi)) };
+    }
+    inline F8 CmpGt(F8 a, F8 b) { return F8{ _mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi) }; }
+    inline F8 RSqrtEst(F8 a) { return F8{ _mm_rsqrt_ps(a.lo), _mm_rsqrt_ps(a.hi) }; }
+    inline bool Any(F8 mask) { return (_mm_movemask_ps(mask.lo) | _mm_movemask_ps(mask.hi)) != 0; }
+    inline int MoveMask(F8 mask) { return _mm_movemask_ps(mask.lo) | (_mm_movemask_ps(mask.hi) << 4); }
+    inline float HSum(F8 a)
+    {
+        __m128 s = _mm_add_ps(a.lo, a.hi);
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    inline void LoadPts(const Pt* pts, F8& x, F8& y, F8& z)
+    {
+        Deinterleave4((const float*)pts, x.lo, y.lo, z.lo);
+        Deinterleave4((const float*)(pts + 4), x.hi, y.hi, z.hi);
+    }
+
+    inline void StorePts(Pt* pts, F8 x, F8 y, F8 z)
+    {
+        Interleave4((float*)pts, x.lo, y.lo, z.lo);
+        Interleave4((float*)(pts + 4), x.hi, y.hi, z.hi);
+    }
+
+#elif defined(PTS_SIMD_NEON)
+
+    inline const char* BackendName() { return "neon"; }
+
+    struct F8
+    {
+        float32x4_t lo;
+        float32x4_t hi;
+    };
+
+    inline F8 Set1(float f) { return F8{ vdupq_n_f32(f), vdupq_n_f32(f) }; }
+    inline F8 Load(const float* p) { return F8{ vld1q_f32(p), vld1q_f32(p + 4) }; }
+    inline void Store(float* p, F8 a) { vst1q_f32(p, a.lo); vst1q_f32(p + 4, a.hi); }
+    inline F8 LoadU16(const unsigned short* p)
+    {
+        uint16x8_t u = vld1q_u16(p);
+        return F8{ vcvtq_f32_u32(vmovl_u16(vget_low_u16(u))), vcvtq_f32_u32(vmovl_u16(vget_high_u16(u))) };
+    }
+    inline F8 operator + (F8 a, F8 b) { return F8{ vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi) }; }
+    inline F8 operator - (F8 a, F8 b) { return F8{ vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi) }; }
+    inline F8 operator * (F8 a, F8 b) { return F8{ vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi) }; }
+#if defined(__aarch64__)
+    inline F8 operator / (F8 a, F8 b) { return F8{ vdivq_f32(a.lo, b.lo), vdivq_f32(a.hi, b.hi) }; }
+#else
+    // 32-bit NEON has no divide: the reciprocal estimate plus two
+    // refinements, within a couple of ulps rather than exact.
+    inline float32x4_t Div4(float32x4_t a, float32x4_t b)
+    {
+        float32x4_t e = vrecpeq_f32(b);
+        e = vmulq_f32(e, vrecpsq_f32(b, e));
+        e = vmulq_f32(e, vrecpsq_f32(b, e));
+        return vmulq_f32(a, e);
+    }
+    inline F8 operator / (F8 a, F8 b) { return F8{ Div4(a.lo, b.lo), Div4(a.hi, b.hi) }; }
+#endif
+    inline float32x4_t And4(float32x4_t a, float32x4_t b)
+    {
+        return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)));
+    }
+    inline float32x4_t Or4(float32x4_t a, float32x4_t b)
+    {
+        return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b)));
+    }
+    inline F8 operator & (F8 a, F8 b) { return F8{ And4(a.lo, b.lo), And4(a.hi, b.hi) }; }
+    inline F8 operator | (F8 a, F8 b) { return F8{ Or4(a.lo, b.lo), Or4(a.hi, b.hi) }; }
+    inline F8 Abs(F8 a) { return F8{ vabsq_f32(a.lo), vabsq_f32(a.hi) }; }
+    inline float32x4_t CmpNeq4(float32x4_t a, float32x4_t b)
+    {
+        return vreinterpretq_f32_u32(vmvnq_u32(vceqq_f32(a, b)));
+    }
+    inline F8 CmpNeq(F8 a, F8 b) { return F8{ CmpNeq4(a.lo, b.lo), CmpNeq4(a.hi, b.hi) }; }
+    inline F8 Select(F8 mask, F8 a, F8 b)
+    {
+        return F8{ vbslq_f32(vreinterpretq_u32_f32(mask.lo), a.lo, b.lo),
+            vbslq_f32(vreinterpretq_u32_f32(mask.hi), a.hi, b.hi) };
+    }
+    // vrsqrte is only ~8 bits; one built-in refinement here plus the
+    // Newton step in the kernel brings it to float precision.
+    inline float32x4_t RSqrtEst4(float32x4_t a)
+    {
+        float32x4_t e = vrsqrteq_f32(a);
+        return vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(a, e), e));
+    }
+    inline F8 RSqrtEst(F8 a) { return F8{ RSqrtEst4(a.lo), RSqrtEst4(a.hi) }; }
+    inline F8 CmpGt(F8 a, F8 b)
+    {
+        return F8{ vreinterpretq_f32_u32(vcgtq_f32(a.lo, b.lo)),
+            vreinterpretq_f32_u32(vcgtq_f32(a.hi, b.hi)) };
+    }
+    inline bool Any(F8 mask)
+    {
+        uint32x4_t m = vorrq_u32(vreinterpretq_u32_f32(mask.lo), vreinterpretq_u32_f32(mask.hi));
+        uint32x2_t t = vorr_u32(vget_low_u32(m), vget_high_u32(m));
+        return (vget_lane_u32(t, 0) | vget_lane_u32(t, 1)) != 0;
+    }
+    inline int MoveMask4(float32x4_t mask)
+    {
+        static const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+        uint32x4_t bits = vandq_u32(vreinterpretq_u32_f32(mask), vld1q_u32(laneBits));
+        uint32x2_t t = vorr_u32(vget_low_u32(bits), vget_high_u32(bits));
+        return (int)(vget_lane_u32(t, 0) | vget_lane_u32(t, 1));
+    }
+    inline int MoveMask(F8 mask) { return MoveMask4(mask.lo) | (MoveMask4(mask.hi) << 4); }
+    inline float HSum(F8 a)
+    {
+        float32x4_t s = vaddq_f32(a.lo, a.hi);
+        float32x2_t t = vadd_f32(vget_low_f32(s), vget_high_f32(s));
+        return vget_lane_f32(vpadd_f32(t, t), 0);
+    }
+
+    inline void LoadPts(const Pt* pts, F8& x, F8& y, F8& z)
+    {
+        float32x4x3_t lo = vld3q_f32((const float*)pts);
+        float32x4x3_t hi = vld3q_f32((const float*)(pts + 4));
+        x = F8{ lo.val[0], hi.val[0] };
+        y = F8{ lo.val[1], hi.val[1] };
+        z = F8{ lo.val[2], hi.val[2] };
+    }
+
+    inline void StorePts(Pt* pts, F8 x, F8 y, F8 z)
+    {
+        float32x4x3_t lo = { { x.lo, y.lo, z.lo } };
+        float32x4x3_t hi = { { x.hi, y.hi, z.hi } };
+        vst3q_f32((float*)pts, lo);
+        vst3q_f32((float*)(pts + 4), hi);
+    }
+
+#else
+
+    inline const char* BackendName() { return "scalar"; }
+
+    struct F8
+    {
+        float v[8];
+    };
+
+    inline F8 Set1(float f) { F8 r; for (int i = 0; i < 8; ++i) r.v[i] = f; return r; }
+    inline F8 Load(const float* p) { F8 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+    inline void Store(float* p, F8 a) { memcpy(p, a.v, sizeof(a.v)); }
+    inline F8 LoadU16(const unsigned short* p) { F8 r; for (int i = 0; i < 8; ++i) r.v[i] = p[i]; return r; }
+    inline F8 operator + (F8 a, F8 b) { for (int i = 0; i < 8; ++i) a.v[i] += b.v[i]; return a; }
+    inline F8 operator - (F8 a, F8 b) { for (int i = 0; i < 8; ++i) a.v[i] -= b.v[i]; return a; }
+    inline F8 operator * (F8 a, F8 b) { for (int i = 0; i < 8; ++i) a.v[i] *= b.v[i]; return a; }
+    inline F8 operator / (F8 a, F8 b) { for (int i = 0; i < 8; ++i) a.v[i] /= b.v[i]; return a; }
+    inline unsigned int Bits(float f) { unsigned int u; memcpy(&u, &f, 4); return u; }
+    inline float Float(unsigned int u) { float f; memcpy(&f, &u, 4); return f; }
+    inline F8 operator & (F8 a, F8 b) { for (int i = 0; i < 8; ++i) a.v[i] = Float(Bits(a.v[i]) & Bits(b.v[i])); return a; }
+    inline F8 operator | (F8 a, F8 b) { for (int i = 0; i < 8; ++i) a.v[i] = Float(Bits(a.v[i]) | Bits(b.v[i])); return a; }
+    inline F8 Abs(F8 a) { for (int i = 0; i < 8; ++i) a.v[i] = fabsf(a.v[i]); return a; }
+    inline F8 CmpNeq(F8 a, F8 b) { for (int i = 0; i < 8; ++i) a.v[i] = Float(a.v[i] != b.v[i] ? 0xFFFFFFFFu : 0); return a; }
+    inline F8 Select(F8 mask, F8 a, F8 b) { for (int i = 0; i < 8; ++i) a.v[i] = Bits(mask.v[i]) ? a.v[i] : b.v[i]; return a; }
+    inline F8 CmpGt(F8 a, F8 b) { for (int i = 0; i < 8; ++i) a.v[i] = Float(a.v[i] > b.v[i] ? 0xFFFFFFFFu : 0); return a; }
+    inline F8 RSqrtEst(F8 a) { for (int i = 0; i < 8; ++i) a.v[i] = 1.0f / sqrtf(a.v[i]); return a; }
+    inline bool Any(F8 mask) { for (int i = 0; i < 8; ++i) if (Bits(mask.v[i])) return true; return false; }
+    inline int MoveMask(F8 mask) { int m = 0; for (int i = 0; i < 8; ++i) m |= (Bits(mask.v[i]) != 0) << i; return m; }
+    inline float HSum(F8 a) { float s = 0; for (int i = 0; i < 8; ++i) s += a.v[i]; return s; }
+
+    inline void LoadPts(const Pt* pts, F8& x, F8& y, F8& z)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            x.v[i] = pts[i].x;
+            y.v[i] = pts[i].y;
+            z.v[i] = pts[i].z;
+        }
+    }
+
+    inline void StorePts(Pt* pts, F8 x, F8 y, F8 z)
+    {
+        for (int i = 0; i < 8; ++i)
+            pts[i] = Pt(x.v[i], y.v[i], z.v[i]);
+    }
+
+#endif
+
+    // Lane-wise Pt::IsValid: not infinite and x, y non-zero.
+    inline F8 ValidMask(F8 x, F8 y)
+    {
+        F8 zero = Set1(0);
+        return CmpNeq(Abs(x), Set1(INFINITY)) & CmpNeq(x, zero) & CmpNeq(y, zero);
+    }
+
+    // 1 / sqrt(a) from the hardware estimate plus one Newton-Raphson step.
+    inline F8 RSqrt(F8 a)
+    {
+        F8 e = RSqrtEst(a);
+        return e * (Set1(1.5f) - Set1(0.5f) * a * e * e);
+    }
+}
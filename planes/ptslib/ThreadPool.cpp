@@ -0,0 +1,104 @@
+#include "pch.h"
+#include <algorithm>
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int threadCount) :
+    m_taskFn(nullptr),
+    m_task(nullptr),
+    m_taskCount(0),
+    m_nextTask(0),
+    m_busyWorkers(0),
+    m_generation(0),
+    m_exit(false)
+{
+    for (int idx = 1; idx < threadCount; ++idx)
+        m_workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& worker : m_workers)
+        worker.join();
+}
+
+void ThreadPool::Run(int taskCount, TaskFn taskFn, const void* task)
+{
+    if (taskCount <= 0)
+        return;
+    if (m_workers.empty() || taskCount == 1)
+    {
+        for (int idx = 0; idx < taskCount; ++idx)
+            taskFn(task, idx);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_taskFn = taskFn;
+        m_task = task;
+        m_taskCount = taskCount;
+        m_nextTask = 0;
+        m_busyWorkers = (int)m_workers.size();
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    RunTasks();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_busyWorkers == 0; });
+    m_taskFn = nullptr;
+    m_task = nullptr;
+}
+
+void ThreadPool::RunTasks()
+{
+    for (;;)
+    {
+        int idx = m_nextTask.fetch_add(1);
+        if (idx >= m_taskCount)
+            break;
+        m_taskFn(m_task, idx);
+    }
+}
+
+void ThreadPool::WorkerLoop()
+{
+    unsigned int seenGeneration = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_exit || m_generation != seenGeneration; });
+            if (m_exit)
+                return;
+            seenGeneration = m_generation;
+        }
+
+        RunTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busyWorkers--;
+        }
+        m_done.notify_one();
+    }
+}
+
+int ResolveThreadCount(int requested)
+{
+    if (requested > 0)
+        return requested;
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+int BandRows(int bytesPerRow)
+{
+    const int bandBytes = 256 * 1024;
+    return std::max(4, bandBytes / std::max(1, bytesPerRow));
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent set of worker threads for splitting one kernel into tasks.
+// Run blocks until every task has finished, and the calling thread works
+// on tasks too, so a pool of N threads owns N - 1 workers.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+
+    int ThreadCount() const { return (int)m_workers.size() + 1; }
+
+    // Calls task(idx) once for every idx in [0, taskCount). task is only
+    // referred to, never copied, so a lambda of any size costs no heap
+    // allocation.
+    template <typename Fn> void Run(int taskCount, const Fn& task)
+    {
+        Run(taskCount, &CallTask<Fn>, &task);
+    }
+
+private:
+    typedef void (*TaskFn)(const void* task, int idx);
+
+    template <typename Fn> static void CallTask(const void* task, int idx)
+    {
+        (*(const Fn*)task)(idx);
+    }
+
+    void Run(int taskCount, TaskFn taskFn, const void* task);
+    void WorkerLoop();
+    void RunTasks();
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    TaskFn m_taskFn;
+    const void* m_task;
+    int m_taskCount;
+    std::atomic<int> m_nextTask;
+    int m_busyWorkers;
+    unsigned int m_generation;
+    bool m_exit;
+};
+
+// Threads to use for a requested count, where 0 or less means one per core.
+int ResolveThreadCount(int requested);
+
+// Rows per band so one band of a kernel touching bytesPerRow per row stays
+// within a core's L2.
+int BandRows(int bytesPerRow);
@@ -0,0 +1,153 @@
+#include "pch.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "TileHistory.h"
+
+namespace
+{
+    inline size_t HashId(unsigned long long id)
+    {
+        id ^= id >> 33;
+        id *= 0xff51afd7ed558ccdull;
+        id ^= id >> 33;
+        return (size_t)id;
+    }
+}
+
+void TileHistory::Update(const Pt* pts, int width, int height, float threshold, ThreadPool& pool)
+{
+    if (m_width != width || m_height != height)
+    {
+        m_width = width;
+        m_height = height;
+        m_cellsX = (width + (1 << cellShift) - 1) >> cellShift;
+        m_cellsY = (height + (1 << cellShift) - 1) >> cellShift;
+        m_refDepth.assign((size_t)width * height, -std::numeric_limits<float>::infinity());
+        m_cellMoved.assign((size_t)m_cellsX * m_cellsY, 0);
+        m_movedSum.assign((size_t)(m_cellsX + 1) * (m_cellsY + 1), 0);
+        m_hasTree = false;
+    }
+
+    // Invalid pixels have depth -inf: |-inf - -inf| is NaN, which is not
+    // above the threshold, and a pixel that turns valid or invalid moves by
+    // an infinite amount.
+    const float invalid = -std::numeric_limits<float>::infinity();
+    // Bands of whole cell rows, so no two tasks mark the same cell.
+    int bandCells = std::max(1, BandRows(width * (int)sizeof(Pt)) >> cellShift);
+    int bandCount = (m_cellsY + bandCells - 1) / bandCells;
+    pool.Run(bandCount, [&](int band)
+        {
+            int cy0 = band * bandCells;
+            int cy1 = std::min(m_cellsY, cy0 + bandCells);
+            std::fill(m_cellMoved.begin() + (size_t)cy0 * m_cellsX,
+                m_cellMoved.begin() + (size_t)cy1 * m_cellsX, 0);
+            int y1 = std::min(height, cy1 << cellShift);
+            for (int y = cy0 << cellShift; y < y1; ++y)
+            {
+                const Pt* row = pts + (size_t)y * width;
+                float* ref = &m_refDepth[(size_t)y * width];
+                uint8_t* cells = &m_cellMoved[(size_t)(y >> cellShift) * m_cellsX];
+                // One vector per cell row; cells are 8 pixels wide.
+                simd::F8 none = simd::Set1(invalid);
+                simd::F8 limit = simd::Set1(threshold);
+                int x = 0;
+                for (; x + 8 <= width; x += 8)
+                {
+                    simd::F8 px, py, pz;
+                    simd::LoadPts(row + x, px, py, pz);
+                    simd::F8 depth = simd::Select(simd::ValidMask(px, py), pz, none);
+                    simd::F8 prev = simd::Load(ref + x);
+                    simd::F8 moved = simd::CmpGt(simd::Abs(depth - prev), limit);
+                    if (simd::Any(moved))
+                    {
+                        simd::Store(ref + x, simd::Select(moved, depth, prev));
+                        cells[x >> cellShift] = 1;
+                    }
+                }
+                for (; x < width; ++x)
+                {
+                    Pt pt = row[x];
+                    float depth = pt.IsValid() ? pt.z : invalid;
+                    if (fabs(depth - ref[x]) > threshold)
+                    {
+                        ref[x] = depth;
+                        cells[x >> cellShift] = 1;
+                    }
+                }
+            }
+        });
+
+    int stride = m_cellsX + 1;
+    m_movedCells = 0;
+    for (int cy = 0; cy < m_cellsY; ++cy)
+    {
+        const uint8_t* cells = &m_cellMoved[(size_t)cy * m_cellsX];
+        const int* above = &m_movedSum[(size_t)cy * stride];
+        int* out = &m_movedSum[(size_t)(cy + 1) * stride];
+        int rowSum = 0;
+        for (int cx = 0; cx < m_cellsX; ++cx)
+        {
+            rowSum += cells[cx];
+            out[cx + 1] = above[cx + 1] + rowSum;
+        }
+        m_movedCells += rowSum;
+    }
+}
+
+bool TileHistory::Moved(int x0, int y0, int x1, int y1) const
+{
+    if (!m_hasTree)
+        return true;
+    int cx0 = std::max(0, x0) >> cellShift;
+    int cy0 = std::max(0, y0) >> cellShift;
+    int cx1 = (std::min(m_width - 1, x1) >> cellShift) + 1;
+    int cy1 = (std::min(m_height - 1, y1) >> cellShift) + 1;
+    int stride = m_cellsX + 1;
+    int count = m_movedSum[(size_t)cy1 * stride + cx1] - m_movedSum[(size_t)cy0 * stride + cx1] -
+        m_movedSum[(size_t)cy1 * stride + cx0] + m_movedSum[(size_t)cy0 * stride + cx0];
+    return count != 0;
+}
+
+const TileRecord* TileHistory::Find(unsigned long long id) const
+{
+    if (!m_hasTree || m_slots.empty())
+        return nullptr;
+    size_t mask = m_slots.size() - 1;
+    for (size_t slot = HashId(id) & mask; ; slot = (slot + 1) & mask)
+    {
+        int idx = m_slots[slot];
+        if (idx < 0)
+            return nullptr;
+        if (m_records[idx].id == id)
+            return &m_records[idx];
+    }
+}
+
+void TileHistory::Commit(const std::vector<std::vector<TileRecord>>& workerRecords)
+{
+    m_records.clear();
+    for (const std::vector<TileRecord>& records : workerRecords)
+        m_records.insert(m_records.end(), records.begin(), records.end());
+    std::sort(m_records.begin(), m_records.end(), [](const TileRecord& a, const TileRecord& b)
+        {
+            return a.id < b.id;
+        });
+
+    // At most half full.
+    size_t slotCount = 16;
+    while (slotCount < m_records.size() * 2)
+        slotCount *= 2;
+    m_slots.assign(slotCount, -1);
+    size_t mask = slotCount - 1;
+    for (int idx = 0; idx < (int)m_records.size(); ++idx)
+    {
+        size_t slot = HashId(m_records[idx].id) & mask;
+        while (m_slots[slot] >= 0)
+            slot = (slot + 1) & mask;
+        m_slots[slot] = idx;
+    }
+    m_hasTree = true;
+}
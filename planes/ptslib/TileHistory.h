@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Pt.h"
+
+class ThreadPool;
+
+enum class TileOutcome : uint8_t
+{
+    Dropped,
+    Split,
+    Leaf
+};
+
+// What one quadtree tile did in the last frame. Leaves keep their plane
+// fit and quad so they can be output again without touching their points.
+struct TileRecord
+{
+    unsigned long long id;
+    TileOutcome outcome;
+    float maxDistFound;
+    Pt normal;
+    Pt pt0;
+    Pt quad[4];
+    int quadPixel[4];
+};
+
+// Temporal state for incremental plane segmentation: which parts of the
+// frame moved since the tiles covering them were last fit, and the last
+// frame's quadtree keyed by Rect::GetUniqueId.
+class TileHistory
+{
+public:
+    // Compares every pixel's depth with its reference depth and marks the
+    // 8x8 pixel cells where one moved more than threshold metres, or
+    // became valid or invalid, so the validity of unmoved pixels is known
+    // to be unchanged. Moved pixels take their new depth as the
+    // reference, so slow drift is still caught once it adds up.
+    void Update(const Pt* pts, int width, int height, float threshold, ThreadPool& pool);
+
+    // Drops the stored tree; the next frame is fit from scratch.
+    void Invalidate() { m_hasTree = false; }
+    bool HasTree() const { return m_hasTree; }
+
+    // Whether any pixel in [x0, x1] x [y0, y1] moved this frame.
+    bool Moved(int x0, int y0, int x1, int y1) const;
+
+    // The tile's record from the stored tree, or null.
+    const TileRecord* Find(unsigned long long id) const;
+
+    // Replaces the stored tree with the records of this frame's tiles.
+    void Commit(const std::vector<std::vector<TileRecord>>& workerRecords);
+
+    // The stored tree ordered by id.
+    const std::vector<TileRecord>& Records() const { return m_records; }
+
+    // Cells marked moved by the last Update.
+    int MovedCells() const { return m_movedCells; }
+    // A stored tree, none of which moved this frame: every tile replays
+    // its last outcome and the leaves are exactly last frame's.
+    bool Unchanged() const { return m_hasTree && m_movedCells == 0; }
+
+private:
+    static const int cellShift = 3;
+
+    int m_width = 0;
+    int m_height = 0;
+    int m_cellsX = 0;
+    int m_cellsY = 0;
+    bool m_hasTree = false;
+    int m_movedCells = 0;
+    // Depth each pixel was last seen at, -inf when invalid.
+    std::vector<float> m_refDepth;
+    std::vector<uint8_t> m_cellMoved;
+    // Summed-area table of m_cellMoved, (cellsX + 1) x (cellsY + 1).
+    std::vector<int> m_movedSum;
+
+    // Open-addressed id -> record index, a power of two in size.
+    std::vector<TileRecord> m_records;
+    std::vector<int> m_slots;
+};
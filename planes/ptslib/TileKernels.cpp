@@ -0,0 +1,51 @@
+#include "pch.h"
+#include <cmath>
+#include "Kernels.h"
+#include "Simd.h"
+
+bool PlaneResidualRowSimd(const Pt* pts, int width, int y, int x0, int x1,
+    const Pt& planePt, const Pt& nrm, float maxDist, float& sum, float& count)
+{
+    using namespace simd;
+    const Pt* row = pts + y * width;
+    F8 nx = Set1(nrm.x), ny = Set1(nrm.y), nz = Set1(nrm.z);
+    F8 ox = Set1(planePt.x), oy = Set1(planePt.y), oz = Set1(planePt.z);
+    F8 vMaxDist = Set1(maxDist);
+    F8 zero = Set1(0), one = Set1(1);
+    F8 vSum = zero, vCount = zero;
+    int x = x0;
+    bool exceeded = false;
+    for (; x + 8 <= x1; x += 8)
+    {
+        F8 px, py, pz;
+        LoadPts(row + x, px, py, pz);
+        F8 valid = ValidMask(px, py);
+        F8 dist = Abs((px - ox) * nx + (py - oy) * ny + (pz - oz) * nz);
+        dist = Select(valid, dist, zero);
+        vSum = vSum + dist;
+        vCount = vCount + Select(valid, one, zero);
+        if (Any(CmpGt(dist, vMaxDist)))
+        {
+            exceeded = true;
+            x += 8;
+            break;
+        }
+    }
+    sum += HSum(vSum);
+    count += HSum(vCount);
+    if (exceeded)
+        return true;
+
+    for (; x < x1; ++x)
+    {
+        Pt pt = row[x];
+        if (!pt.IsValid())
+            continue;
+        float dp = fabs(Dot(pt - planePt, nrm));
+        sum += dp;
+        count++;
+        if (dp > maxDist)
+            return true;
+    }
+    return false;
+}
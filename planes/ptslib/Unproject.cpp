@@ -0,0 +1,44 @@
+#include "pch.h"
+#include <limits>
+#include "Kernels.h"
+#include "Simd.h"
+
+void UnprojectRowScalar(const unsigned short* depth, const float* rayX, const float* rayY,
+    Pt* outPts, int width, int y, int x0, int x1)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    for (int x = x0; x < x1; ++x)
+    {
+        int idx = y * width + x;
+        if (depth[idx] == 0)
+        {
+            outPts[idx] = Pt(-inf, -inf, -inf);
+            continue;
+        }
+        float z = depth[idx] * 0.001f;
+        outPts[idx] = Pt(rayX[idx] * z, rayY[idx] * z, z);
+    }
+}
+
+void UnprojectRowSimd(const unsigned short* depth, const float* rayX, const float* rayY,
+    Pt* outPts, int width, int y, int x0, int x1)
+{
+    using namespace simd;
+    int rowStart = y * width;
+    F8 mmToMetres = Set1(0.001f);
+    F8 invalid = Set1(-INFINITY);
+    F8 zero = Set1(0);
+    int x = x0;
+    for (; x + 8 <= x1; x += 8)
+    {
+        int idx = rowStart + x;
+        F8 d = LoadU16(depth + idx);
+        F8 valid = CmpGt(d, zero);
+        F8 z = d * mmToMetres;
+        StorePts(outPts + idx,
+            Select(valid, Load(rayX + idx) * z, invalid),
+            Select(valid, Load(rayY + idx) * z, invalid),
+            Select(valid, z, invalid));
+    }
+    UnprojectRowScalar(depth, rayX, rayY, outPts, width, y, x, x1);
+}
@@ -0,0 +1,126 @@
+#include "pch.h"
+#include <algorithm>
+#include "ThreadPool.h"
+#include "TileHistory.h"
+#include "ValidMask.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+    inline int LowestBit(uint64_t v)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward64(&idx, v);
+        return (int)idx;
+#else
+        return __builtin_ctzll(v);
+#endif
+    }
+
+    inline int HighestBit(uint64_t v)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanReverse64(&idx, v);
+        return (int)idx;
+#else
+        return 63 - __builtin_clzll(v);
+#endif
+    }
+
+    // Bits [lo, hi] of a word, 0 <= lo <= hi <= 63.
+    inline uint64_t RangeMask(int lo, int hi)
+    {
+        uint64_t upper = hi == 63 ? ~0ull : ((1ull << (hi + 1)) - 1);
+        return upper & (~0ull << lo);
+    }
+}
+
+void ValidMask::Build(const Pt* pts, int width, int height, ThreadPool& pool,
+    const TileHistory* history)
+{
+    if (m_width != width || m_height != height)
+    {
+        m_width = width;
+        m_height = height;
+        m_wordsPerRow = (width + 63) / 64;
+        m_bits.assign((size_t)m_wordsPerRow * height, 0);
+        m_rowFirst.assign(height, width);
+        m_rowLast.assign(height, -1);
+    }
+
+    int bandRows = BandRows(width * (int)sizeof(Pt));
+    int bandCount = (height + bandRows - 1) / bandRows;
+    pool.Run(bandCount, [&](int band)
+        {
+            int y1 = std::min(height, (band + 1) * bandRows);
+            for (int y = band * bandRows; y < y1; ++y)
+            {
+                if (history != nullptr && !history->Moved(0, y, width - 1, y))
+                    continue;
+                const Pt* row = pts + y * width;
+                uint64_t* words = &m_bits[(size_t)y * m_wordsPerRow];
+                int first = width, last = -1;
+                for (int w = 0; w < m_wordsPerRow; ++w)
+                {
+                    uint64_t word = 0;
+                    int x0 = w * 64;
+                    int x1 = std::min(width, x0 + 64);
+                    for (int x = x0; x < x1; ++x)
+                    {
+                        Pt pt = row[x];
+                        word |= (uint64_t)pt.IsValid() << (x - x0);
+                    }
+                    words[w] = word;
+                    if (word != 0)
+                    {
+                        if (first == width)
+                            first = x0 + LowestBit(word);
+                        last = x0 + HighestBit(word);
+                    }
+                }
+                m_rowFirst[y] = first;
+                m_rowLast[y] = last;
+            }
+        });
+}
+
+int ValidMask::FirstInRow(int y, int x0, int x1) const
+{
+    x0 = std::max(x0, m_rowFirst[y]);
+    x1 = std::min(x1, m_rowLast[y]);
+    if (x0 > x1)
+        return -1;
+    const uint64_t* words = &m_bits[(size_t)y * m_wordsPerRow];
+    for (int w = x0 >> 6; w <= (x1 >> 6); ++w)
+    {
+        int lo = w == (x0 >> 6) ? (x0 & 63) : 0;
+        int hi = w == (x1 >> 6) ? (x1 & 63) : 63;
+        uint64_t word = words[w] & RangeMask(lo, hi);
+        if (word != 0)
+            return w * 64 + LowestBit(word);
+    }
+    return -1;
+}
+
+int ValidMask::LastInRow(int y, int x0, int x1) const
+{
+    x0 = std::max(x0, m_rowFirst[y]);
+    x1 = std::min(x1, m_rowLast[y]);
+    if (x0 > x1)
+        return -1;
+    const uint64_t* words = &m_bits[(size_t)y * m_wordsPerRow];
+    for (int w = x1 >> 6; w >= (x0 >> 6); --w)
+    {
+        int lo = w == (x0 >> 6) ? (x0 & 63) : 0;
+        int hi = w == (x1 >> 6) ? (x1 & 63) : 63;
+        uint64_t word = words[w] & RangeMask(lo, hi);
+        if (word != 0)
+            return w * 64 + HighestBit(word);
+    }
+    return -1;
+}
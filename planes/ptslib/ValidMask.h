@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Pt.h"
+
+class ThreadPool;
+class TileHistory;
+
+// One bit per pixel for Pt::IsValid, plus the first and last valid column
+// of every row, built once per frame so tile scans can skip invalid runs
+// with bit scans instead of testing points one by one.
+class ValidMask
+{
+public:
+    // With a history only the rows it marked moved are rebuilt; the rest
+    // kept their validity since the last build.
+    void Build(const Pt* pts, int width, int height, ThreadPool& pool,
+        const TileHistory* history = nullptr);
+
+    bool IsValid(int x, int y) const
+    {
+        return (m_bits[(size_t)y * m_wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+    }
+
+    // First / last valid column in [x0, x1] of row y, or -1.
+    int FirstInRow(int y, int x0, int x1) const;
+    int LastInRow(int y, int x0, int x1) const;
+
+    int RowFirst(int y) const { return m_rowFirst[y]; }
+    int RowLast(int y) const { return m_rowLast[y]; }
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    int m_wordsPerRow = 0;
+    std::vector<uint64_t> m_bits;
+    // Width / -1 for rows with no valid pixel.
+    std::vector<int> m_rowFirst;
+    std::vector<int> m_rowLast;
+};
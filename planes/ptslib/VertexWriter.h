@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "Pt.h"
+#include "ptslib.h"
+
+// The layout the Pt* entry points write: separate arrays of three floats.
+inline VertexLayout PtLayout(Pt* positions, Pt* colors, Pt* normals)
+{
+    VertexLayout layout;
+    layout.position = VertexStream{ positions, (int)sizeof(Pt), VertexFloat3 };
+    layout.color = VertexStream{ colors, (int)sizeof(Pt), VertexFloat3 };
+    layout.normal = VertexStream{ normals, (int)sizeof(Pt), VertexFloat3 };
+    return layout;
+}
+
+inline uint8_t ToUnorm8(float v)
+{
+    return (uint8_t)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+inline int8_t ToSnorm8(float v)
+{
+    float scaled = std::min(std::max(v, -1.0f), 1.0f) * 127.0f;
+    // Normals' signs are random, so round half away from zero without a
+    // branch.
+    return (int8_t)(scaled + copysignf(0.5f, scaled));
+}
+
+// Writes value(i) for i in [0, count) to vertices [first, first + count)
+// of stream s. The format is switched on once per call, so callers write
+// whole runs of vertices at a time. w fills the fourth component of the
+// four-component formats, in [0, 1].
+template <typename Fn> void WriteVertices(const VertexStream& s, size_t first, int count, float w, Fn value)
+{
+    if (s.data == nullptr)
+        return;
+    unsigned char* dst = (unsigned char*)s.data + first * s.stride;
+    switch (s.format)
+    {
+    case VertexFloat3:
+        for (int i = 0; i < count; ++i, dst += s.stride)
+        {
+            Pt v = value(i);
+            float f[3] = { v.x, v.y, v.z };
+            memcpy(dst, f, sizeof(f));
+        }
+        break;
+    case VertexFloat4:
+        for (int i = 0; i < count; ++i, dst += s.stride)
+        {
+            Pt v = value(i);
+            float f[4] = { v.x, v.y, v.z, w };
+            memcpy(dst, f, sizeof(f));
+        }
+        break;
+    case VertexUnorm8x4:
+    {
+        uint8_t cw = ToUnorm8(w);
+        for (int i = 0; i < count; ++i, dst += s.stride)
+        {
+            Pt v = value(i);
+            uint8_t c[4] = { ToUnorm8(v.x), ToUnorm8(v.y), ToUnorm8(v.z), cw };
+            memcpy(dst, c, sizeof(c));
+        }
+        break;
+    }
+    case VertexSnorm8x4:
+    {
+        int8_t cw = ToSnorm8(w);
+        for (int i = 0; i < count; ++i, dst += s.stride)
+        {
+            Pt v = value(i);
+            int8_t c[4] = { ToSnorm8(v.x), ToSnorm8(v.y), ToSnorm8(v.z), cw };
+            memcpy(dst, c, sizeof(c));
+        }
+        break;
+    }
+    }
+}
+
+inline void WriteVertex(const VertexStream& s, size_t idx, float w, const Pt& v)
+{
+    WriteVertices(s, idx, 1, w, [&](int) { return v; });
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+// Work-stealing task queues run on a ThreadPool. Each worker pushes and
+// pops its own tasks at the back of its deque, so it keeps working depth
+// first on data it just touched; an idle worker steals from the front of
+// another worker's deque, where the oldest and usually largest tasks are.
+// The deques keep their storage between runs, and each is made room for
+// as many tasks as the largest run pushed, as any one of them may end up
+// with them all. So a reused set of queues stops allocating once it has
+// seen its largest task tree, however the tasks were stolen.
+template <typename Task> class StealingQueues
+{
+public:
+    StealingQueues() :
+        m_pending(0),
+        m_pushed(0),
+        m_mostPushed(0),
+        m_allocations(0)
+    {
+    }
+
+    explicit StealingQueues(int workerCount) :
+        StealingQueues()
+    {
+        Resize(workerCount);
+    }
+
+    // Only between runs.
+    void Resize(int workerCount)
+    {
+        while ((int)m_queues.size() < workerCount)
+            m_queues.emplace_back(new Queue());
+        m_queues.resize(workerCount);
+    }
+
+    int WorkerCount() const { return (int)m_queues.size(); }
+
+    // Times a deque's storage has grown.
+    unsigned long long Allocations() const { return m_allocations; }
+
+    void Push(int worker, const Task& task)
+    {
+        m_pending.fetch_add(1);
+        m_pushed.fetch_add(1, std::memory_order_relaxed);
+        Queue& queue = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+
+    // Calls fn(task, worker) for every pushed task, including tasks that
+    // fn pushes, and returns once all of them have finished.
+    template <typename Fn> void Run(ThreadPool& pool, Fn fn)
+    {
+        for (std::unique_ptr<Queue>& queue : m_queues)
+        {
+            if (queue->tasks.capacity() < m_mostPushed)
+            {
+                queue->tasks.reserve(m_mostPushed);
+                m_allocations++;
+            }
+        }
+        pool.Run(WorkerCount(), [&](int worker) { WorkerLoop(worker, fn); });
+        m_mostPushed = std::max(m_mostPushed, (size_t)m_pushed.exchange(0));
+    }
+
+private:
+    // tasks[head, size) are queued; stealing advances head, and the
+    // vector is rewound whenever it empties.
+    struct Queue
+    {
+        Queue() : head(0) {}
+
+        std::mutex mutex;
+        std::vector<Task> tasks;
+        size_t head;
+    };
+
+    bool Pop(int worker, Task& task)
+    {
+        Queue& queue = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.size() == queue.head)
+            return false;
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        if (queue.tasks.size() == queue.head)
+        {
+            queue.tasks.clear();
+            queue.head = 0;
+        }
+        return true;
+    }
+
+    bool Steal(int worker, Task& task)
+    {
+        int count = WorkerCount();
+        for (int offset = 1; offset < count; ++offset)
+        {
+            Queue& queue = *m_queues[(worker + offset) % count];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.size() == queue.head)
+                continue;
+            task = queue.tasks[queue.head++];
+            if (queue.tasks.size() == queue.head)
+            {
+                queue.tasks.clear();
+                queue.head = 0;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    template <typename Fn> void WorkerLoop(int worker, Fn& fn)
+    {
+        Task task;
+        for (;;)
+        {
+            if (Pop(worker, task) || Steal(worker, task))
+            {
+                fn(task, worker);
+                // Tasks push their children before they finish, so the
+                // count only reaches zero once the whole tree is done.
+                m_pending.fetch_sub(1);
+            }
+            else if (m_pending.load() == 0)
+                return;
+            else
+                std::this_thread::yield();
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::atomic<int> m_pending;
+    // Tasks pushed since the last run ended, and the most one run has had.
+    std::atomic<int> m_pushed;
+    size_t m_mostPushed;
+    unsigned long long m_allocations;
+};
@@ -0,0 +1,459 @@
+#pragma once
+
+#if defined(_WIN32)
+#define DEXPORT __declspec (dllexport)
+#else
+#define DEXPORT __attribute__((visibility("default")))
+#endif
+
+struct Pt;
+struct DepthContext;
+class MappedRecording;
+class DepthRecordingWriter;
+class DepthPipeline;
+
+enum PlaneFitMode
+{
+    // Plane through three of the tile's corner points, split on the max and
+    // mean distance of every point to it.
+    PlaneFitCorners = 0,
+    // Least-squares plane from a per-frame summed-area table of point
+    // moments, split when the RMS distance exceeds splitThreshold. Constant
+    // time per tile.
+    PlaneFitMoments = 1
+};
+
+enum NeighborSearch
+{
+    // Both find the same neighbours: tiles whose edges lie on the same
+    // line and share at least a pixel of it. Tiles that only meet at a
+    // corner are not neighbours.
+    // Leaf ids written along each tile's left and top edge, then every
+    // tile walks its right and bottom edge once. Linear in the tile count
+    // and perimeter, with its lists in the context's storage.
+    NeighborSearchGrid = 0,
+    // The original per-line std::map buckets and sorted sweep. Kept as a
+    // reference for the grid.
+    NeighborSearchSweep = 1
+};
+
+// One merged plane from the last DepthMakePlanes call, or one
+// DepthRansacPlanesCtx or DepthSegmentPlanesCtx plane, in camera space.
+struct PlaneDescriptor
+{
+    // Least-squares plane through the group's points: dot(normal, p) +
+    // offset = 0, with the unit normal facing the camera, so offset is the
+    // plane's distance from it.
+    float normal[3];
+    float offset;
+    float centroid[3];
+    // RMS point-to-plane distance.
+    float rmsDist;
+    // Total area of the group's quads, in square metres. RANSAC and
+    // segmented planes sum the footprint of their pixels.
+    float area;
+    // Valid points in the group's tiles, or the plane's pixels.
+    int inlierCount;
+    // Unit in-plane axes and the extent of the quad corners (RANSAC and
+    // segmented planes: points) along them, relative to the centroid.
+    float axisU[3];
+    float axisV[3];
+    float extentMin[2];
+    float extentMax[2];
+    // The group's tiles are outTiles[firstTile, firstTile + tileCount).
+    // RANSAC and segmented planes have none.
+    int firstTile;
+    int tileCount;
+    // Colour the group was drawn in.
+    float color[3];
+};
+
+// A member tile of a plane, in depth pixels.
+struct PlaneTile
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// Component formats of a VertexStream.
+enum VertexFormat
+{
+    // Three 32-bit floats.
+    VertexFloat3 = 0,
+    // Four 32-bit floats; w is 1 for positions and colours, 0 for normals.
+    VertexFloat4 = 1,
+    // Four bytes, [0, 1] scaled to 255; alpha is 255. For colours.
+    VertexUnorm8x4 = 2,
+    // Four signed bytes, [-1, 1] scaled to 127; w is 0. For normals.
+    VertexSnorm8x4 = 3
+};
+
+// One vertex attribute in caller memory, such as a mapped or pinned
+// vertex buffer: vertex i's value is written in format at
+// (char*)data + i * stride. A null data skips the attribute.
+struct VertexStream
+{
+    void* data;
+    int stride;
+    int format;
+};
+
+// Where the *LayoutCtx entry points write each vertex's attributes.
+// Streams may be separate buffers or point into one interleaved buffer
+// at different offsets with a common stride.
+struct VertexLayout
+{
+    VertexStream position;
+    VertexStream color;
+    VertexStream normal;
+};
+
+// Stages timed by SetContextInstrument.
+enum InstrumentStage
+{
+    InstrumentFilter = 0,
+    InstrumentNormals = 1,
+    // Incremental mode: finding the tiles whose points moved.
+    InstrumentTileHistory = 2,
+    // Validity mask and moment table for the tile scans.
+    InstrumentTileMasks = 3,
+    // Subdividing the frame into tiles, on all of the pool's threads.
+    InstrumentQuadtree = 4,
+    // Within the quadtree, per tile: finding its corners, and testing its
+    // points against the plane through them.
+    InstrumentCornerSearch = 5,
+    InstrumentResidualScan = 6,
+    // Dropping leaves whose quad is far larger than their pixels.
+    InstrumentCoverageFilter = 7,
+    InstrumentNeighbors = 8,
+    InstrumentMerge = 9,
+    InstrumentOutput = 10,
+    InstrumentStageCount = 11
+};
+
+// One frame as SetContextInstrument saw it.
+struct DepthInstrumentStats
+{
+    // Frames completed since instrumentation was turned on, this one
+    // included.
+    long long frame;
+    // Milliseconds per InstrumentStage. Corner search and residual scans
+    // are summed over every tile and thread, so they can exceed the
+    // quadtree's wall time; the rest are wall time.
+    float stageMs[InstrumentStageCount];
+    // Quadtree tiles walked, including those replayed from the
+    // incremental history; none when the whole tree is replayed.
+    long long tilesVisited;
+    long long splits;
+    // Tiles accepted as planes.
+    long long leaves;
+    // Points the residual scans and the coarse split test read.
+    long long pixelsScanned;
+    long long coverageRejected;
+    // Pairs of neighbouring leaves, and those on the same plane.
+    long long neighborEdges;
+    long long samePlaneEdges;
+    long long mergedGroups;
+};
+
+// The stages of a DepthPipeline, each on a thread of its own.
+enum PipelineStage
+{
+    // DepthFindNormalsCtx.
+    PipelineNormals = 0,
+    // Tile fits and the quadtree, from the incremental history if on.
+    PipelineQuadtree = 1,
+    // Neighbour search and merging tiles into groups.
+    PipelineMerge = 2,
+    // Triangles into the frame's output buffers.
+    PipelineOutput = 3,
+    PipelineStageCount = 4
+};
+
+// A frame PollDepthFrame handed back.
+struct DepthFrameStatus
+{
+    long long frameId;
+    // Vertices written to the frame's outVertices.
+    int vertexCount;
+    // Per stage, milliseconds from the previous stage finishing the frame
+    // (for the first, from SubmitDepthFrame) to this one starting it, and
+    // milliseconds it took.
+    float waitMs[PipelineStageCount];
+    float stageMs[PipelineStageCount];
+    // SubmitDepthFrame to the output stage finishing.
+    float latencyMs;
+};
+
+extern "C"
+{
+    // Context handle API. A context owns all scratch memory for one depth
+    // stream of the given resolution; separate contexts may be used
+    // concurrently from different threads.
+    DEXPORT DepthContext* CreateDepthContext(int depthWidth, int depthHeight);
+    DEXPORT void DestroyDepthContext(DepthContext* ctx);
+    DEXPORT void SetContextPlaneConstants(DepthContext* ctx, float minDist, float splitThreshold,
+        float minDPVal);
+    // Vectorized kernels and mask-based tile scans are on by default; 0 selects
+    // the scalar reference path.
+    DEXPORT void SetContextSimd(DepthContext* ctx, int enable);
+    // With SIMD on and PlaneFitCorners, tiles at least 32 pixels across
+    // are first tested on a grid of 16 of their points across: one further
+    // than minDist from the tile's plane splits the tile without the
+    // full-resolution scan, which then only runs for tiles that may be
+    // accepted. The output is the same either way. On by default; 0 turns
+    // it off.
+    DEXPORT void SetContextCoarseSplit(DepthContext* ctx, int enable);
+    // Threads used by the row-banded kernels and the plane quadtree, 0 (the
+    // default) for one per core. Results do not depend on the thread count.
+    DEXPORT void SetContextThreadCount(DepthContext* ctx, int threadCount);
+    // One of PlaneFitMode, PlaneFitCorners by default.
+    DEXPORT void SetContextPlaneFit(DepthContext* ctx, int planeFit);
+    // One of NeighborSearch, NeighborSearchGrid by default.
+    DEXPORT void SetContextNeighborSearch(DepthContext* ctx, int neighborSearch);
+    // Reuse the previous frame's quadtree: tiles none of whose points moved
+    // more than moveThreshold metres in depth (or became valid or invalid)
+    // since they were last fit keep their split decision and plane without
+    // being scanned. With NeighborSearchGrid their neighbour pairs and
+    // groups are kept too, and only re-fit tiles are searched and merged;
+    // the sweep searches every frame in full. The groups are the same
+    // either way. 0, the default, fits every frame from scratch. Changing
+    // the constants, fit mode or SIMD setting starts over.
+    DEXPORT void SetContextIncremental(DepthContext* ctx, float moveThreshold);
+    // Per-stage timers and counters for the context's frames, off by
+    // default. A frame's stages run from the end of the previous
+    // DepthMakePlanesCtx (or mesh) call through the end of its own.
+    // maxTraceEvents > 0 also keeps up to that many trace events for
+    // WriteContextTrace; turning instrumentation on again starts a new
+    // trace. Off, the stages only test a flag and the tiles bump their
+    // counters.
+    DEXPORT void SetContextInstrument(DepthContext* ctx, int enable, int maxTraceEvents);
+    // The last completed frame. Returns 0 if none has completed since
+    // instrumentation was turned on.
+    DEXPORT int GetContextStats(DepthContext* ctx, DepthInstrumentStats* outStats);
+    // The trace as Chrome trace-event JSON, for chrome://tracing or
+    // Perfetto: a complete event for each stage run, on the thread that
+    // ran it, and a counter event per frame. Events past maxTraceEvents
+    // were dropped. Returns 0 if the file cannot be written.
+    DEXPORT int WriteContextTrace(DepthContext* ctx, const char* path);
+    // "avx2", "sse", "neon" or "scalar".
+    DEXPORT const char* GetSimdBackend();
+    // Times the context's per-frame DepthMakePlanes storage has grown:
+    // tiles, results, neighbour lists, groups and the subdivision queues.
+    // Every worker gets room for the largest frame's whole tree, so this
+    // stops increasing once the context has seen its largest frame,
+    // however the work was shared between threads. From then on the
+    // DepthMakePlanes*Ctx calls make no heap allocations at all.
+    DEXPORT unsigned long long GetContextAllocationCount(DepthContext* ctx);
+
+    // Per-pixel camera-space rays for DepthUnprojectCtx: width * height
+    // (x / z, y / z) pairs, the layout of the Kinect CoordinateMapper's
+    // GetDepthFrameToCameraSpaceTable. The table is copied; null clears it.
+    DEXPORT void SetContextDepthRays(DepthContext* ctx, const float* rays);
+    // Camera-space points from raw millimetre depth (the buffer
+    // DepthFindEdgesCtx takes) and the context's rays, in the layout the
+    // other entry points read. Pixels with no depth are -inf, as from
+    // MapDepthFrameToCameraSpace. Returns 0 if no rays have been set.
+    DEXPORT int DepthUnprojectCtx(DepthContext* ctx, const unsigned short* dbuf, float* outPts);
+
+    // DepthFilterPointsCtx smoothing taps on either side of a pixel (default
+    // 2, at most 4, 0 for none), the depth difference past which a tap is
+    // ignored as a fraction of the pixel's depth (0.02), the difference
+    // within which a neighbour supports a pixel, likewise (0.03), and the
+    // supporting neighbours of 8 a pixel needs to be kept (3, 0 for all).
+    DEXPORT void SetContextFilter(DepthContext* ctx, int radius, float rangeRatio, float flyingJump,
+        int flyingSupport);
+    // Edge-preserving pre-filter for the points the other entry points
+    // take, so noise and flying pixels do not split tiles. Flying pixels,
+    // those with too few neighbours at about their depth (the mixed
+    // samples the Kinect returns along silhouettes), become invalid; the
+    // rest are smoothed along rows then columns with a binomial kernel
+    // whose taps are weighted down to nothing across depth steps, and
+    // moved along their rays to the result. Vectorized and run in bands
+    // on the context's threads; results do not depend on the thread
+    // count. outPts may be vals.
+    DEXPORT void DepthFilterPointsCtx(DepthContext* ctx, const float* vals, float* outPts);
+    // Depth discontinuities in one pass over the raw depth. outMask gets a
+    // bit per pixel, set where the depth steps by more than about 55 mm:
+    // (depthWidth + 63) / 64 words per row, pixel x in bit x % 64 of word
+    // x / 64. outpts, if not null, gets the DepthFindEdgesCtx
+    // visualization as well; outMask may be null too.
+    DEXPORT void DepthFindEdgeMaskCtx(DepthContext* ctx, const unsigned short* dbuf,
+        unsigned long long* outMask, float* outpts);
+    // Three floats per pixel: 0, then the squared first and second depth
+    // differences less 3000, so edges are positive.
+    DEXPORT void DepthFindEdgesCtx(DepthContext* ctx, unsigned short* dbuf, float* outpts);
+    // outpts may be null when only the normals DepthMakePlanesCtx and
+    // the plane finders read are wanted.
+    DEXPORT void DepthFindNormalsCtx(DepthContext* ctx, float* vals, float* outpts, int px, int py);
+    // DepthFindNormalsCtx straight into vertex buffers, one vertex per
+    // pixel in row order: the point, its unit normal (zero where it has
+    // none, including the frame border) and DepthFindNormalsCtx's colour
+    // for it, written for every pixel.
+    DEXPORT void DepthFindNormalsLayoutCtx(DepthContext* ctx, float* vals, const VertexLayout* layout,
+        int px, int py);
+    DEXPORT void DepthMakePlanesCtx(DepthContext* ctx, float* vals, Pt* outVertices, Pt* outTexCoords,
+        int maxCount, int* outCount, int pickX, int pickY);
+    // DepthMakePlanesCtx into the layout's streams: the positions and
+    // colours it writes to outVertices and outTexCoords, and each tile's
+    // plane normal, facing the camera.
+    DEXPORT void DepthMakePlanesLayoutCtx(DepthContext* ctx, float* vals, const VertexLayout* layout, int maxCount,
+        int* outCount, int pickX, int pickY);
+    // Describes the planes the last DepthMakePlanesCtx or
+    // DepthMakePlaneMeshCtx call on ctx merged, one per group in output
+    // order; vals must be the points that call was given. Planes whose
+    // tiles do not fit in outTiles are left out.
+    DEXPORT void DepthDescribePlanesCtx(DepthContext* ctx, float* vals, PlaneDescriptor* outPlanes,
+        int maxPlanes, int* outPlaneCount, PlaneTile* outTiles, int maxTiles, int* outTileCount);
+    // The pairs of neighbouring tiles ctx's neighbour search finds among
+    // the tiles DepthMakePlanesCtx would fit to vals, for checking one
+    // search against the other. A pair is its tiles' top-left pixel
+    // indices, smaller first, in no particular order. outPairCount gets
+    // every pair found; only the first maxPairs are written.
+    DEXPORT void DepthPlaneNeighborsCtx(DepthContext* ctx, float* vals, int* outPairs, int maxPairs,
+        int* outPairCount);
+    // DepthRansacPlanesCtx inlier distance in metres (default 0.02), min
+    // |dot| of an inlier's normal with the plane's (0.7), smallest plane
+    // in points (2000), hypotheses per plane at most (1000) and the
+    // confidence the iteration count adapts to (0.99).
+    DEXPORT void SetContextRansac(DepthContext* ctx, float inlierDist, float inlierMinDot,
+        int minInliers, int maxIterations, float confidence);
+    // Planes found by RANSAC rather than the quadtree, for clouds too
+    // noisy or fragmented for tiles to fit. vals must be the points the
+    // last DepthFindNormalsCtx call on ctx was given. Hypotheses are
+    // planes through three nearby points whose normals all agree with
+    // them to the minDPVal plane constant. Planes are extracted largest
+    // first, each from batches of hypotheses scored on all of the pool's
+    // threads, and extraction stops when the best hypothesis left could
+    // not reach minInliers. outLabels, if not null, gets each pixel's
+    // plane index or -1. Results do not depend on the thread count.
+    DEXPORT void DepthRansacPlanesCtx(DepthContext* ctx, float* vals, PlaneDescriptor* outPlanes,
+        int maxPlanes, int* outPlaneCount, int* outLabels);
+    // DepthSegmentPlanesCtx min |dot| of a pixel's normal with its
+    // region's plane (default 0.8), max distance of its point from the
+    // plane in metres (0.02) and smallest region in pixels (500).
+    DEXPORT void SetContextSegment(DepthContext* ctx, float minNormalDot, float maxPlaneDist,
+        int minPoints);
+    // Planes by region growing over the normal map, for scenes the
+    // quadtree over-splits. vals must be the points the last
+    // DepthFindNormalsCtx call on ctx was given. Unlabelled pixels seed
+    // regions in raster order; a region takes the unlabelled 4-connected
+    // pixels whose normal and point are close to its plane, which is
+    // refit each time the region doubles. Regions smaller than minPoints
+    // are left out. One single-threaded pass; outLabels, if not null,
+    // gets each pixel's plane index or -1.
+    DEXPORT void DepthSegmentPlanesCtx(DepthContext* ctx, float* vals, PlaneDescriptor* outPlanes,
+        int maxPlanes, int* outPlaneCount, int* outLabels);
+    // DepthMakePlanesCtx as an indexed mesh. Within a merged group, rows
+    // and columns of tiles are joined into larger quads, spanned between
+    // the outer tiles' corners, and corners found at the same pixel share
+    // a vertex. Each group gets one colour, the
+    // one DepthMakePlanesCtx would use:
+    // group g is the triangles at
+    // outIndices[outGroupIndexStarts[g], outGroupIndexStarts[g + 1]),
+    // drawn in outGroupColors[g], so outGroupIndexStarts needs
+    // maxGroups + 1 entries. The picked tile comes last as a white group
+    // of its own. Groups that do not fit in the buffers are left out, and
+    // later, smaller ones still added.
+    DEXPORT void DepthMakePlaneMeshCtx(DepthContext* ctx, float* vals,
+        Pt* outVertices, int maxVertices, int* outVertexCount,
+        unsigned int* outIndices, int maxIndices, int* outIndexCount,
+        Pt* outGroupColors, int* outGroupIndexStarts, int maxGroups, int* outGroupCount,
+        int pickX, int pickY);
+    // DepthMakePlaneMeshCtx with vertices written to the layout: each also
+    // gets its group's colour and the camera-facing normal of a tile it
+    // is a corner of, so the group arrays are only needed for drawing
+    // groups separately. outIndices may be a mapped index buffer too.
+    DEXPORT void DepthMakePlaneMeshLayoutCtx(DepthContext* ctx, float* vals,
+        const VertexLayout* layout, int maxVertices, int* outVertexCount,
+        unsigned int* outIndices, int maxIndices, int* outIndexCount,
+        Pt* outGroupColors, int* outGroupIndexStarts, int maxGroups, int* outGroupCount,
+        int pickX, int pickY);
+
+    // DepthFindNormalsCtx and DepthMakePlanesCtx (without a pick) for a
+    // stream of frames, with the stages of consecutive frames overlapped
+    // on separate threads. At most maxInFlight frames are submitted and
+    // not yet polled; each has a context of its own, whose kernels run on
+    // its stage's thread. Returns null for a zero size or maxInFlight.
+    // Destroying the pipeline abandons frames in flight, but no stage
+    // touches their buffers after it returns.
+    DEXPORT DepthPipeline* CreateDepthPipeline(int depthWidth, int depthHeight, int maxInFlight);
+    DEXPORT void DestroyDepthPipeline(DepthPipeline* pipeline);
+    // Context of slot [0, maxInFlight), for settings; frame n of the
+    // stream runs in slot n % maxInFlight. Set every slot's context the
+    // same way, and only while no frame is in flight. With
+    // SetContextIncremental each slot reuses the quadtree of the frame
+    // maxInFlight before, not the previous one.
+    DEXPORT DepthContext* GetPipelineContext(DepthPipeline* pipeline, int slot);
+    // Queues a frame without blocking. vals, outNormals (DepthFindNormalsCtx
+    // colours, may be null), outVertices and outTexCoords (maxCount each)
+    // belong to the caller and must stay valid and unchanged, except by
+    // the pipeline, until the frame is polled. Returns 0, queueing
+    // nothing, if maxInFlight frames are in flight.
+    DEXPORT int SubmitDepthFrame(DepthPipeline* pipeline, long long frameId, float* vals, float* outNormals,
+        Pt* outVertices, Pt* outTexCoords, int maxCount);
+    // SubmitDepthFrame with the planes written as DepthMakePlanesLayoutCtx
+    // does. The layout is copied; the memory it points to must stay valid
+    // until the frame is polled.
+    DEXPORT int SubmitDepthFrameLayout(DepthPipeline* pipeline, long long frameId, float* vals, float* outNormals,
+        const VertexLayout* layout, int maxCount);
+    // Frames complete in submission order. Returns 1 and fills outStatus
+    // once the oldest frame in flight is done, after which its buffers are
+    // the caller's again; with wait set, blocks until it is. Returns 0 if
+    // no frame is in flight or, without wait, the oldest is not done.
+    DEXPORT int PollDepthFrame(DepthPipeline* pipeline, int wait, DepthFrameStatus* outStatus);
+
+    // Memory-mapped depth.out reader. Opening reads only the timestamps;
+    // frames are zero-copy views into the file that stay valid until the
+    // recording is closed and can be passed straight to the entry points
+    // above, which only read their input. With prefetchFrames > 0 a
+    // background thread keeps that many frames after the last one fetched
+    // resident and releases older ones, so memory stays bounded.
+    // Compressed recordings are detected and decoded instead, ahead of
+    // time by the same thread; their frames stay valid until two more
+    // frames have been fetched, so only while a single thread fetches.
+    // Threads reading one recording at once use ReadRecordingFrame.
+    DEXPORT MappedRecording* OpenDepthRecording(const char* path, int depthWidth, int depthHeight,
+        int prefetchFrames);
+    DEXPORT void CloseDepthRecording(MappedRecording* rec);
+    DEXPORT int GetRecordingFrameCount(MappedRecording* rec);
+    DEXPORT long long GetRecordingTimestamp(MappedRecording* rec, int frameIdx);
+    // Last frame at or before timestamp.
+    DEXPORT int FindRecordingFrame(MappedRecording* rec, long long timestamp);
+    DEXPORT const float* GetRecordingFrame(MappedRecording* rec, int frameIdx);
+    // Copies the frame's width * height points to outPts. Any number of
+    // threads may call it at once. Returns 0 if frameIdx is out of range.
+    DEXPORT int ReadRecordingFrame(MappedRecording* rec, int frameIdx, float* outPts);
+
+    // Compressed recording writer: 16-bit millimetre depth plus a per-pixel
+    // ray table, about 20x smaller than depth.out. Depth is lossless;
+    // points read back as ray * depth. WriteDepthRecordingFrame returns 0
+    // on a write error.
+    DEXPORT DepthRecordingWriter* OpenDepthRecordingWriter(const char* path, int depthWidth,
+        int depthHeight);
+    DEXPORT int WriteDepthRecordingFrame(DepthRecordingWriter* writer, long long timestamp,
+        const float* pts);
+    DEXPORT void CloseDepthRecordingWriter(DepthRecordingWriter* writer);
+
+    // Legacy entry points, backed by a shared default context.
+    DEXPORT void SetPlaneConstants(float minDist, float splitThreshold, float minDPVal);
+    DEXPORT void DepthFindEdges(unsigned short* dbuf, float* outpts, int depthWidth, int depthHeight);
+    DEXPORT void DepthFindNormals(float* vals, float* outpts, int px, int py, int depthWidth, int depthHeight);
+    DEXPORT void DepthMakePlanes(float* vals, Pt* outVertices, Pt* outTexCoords, int maxCount, int* outCount,
+        int pickX, int pickY,
+        int depthWidth, int depthHeight);
+    DEXPORT void DepthMakePlaneMesh(float* vals, Pt* outVertices, int maxVertices, int* outVertexCount,
+        unsigned int* outIndices, int maxIndices, int* outIndexCount,
+        Pt* outGroupColors, int* outGroupIndexStarts, int maxGroups, int* outGroupCount,
+        int pickX, int pickY, int depthWidth, int depthHeight);
+    DEXPORT void DepthFindNormalsLayout(float* vals, const VertexLayout* layout, int px, int py,
+        int depthWidth, int depthHeight);
+    DEXPORT void DepthMakePlanesLayout(float* vals, const VertexLayout* layout, int maxCount, int* outCount,
+        int pickX, int pickY, int depthWidth, int depthHeight);
+    DEXPORT void DepthMakePlaneMeshLayout(float* vals, const VertexLayout* layout, int maxVertices,
+        int* outVertexCount, unsigned int* outIndices, int maxIndices, int* outIndexCount,
+        Pt* outGroupColors, int* outGroupIndexStarts, int maxGroups, int* outGroupCount,
+        int pickX, int pickY, int depthWidth, int depthHeight);
+}